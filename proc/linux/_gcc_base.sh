@@ -50,3 +50,18 @@ src=(
 build_cmd="gcc ${inc[*]} ${src[*]} ${flags[*]} ${libs[*]} -o ${proj_name}"
 echo ${build_cmd}
 ${build_cmd}
+
+if [ "$?" -ne "0" ]; then
+	exit 1
+fi
+
+# Build trace benchmark
+proj_name=tracebench
+echo Building ${proj_name}...
+src=(
+	../src/trace_bench.c
+	../src/**/*.c
+)
+build_cmd="gcc ${inc[*]} ${src[*]} ${flags[*]} ${libs[*]} -o ${proj_name}"
+echo ${build_cmd}
+${build_cmd}
@@ -11,17 +11,27 @@
 =================================================================*/
 
 #include "bsp_map.h"
+#include "bsp_occlusion.h"
+#include "bsp_optimize.h"
+#include "bsp_trace.h"
 #include "../game/config.h"
 #include "../game/time_manager.h"
 #include "../graphics/renderer.h"
 #include "../graphics/texture_manager.h"
 #include "../util/camera.h"
+#include "../util/packing.h"
 #include "../util/render.h"
 #include "../util/transform.h"
 
 void bsp_map_init(bsp_map_t *map)
 {
 	map->previous_leaf = uint32_max;
+	// Force PVS rebuild on first update
+	map->pvs_cluster = INT32_MIN;
+	map->camera_area = INT32_MIN;
+	map->packed_vertices = mg_cvar("r_packed_vertices")->value.i;
+
+	bsp_trace_init(map);
 
 	// Init dynamic arrays
 	gs_dyn_array_reserve(map->render_faces, map->faces.count);
@@ -34,9 +44,63 @@ void bsp_map_init(bsp_map_t *map)
 		}
 	}
 	gs_dyn_array_reserve(map->patches, patch_count);
+	gs_dyn_array_reserve(map->pvs_leaves, map->leaves.count);
+	gs_dyn_array_reserve(map->pvs_faces, map->faces.count);
+	gs_dyn_array_reserve(map->node_pvs_leaves, map->nodes.count);
+	gs_dyn_array_reserve(map->node_parents, map->nodes.count);
+	gs_dyn_array_reserve(map->leaf_parents, map->leaves.count);
+	gs_dyn_array_reserve(map->vis_stack, 64);
+	gs_dyn_array_reserve(map->vis_leaves, map->leaves.count);
+	gs_dyn_array_reserve(map->visible_faces, map->faces.count);
+
+	// Float leaf bounds for the culling kernel
+	_bsp_bounds_soa_alloc(&map->leaf_bounds, map->leaves.count);
+	_bsp_bounds_soa_alloc(&map->vis_test_bounds, map->leaves.count);
+	map->vis_test_results = gs_malloc(map->leaves.count > 0 ? map->leaves.count : 1);
+	for (size_t i = 0; i < map->leaves.count; i++)
+	{
+		bsp_leaf_lump_t lump	  = map->leaves.data[i];
+		map->leaf_bounds.min_x[i] = lump.mins[0];
+		map->leaf_bounds.min_y[i] = lump.mins[1];
+		map->leaf_bounds.min_z[i] = lump.mins[2];
+		map->leaf_bounds.max_x[i] = lump.maxs[0];
+		map->leaf_bounds.max_y[i] = lump.maxs[1];
+		map->leaf_bounds.max_z[i] = lump.maxs[2];
+	}
+
+	// Parent links for marking PVS nodes,
+	// node 0 is the root of the world model.
+	gs_dyn_array_head(map->node_pvs_leaves)->size = map->nodes.count;
+	gs_dyn_array_head(map->node_parents)->size    = map->nodes.count;
+	gs_dyn_array_head(map->leaf_parents)->size    = map->leaves.count;
+	for (size_t i = 0; i < map->nodes.count; i++)
+	{
+		map->node_pvs_leaves[i] = 0;
+		map->node_parents[i]	= -1;
+	}
+	for (size_t i = 0; i < map->leaves.count; i++)
+	{
+		map->leaf_parents[i] = -1;
+	}
+	for (size_t i = 0; i < map->nodes.count; i++)
+	{
+		for (size_t j = 0; j < 2; j++)
+		{
+			int32_t child = map->nodes.data[i].children[j];
+			if (child >= 0)
+			{
+				map->node_parents[child] = i;
+			}
+			else
+			{
+				map->leaf_parents[~child] = i;
+			}
+		}
+	}
 
 	// Load stuff
 	_bsp_load_entities(map);
+	_bsp_load_area_portals(map);
 	_bsp_load_textures(map);
 	_bsp_load_lightmaps(map);
 	_bsp_load_lightvols(map);
@@ -65,11 +129,50 @@ void bsp_map_init(bsp_map_t *map)
 			face_array_idx++;
 		}
 
+		face.surface_class = _bsp_classify_surface(map, map->faces.data[i].texture);
+
+		if (face.type == BSP_FACE_TYPE_POLYGON)
+		{
+			bsp_face_lump_t lump = map->faces.data[i];
+			face.normal	     = lump.normal;
+			face.dist	     = gs_vec3_dot(lump.normal, map->vertices.data[lump.first_vertex].position);
+			face.two_sided	     = _bsp_face_is_two_sided(map, lump);
+		}
+
+		// Patch bounds are known after tesselation
+		if (face.type != BSP_FACE_TYPE_PATCH && map->faces.data[i].num_vertices > 0)
+		{
+			bsp_face_lump_t lump = map->faces.data[i];
+			face.mins	     = map->vertices.data[lump.first_vertex].position;
+			face.maxs	     = face.mins;
+			for (size_t j = 1; j < lump.num_vertices; j++)
+			{
+				gs_vec3 position = map->vertices.data[lump.first_vertex + j].position;
+				face.mins	 = gs_v3(gs_min(face.mins.x, position.x), gs_min(face.mins.y, position.y), gs_min(face.mins.z, position.z));
+				face.maxs	 = gs_v3(gs_max(face.maxs.x, position.x), gs_max(face.maxs.y, position.y), gs_max(face.maxs.z, position.z));
+			}
+		}
+
 		gs_dyn_array_push(map->render_faces, face);
 	}
 
+	_bsp_tesselate_patches(map);
+
+	for (size_t i = 0; i < gs_dyn_array_size(map->render_faces); i++)
+	{
+		bsp_face_renderable_t *face = &map->render_faces[i];
+		if (face->type == BSP_FACE_TYPE_PATCH)
+		{
+			face->mins = map->patches[face->index].mins;
+			face->maxs = map->patches[face->index].maxs;
+		}
+	}
+
 	// Index & Vertex buffers
 	_bsp_map_create_buffers(map);
+	_bsp_create_materials(map);
+	_bsp_create_submodels(map);
+	bsp_occlusion_init(&map->occlusion, map);
 
 	// Create uniforms
 	map->bsp_graphics_u_proj = gs_graphics_uniform_create(
@@ -80,6 +183,14 @@ void bsp_map_init(bsp_map_t *map)
 			},
 			.stage = GS_GRAPHICS_SHADER_STAGE_VERTEX,
 		});
+	map->bsp_graphics_u_model = gs_graphics_uniform_create(
+		&(gs_graphics_uniform_desc_t){
+			.name	= "u_model",
+			.layout = &(gs_graphics_uniform_layout_desc_t){
+				.type = GS_GRAPHICS_UNIFORM_MAT4,
+			},
+			.stage = GS_GRAPHICS_SHADER_STAGE_VERTEX,
+		});
 	map->bsp_graphics_u_tex = gs_graphics_uniform_create(
 		&(gs_graphics_uniform_desc_t){
 			.name	= "u_tex",
@@ -114,16 +225,57 @@ void bsp_map_init(bsp_map_t *map)
 		(gs_graphics_vertex_attribute_desc_t){.format = GS_GRAPHICS_VERTEX_ATTRIBUTE_FLOAT3, .name = "a_normal", .stride = total_stride, .offset = sizeof(float32_t) * 7},
 		(gs_graphics_vertex_attribute_desc_t){.format = GS_GRAPHICS_VERTEX_ATTRIBUTE_BYTE4, .name = "a_color", .stride = total_stride, .offset = sizeof(float32_t) * 10},
 	};
+	gs_graphics_vertex_attribute_desc_t packed_vattrs[] = {
+		(gs_graphics_vertex_attribute_desc_t){.format = GS_GRAPHICS_VERTEX_ATTRIBUTE_FLOAT3, .name = "a_pos", .stride = sizeof(bsp_packed_vert_t), .offset = 0},
+		(gs_graphics_vertex_attribute_desc_t){.format = GS_GRAPHICS_VERTEX_ATTRIBUTE_UINT3, .name = "a_packed", .stride = sizeof(bsp_packed_vert_t), .offset = sizeof(float32_t) * 3},
+	};
+	gs_graphics_vertex_attribute_desc_t *layout = map->packed_vertices ? packed_vattrs : vattrs;
+	size_t layout_size			    = map->packed_vertices ? sizeof(packed_vattrs) : sizeof(vattrs);
 
+	char *shader_opaque	 = map->packed_vertices ? "bsp_packed" : "bsp";
+	char *shader_alpha_test	 = map->packed_vertices ? "bsp_packed_alpha_test" : "bsp_alpha_test";
+	char *shader_translucent = map->packed_vertices ? "bsp_packed_translucent" : "bsp_translucent";
+
+	// Opaque and alpha tested surfaces don't blend
 	map->bsp_graphics_pipe = gs_graphics_pipeline_create(
 		&(gs_graphics_pipeline_desc_t){
 			.raster = {
-				.shader			   = mg_renderer_get_shader("bsp"),
+				.shader			   = mg_renderer_get_shader(shader_opaque),
 				.index_buffer_element_size = sizeof(uint32_t),
 				.primitive		   = GS_GRAPHICS_PRIMITIVE_TRIANGLES,
 				.face_culling		   = GS_GRAPHICS_FACE_CULLING_BACK,
 				.winding_order		   = GS_GRAPHICS_WINDING_ORDER_CW,
 			},
+			.depth = {
+				.func = GS_GRAPHICS_DEPTH_FUNC_LESS,
+			},
+			.layout = {
+				.attrs = layout,
+				.size  = layout_size,
+			},
+		});
+	map->bsp_graphics_alpha_test_pipe = gs_graphics_pipeline_create(
+		&(gs_graphics_pipeline_desc_t){
+			.raster = {
+				.shader			   = mg_renderer_get_shader(shader_alpha_test),
+				.index_buffer_element_size = sizeof(uint32_t),
+				.primitive		   = GS_GRAPHICS_PRIMITIVE_TRIANGLES,
+			},
+			.depth = {
+				.func = GS_GRAPHICS_DEPTH_FUNC_LESS,
+			},
+			.layout = {
+				.attrs = layout,
+				.size  = layout_size,
+			},
+		});
+	map->bsp_graphics_translucent_pipe = gs_graphics_pipeline_create(
+		&(gs_graphics_pipeline_desc_t){
+			.raster = {
+				.shader			   = mg_renderer_get_shader(shader_translucent),
+				.index_buffer_element_size = sizeof(uint32_t),
+				.primitive		   = GS_GRAPHICS_PRIMITIVE_TRIANGLES,
+			},
 			.blend = {
 				.func = GS_GRAPHICS_BLEND_EQUATION_ADD,
 				.src  = GS_GRAPHICS_BLEND_MODE_SRC_ALPHA,
@@ -133,8 +285,8 @@ void bsp_map_init(bsp_map_t *map)
 				.func = GS_GRAPHICS_DEPTH_FUNC_LESS,
 			},
 			.layout = {
-				.attrs = vattrs,
-				.size  = sizeof(vattrs),
+				.attrs = layout,
+				.size  = layout_size,
 			},
 		});
 	map->bsp_graphics_wire_pipe = gs_graphics_pipeline_create(
@@ -153,16 +305,17 @@ void bsp_map_init(bsp_map_t *map)
 				.func = GS_GRAPHICS_DEPTH_FUNC_LESS,
 			},
 			.layout = {
-				.attrs = vattrs,
-				.size  = sizeof(vattrs),
+				.attrs = layout,
+				.size  = layout_size,
 			},
 		});
 
 	// Static stats
-	map->stats.total_vertices = gs_dyn_array_size(map->bsp_graphics_vert_arr); // inaccurate, has patch control verts
+	map->stats.total_vertices = gs_dyn_array_size(map->bsp_graphics_vert_arr);
 	map->stats.total_indices  = gs_dyn_array_size(map->bsp_graphics_index_arr);
 	map->stats.total_faces	  = face_array_idx;
 	map->stats.total_patches  = patch_array_idx;
+	map->stats.total_materials = gs_dyn_array_size(map->materials);
 }
 
 void _bsp_load_entities(bsp_map_t *map)
@@ -186,6 +339,371 @@ void _bsp_load_entities(bsp_map_t *map)
 	gs_free(ents);
 }
 
+// Doors touching two areas connect them, closed unless spawned open.
+// Other movers such as platforms never block visibility.
+void _bsp_load_area_portals(bsp_map_t *map)
+{
+	map->num_areas = 0;
+	for (size_t i = 0; i < map->leaves.count; i++)
+	{
+		map->num_areas = gs_max(map->num_areas, map->leaves.data[i].area + 1);
+	}
+
+	map->area_visible = gs_malloc(map->num_areas > 0 ? map->num_areas : 1);
+	map->area_stack	  = gs_malloc(sizeof(int32_t) * (map->num_areas > 0 ? map->num_areas : 1));
+	memset(map->area_visible, 1, map->num_areas);
+
+	if (map->num_areas < 2 || map->nodes.count == 0)
+	{
+		return;
+	}
+
+	for (size_t i = 0; i < gs_dyn_array_size(map->entities); i++)
+	{
+		char *classname = bsp_entity_get_value(&map->entities[i], "classname");
+		char *model	= bsp_entity_get_value(&map->entities[i], "model");
+		if (classname == NULL || strncmp(classname, "func_door", strlen("func_door")) != 0 || model == NULL || model[0] != '*')
+		{
+			continue;
+		}
+
+		int32_t model_index = strtol(model + 1, NULL, 10);
+		if (model_index <= 0 || model_index >= map->models.count)
+		{
+			continue;
+		}
+
+		// Slightly larger so leaves on both sides are touched
+		bsp_model_lump_t lump = map->models.data[model_index];
+		gs_vec3 mins	      = gs_vec3_sub(lump.mins, gs_v3(1.0f, 1.0f, 1.0f));
+		gs_vec3 maxs	      = gs_vec3_add(lump.maxs, gs_v3(1.0f, 1.0f, 1.0f));
+
+		int32_t areas[3];
+		uint32_t count = 0;
+		_bsp_box_areas(map, 0, mins, maxs, areas, &count);
+
+		if (count < 2)
+		{
+			continue;
+		}
+
+		if (count > 2)
+		{
+			mg_println("WARN: brush model %d touches more than 2 areas", model_index);
+		}
+
+		char *spawnflags = bsp_entity_get_value(&map->entities[i], "spawnflags");
+		bool32_t open	 = spawnflags != NULL && (strtol(spawnflags, NULL, 10) & BSP_DOOR_START_OPEN) != 0;
+		gs_dyn_array_push(map->area_portals, ((bsp_area_portal_t){.model = model_index, .areas = {areas[0], areas[1]}, .open = open}));
+	}
+}
+
+// 1 if the box is in front of the plane, 2 if behind, 3 if crossing
+static inline int32_t _bsp_box_on_plane_side(const bsp_plane_lump_t plane, const gs_vec3 mins, const gs_vec3 maxs)
+{
+	// Box corners nearest and farthest along the plane normal
+	float32_t near = plane.normal.x * (plane.normal.x < 0 ? maxs.x : mins.x)
+			 + plane.normal.y * (plane.normal.y < 0 ? maxs.y : mins.y)
+			 + plane.normal.z * (plane.normal.z < 0 ? maxs.z : mins.z);
+	float32_t far = plane.normal.x * (plane.normal.x < 0 ? mins.x : maxs.x)
+			+ plane.normal.y * (plane.normal.y < 0 ? mins.y : maxs.y)
+			+ plane.normal.z * (plane.normal.z < 0 ? mins.z : maxs.z);
+
+	if (near >= plane.dist) return 1;
+	if (far < plane.dist) return 2;
+	return 3;
+}
+
+// Collect up to 3 distinct areas of leaves touching the box
+void _bsp_box_areas(bsp_map_t *map, int32_t node, const gs_vec3 mins, const gs_vec3 maxs, int32_t *areas, uint32_t *count)
+{
+	while (node >= 0)
+	{
+		bsp_node_lump_t lump = map->nodes.data[node];
+		int32_t side	     = _bsp_box_on_plane_side(map->planes.data[lump.plane], mins, maxs);
+
+		if (side == 3)
+		{
+			_bsp_box_areas(map, lump.children[0], mins, maxs, areas, count);
+		}
+		node = lump.children[side == 1 ? 0 : 1];
+	}
+
+	int32_t area = map->leaves.data[~node].area;
+	if (area < 0 || *count >= 3)
+	{
+		return;
+	}
+
+	for (size_t i = 0; i < *count; i++)
+	{
+		if (areas[i] == area)
+		{
+			return;
+		}
+	}
+
+	areas[(*count)++] = area;
+}
+
+void _bsp_create_submodels(bsp_map_t *map)
+{
+	for (size_t i = 1; i < map->models.count; i++)
+	{
+		bsp_submodel_t submodel = {
+			.model	   = i,
+			.transform = gs_mat4_identity(),
+			.inverse   = gs_mat4_identity(),
+		};
+		_bsp_update_submodel_bounds(map, &submodel);
+		gs_dyn_array_push(map->submodels, submodel);
+	}
+
+	gs_dyn_array_reserve(map->visible_model_faces, map->models.count > 0 ? map->faces.count - map->models.data[0].num_faces : 1);
+	map->stats.models = gs_dyn_array_size(map->submodels);
+}
+
+// Transformed bounds and the leaves touching them for PVS tests
+void _bsp_update_submodel_bounds(bsp_map_t *map, bsp_submodel_t *submodel)
+{
+	bsp_model_lump_t lump = map->models.data[submodel->model];
+
+	for (size_t i = 0; i < 8; i++)
+	{
+		gs_vec4 corner = gs_mat4_mul_vec4(
+			submodel->transform,
+			gs_v4(
+				i & 1 ? lump.maxs.x : lump.mins.x,
+				i & 2 ? lump.maxs.y : lump.mins.y,
+				i & 4 ? lump.maxs.z : lump.mins.z,
+				1.0f));
+
+		if (i == 0)
+		{
+			submodel->mins = gs_v3(corner.x, corner.y, corner.z);
+			submodel->maxs = submodel->mins;
+		}
+
+		submodel->mins = gs_v3(gs_min(submodel->mins.x, corner.x), gs_min(submodel->mins.y, corner.y), gs_min(submodel->mins.z, corner.z));
+		submodel->maxs = gs_v3(gs_max(submodel->maxs.x, corner.x), gs_max(submodel->maxs.y, corner.y), gs_max(submodel->maxs.z, corner.z));
+	}
+
+	gs_dyn_array_clear(submodel->leaves);
+	if (map->nodes.count > 0)
+	{
+		_bsp_box_leaves(map, 0, submodel->mins, submodel->maxs, submodel);
+	}
+}
+
+void _bsp_box_leaves(bsp_map_t *map, int32_t node, const gs_vec3 mins, const gs_vec3 maxs, bsp_submodel_t *submodel)
+{
+	while (node >= 0)
+	{
+		bsp_node_lump_t lump = map->nodes.data[node];
+		int32_t side	     = _bsp_box_on_plane_side(map->planes.data[lump.plane], mins, maxs);
+
+		if (side == 3)
+		{
+			_bsp_box_leaves(map, lump.children[0], mins, maxs, submodel);
+		}
+		node = lump.children[side == 1 ? 0 : 1];
+	}
+
+	if (map->leaves.data[~node].cluster >= 0)
+	{
+		gs_dyn_array_push(submodel->leaves, ~node);
+	}
+}
+
+// Set transform of brush model "*n", applied to its world space faces.
+void bsp_map_set_model_transform(bsp_map_t *map, int32_t model, const gs_mat4 transform)
+{
+	if (model < 1 || model > gs_dyn_array_size(map->submodels))
+	{
+		mg_println("WARN: bsp_map_set_model_transform invalid model %d", model);
+		return;
+	}
+
+	bsp_submodel_t *submodel = &map->submodels[model - 1];
+	submodel->transform	 = transform;
+	submodel->inverse	 = gs_mat4_inverse(transform);
+	_bsp_update_submodel_bounds(map, submodel);
+
+	// Doors are compiled closed, moving one away from there opens its portal
+	bsp_model_lump_t lump = map->models.data[model];
+	float32_t offset      = gs_max(gs_vec3_dist(submodel->mins, lump.mins), gs_vec3_dist(submodel->maxs, lump.maxs));
+	bsp_map_set_area_portal(map, model, offset > BSP_DOOR_CLOSED_EPSILON);
+}
+
+// Cull submodels as a whole by the leaves they touch, frustum and occlusion.
+// Faces of visible ones are backface culled in model space.
+void _bsp_calculate_visible_models(bsp_map_t *map, const mg_camera_frustum_t *fr, const gs_vec3 view_position, bool32_t occlusion)
+{
+	gs_dyn_array_clear(map->visible_model_faces);
+	map->stats.visible_models = 0;
+	map->stats.culled_models  = 0;
+
+	for (size_t i = 0; i < gs_dyn_array_size(map->submodels); i++)
+	{
+		bsp_submodel_t *submodel     = &map->submodels[i];
+		submodel->visible	     = false;
+		submodel->num_visible_faces = 0;
+
+		bool32_t in_pvs = false;
+		for (size_t j = 0; j < gs_dyn_array_size(submodel->leaves); j++)
+		{
+			bsp_leaf_lump_t lump = map->leaves.data[submodel->leaves[j]];
+			if (_bsp_cluster_visible(map, map->pvs_cluster, lump.cluster) && _bsp_area_visible(map, lump.area))
+			{
+				in_pvs = true;
+				break;
+			}
+		}
+
+		if (!in_pvs
+		    || !mg_camera_aabb_in_frustum(*fr, submodel->mins, submodel->maxs)
+		    || (occlusion && !bsp_occlusion_test_aabb(&map->occlusion, submodel->mins, submodel->maxs)))
+		{
+			map->stats.culled_models++;
+			continue;
+		}
+
+		gs_vec4 local		     = gs_mat4_mul_vec4(submodel->inverse, gs_v4(view_position.x, view_position.y, view_position.z, 1.0f));
+		gs_vec3 local_view	     = gs_v3(local.x, local.y, local.z);
+		bsp_model_lump_t lump	     = map->models.data[submodel->model];
+		submodel->first_visible_face = gs_dyn_array_size(map->visible_model_faces);
+
+		for (size_t j = 0; j < lump.num_faces; j++)
+		{
+			int32_t idx		   = lump.first_face + j;
+			bsp_face_renderable_t face = map->render_faces[idx];
+
+			if (face.type == BSP_FACE_TYPE_BILLBOARD || face.surface_class == BSP_SURFACE_CLASS_SKY || face.surface_class == BSP_SURFACE_CLASS_NODRAW)
+			{
+				continue;
+			}
+
+			if (face.type == BSP_FACE_TYPE_POLYGON && !face.two_sided && gs_vec3_dot(face.normal, local_view) - face.dist <= 0.0f)
+			{
+				map->stats.culled_faces_backface++;
+				continue;
+			}
+
+			gs_dyn_array_push(map->visible_model_faces, idx);
+			map->stats.visible_faces++;
+
+			// Bounds of quadratic patches are in model space, draw at full detail
+			if (face.type == BSP_FACE_TYPE_PATCH)
+			{
+				bsp_patch_t *patch = &map->patches[face.index];
+				patch->lod	   = 0;
+				for (size_t k = 0; k < gs_dyn_array_size(patch->quadratic_patches); k++)
+				{
+					patch->quadratic_patches[k].visible = true;
+				}
+				map->stats.visible_patches++;
+			}
+
+			map->stats.visible_indices += _bsp_face_draw_index_count(map, face);
+		}
+
+		submodel->num_visible_faces = gs_dyn_array_size(map->visible_model_faces) - submodel->first_visible_face;
+		submodel->visible	    = submodel->num_visible_faces > 0;
+		map->stats.visible_models += submodel->visible;
+	}
+}
+
+// Mark areas reachable from the camera area.
+// Returns true if any area changed visibility.
+bool32_t _bsp_flood_areas(bsp_map_t *map, int32_t camera_area)
+{
+	map->camera_area	  = camera_area;
+	map->area_portals_changed = false;
+
+	if (map->num_areas == 0)
+	{
+		return false;
+	}
+
+	// Outside the map, don't hide anything
+	if (camera_area < 0 || camera_area >= map->num_areas)
+	{
+		bool32_t changed = false;
+		for (size_t i = 0; i < map->num_areas; i++)
+		{
+			changed |= !map->area_visible[i];
+			map->area_visible[i] = true;
+		}
+		return changed;
+	}
+
+	// Previous state in the upper bit
+	for (size_t i = 0; i < map->num_areas; i++)
+	{
+		map->area_visible[i] = map->area_visible[i] ? 2 : 0;
+	}
+
+	uint32_t stack_size		  = 0;
+	map->area_stack[stack_size++]	  = camera_area;
+	map->area_visible[camera_area] |= 1;
+
+	while (stack_size > 0)
+	{
+		int32_t area = map->area_stack[--stack_size];
+
+		for (size_t i = 0; i < gs_dyn_array_size(map->area_portals); i++)
+		{
+			bsp_area_portal_t portal = map->area_portals[i];
+			if (!portal.open) continue;
+
+			int32_t other = -1;
+			if (portal.areas[0] == area) other = portal.areas[1];
+			else if (portal.areas[1] == area) other = portal.areas[0];
+
+			if (other < 0 || map->area_visible[other] & 1) continue;
+
+			map->area_visible[other] |= 1;
+			map->area_stack[stack_size++] = other;
+		}
+	}
+
+	bool32_t changed = false;
+	for (size_t i = 0; i < map->num_areas; i++)
+	{
+		bool32_t visible = map->area_visible[i] & 1;
+		changed |= visible != (map->area_visible[i] >> 1);
+		map->area_visible[i] = visible;
+	}
+
+	return changed;
+}
+
+bool32_t _bsp_area_visible(bsp_map_t *map, int32_t area)
+{
+	// Leaves without an area are never cut off
+	if (area < 0 || area >= map->num_areas)
+	{
+		return true;
+	}
+
+	return map->area_visible[area];
+}
+
+// Open or close the area portal of a brush model, such as a door.
+// Visibility is flooded again on the next update.
+void bsp_map_set_area_portal(bsp_map_t *map, int32_t model, bool32_t open)
+{
+	for (size_t i = 0; i < gs_dyn_array_size(map->area_portals); i++)
+	{
+		bsp_area_portal_t *portal = &map->area_portals[i];
+		if (portal->model == model && portal->open != open)
+		{
+			portal->open		  = open;
+			map->area_portals_changed = true;
+		}
+	}
+}
+
 void _bsp_load_textures(bsp_map_t *map)
 {
 	int32_t num_textures = map->header.dir_entries[BSP_LUMP_TYPE_TEXTURES].length / sizeof(bsp_texture_lump_t);
@@ -224,36 +742,102 @@ void _bsp_load_textures(bsp_map_t *map)
 
 void _bsp_load_lightmaps(bsp_map_t *map)
 {
-	gs_color_t gray		= gs_color(100, 100, 100, 255);
-	map->missing_lm_texture = gs_graphics_texture_create(
-		&(gs_graphics_texture_desc_t){
-			.type	    = GS_GRAPHICS_TEXTURE_2D,
-			.width	    = 1,
-			.height	    = 1,
-			.format	    = GS_GRAPHICS_TEXTURE_FORMAT_RGBA8,
-			.min_filter = GS_GRAPHICS_TEXTURE_FILTER_LINEAR,
-			.mag_filter = GS_GRAPHICS_TEXTURE_FILTER_LINEAR,
-			.mip_filter = GS_GRAPHICS_TEXTURE_FILTER_LINEAR,
-			.num_mips   = 1,
-			.data	    = &gray});
+	// Overbright and gamma are applied once here instead of per pixel
+	uint8_t lut[256];
+	for (size_t i = 0; i < 256; i++)
+	{
+		float32_t c = powf(i / 255.0f * BSP_LIGHTMAP_STRENGTH, 1.0f / BSP_LIGHTMAP_GAMMA) / BSP_LIGHTMAP_RANGE;
+		lut[i]	    = (uint8_t)gs_clamp(c * 255.0f + 0.5f, 0.0f, 255.0f);
+	}
+
+	const uint32_t slot_size      = BSP_LIGHTMAP_SIZE + 2 * BSP_LIGHTMAP_ATLAS_PADDING;
+	const uint32_t slots_per_row  = BSP_LIGHTMAP_ATLAS_SIZE / slot_size;
+	const uint32_t slots_per_page = slots_per_row * slots_per_row;
+
+	// Extra slot for the flat lightmap
+	uint32_t num_slots = map->lightmaps.count + 1;
+	uint32_t num_pages = (num_slots + slots_per_page - 1) / slots_per_page;
+	uint8_t gray[3]	   = {100, 100, 100};
 
-	map->lightmap_textures.data  = gs_malloc(map->lightmaps.count * sizeof(gs_handle(gs_graphics_texture_t)));
-	map->lightmap_textures.count = map->lightmaps.count;
+	map->lightmap_pages	     = gs_malloc(sizeof(int32_t) * num_slots);
+	map->lightmap_textures.data  = gs_malloc(num_pages * sizeof(gs_handle(gs_graphics_texture_t)));
+	map->lightmap_textures.count = num_pages;
 
-	for (size_t i = 0; i < map->lightmaps.count; i++)
+	// Texel position of each slot and height of each page for remapping
+	gs_vec2 *slot_offsets	 = gs_malloc(sizeof(gs_vec2) * num_slots);
+	uint32_t *page_heights	 = gs_malloc(sizeof(uint32_t) * num_pages);
+	uint8_t *pixels		 = gs_malloc(BSP_LIGHTMAP_ATLAS_SIZE * BSP_LIGHTMAP_ATLAS_SIZE * 3);
+
+	for (size_t page = 0; page < num_pages; page++)
 	{
-		map->lightmap_textures.data[i] = gs_graphics_texture_create(
+		uint32_t first_slot = page * slots_per_page;
+		uint32_t page_slots = gs_min(slots_per_page, num_slots - first_slot);
+		uint32_t rows	    = (page_slots + slots_per_row - 1) / slots_per_row;
+		uint32_t height	    = rows * slot_size;
+
+		page_heights[page] = height;
+		memset(pixels, 0, BSP_LIGHTMAP_ATLAS_SIZE * height * 3);
+
+		for (size_t i = 0; i < page_slots; i++)
+		{
+			uint32_t slot = first_slot + i;
+			uint32_t x0   = (i % slots_per_row) * slot_size;
+			uint32_t y0   = (i / slots_per_row) * slot_size;
+
+			map->lightmap_pages[slot] = page;
+			slot_offsets[slot]	  = gs_v2(x0 + BSP_LIGHTMAP_ATLAS_PADDING, y0 + BSP_LIGHTMAP_ATLAS_PADDING);
+
+			// Copy with edge texels repeated into the padding
+			for (int32_t y = 0; y < slot_size; y++)
+			{
+				int32_t sy = gs_clamp(y - BSP_LIGHTMAP_ATLAS_PADDING, 0, BSP_LIGHTMAP_SIZE - 1);
+				for (int32_t x = 0; x < slot_size; x++)
+				{
+					int32_t sx	= gs_clamp(x - BSP_LIGHTMAP_ATLAS_PADDING, 0, BSP_LIGHTMAP_SIZE - 1);
+					uint8_t *src	= slot < map->lightmaps.count ? (uint8_t *)&map->lightmaps.data[slot].map[(sy * BSP_LIGHTMAP_SIZE + sx) * 3] : gray;
+					uint8_t *dst	= &pixels[((y0 + y) * BSP_LIGHTMAP_ATLAS_SIZE + x0 + x) * 3];
+					dst[0]		= lut[src[0]];
+					dst[1]		= lut[src[1]];
+					dst[2]		= lut[src[2]];
+				}
+			}
+		}
+
+		map->lightmap_textures.data[page] = gs_graphics_texture_create(
 			&(gs_graphics_texture_desc_t){
 				.type	    = GS_GRAPHICS_TEXTURE_2D,
-				.width	    = 128,
-				.height	    = 128,
+				.width	    = BSP_LIGHTMAP_ATLAS_SIZE,
+				.height	    = height,
 				.format	    = GS_GRAPHICS_TEXTURE_FORMAT_RGB8,
 				.min_filter = GS_GRAPHICS_TEXTURE_FILTER_LINEAR,
 				.mag_filter = GS_GRAPHICS_TEXTURE_FILTER_LINEAR,
 				.mip_filter = GS_GRAPHICS_TEXTURE_FILTER_LINEAR,
 				.num_mips   = 1,
-				.data	    = map->lightmaps.data[i].map});
+				.data	    = pixels});
 	}
+
+	// Remap lightmap coordinates to atlas pages.
+	// Faces don't share vertices, patch control points get remapped too.
+	for (size_t i = 0; i < map->faces.count; i++)
+	{
+		bsp_face_lump_t face = map->faces.data[i];
+		bool has_lightmap    = face.lm_index >= 0 && face.lm_index < map->lightmaps.count;
+		uint32_t slot	     = has_lightmap ? face.lm_index : map->lightmaps.count;
+		gs_vec2 offset	     = slot_offsets[slot];
+		float32_t height     = page_heights[map->lightmap_pages[slot]];
+
+		for (size_t j = 0; j < face.num_vertices; j++)
+		{
+			gs_vec2 *lm_coord = &map->vertices.data[face.first_vertex + j].lm_coord;
+			gs_vec2 texel	  = has_lightmap ? gs_vec2_scale(*lm_coord, BSP_LIGHTMAP_SIZE) : gs_v2(BSP_LIGHTMAP_SIZE * 0.5f, BSP_LIGHTMAP_SIZE * 0.5f);
+			lm_coord->x	  = (offset.x + texel.x) / BSP_LIGHTMAP_ATLAS_SIZE;
+			lm_coord->y	  = (offset.y + texel.y) / height;
+		}
+	}
+
+	gs_free(pixels);
+	gs_free(slot_offsets);
+	gs_free(page_heights);
 }
 
 void _bsp_load_lightvols(bsp_map_t *map)
@@ -282,9 +866,7 @@ void _bsp_create_patch(bsp_map_t *map, bsp_face_lump_t face)
 		{
 			uint32_t patch_idx = y * num_patches_x + x;
 
-			bsp_quadratic_patch_t quadratic = {
-				.tesselation = 8,
-			};
+			bsp_quadratic_patch_t quadratic = {0};
 
 			// Get the 9 vertices used as control points for this quadratic patch.
 			for (size_t row = 0; row < 3; row++)
@@ -301,14 +883,139 @@ void _bsp_create_patch(bsp_map_t *map, bsp_face_lump_t face)
 			}
 
 			gs_dyn_array_set_data_i(&patch.quadratic_patches, &quadratic, sizeof(bsp_quadratic_patch_t), patch_idx);
-			bsp_quadratic_patch_tesselate(&patch.quadratic_patches[patch_idx]);
 		}
 	}
 
-	uint32_t temp = gs_dyn_array_size(patch.quadratic_patches);
+	// Neighbouring quadratic patches share edges, so tesselation
+	// is picked per column and row of them to avoid cracks.
+	int32_t *tess_u = gs_malloc(sizeof(int32_t) * num_patches_x);
+	int32_t *tess_v = gs_malloc(sizeof(int32_t) * num_patches_y);
+	for (size_t x = 0; x < num_patches_x; x++)
+	{
+		tess_u[x] = 1;
+	}
+	for (size_t y = 0; y < num_patches_y; y++)
+	{
+		tess_v[y] = 1;
+	}
+
+	for (size_t x = 0; x < num_patches_x; x++)
+	{
+		for (size_t y = 0; y < num_patches_y; y++)
+		{
+			int32_t u, v;
+			bsp_quadratic_patch_get_tesselation(&patch.quadratic_patches[y * num_patches_x + x], &u, &v);
+			tess_u[x] = gs_max(tess_u[x], u);
+			tess_v[y] = gs_max(tess_v[y], v);
+		}
+	}
+
+	// Tesselated later for all patches at once, see _bsp_tesselate_patches
+	for (size_t x = 0; x < num_patches_x; x++)
+	{
+		for (size_t y = 0; y < num_patches_y; y++)
+		{
+			bsp_quadratic_patch_t *quadratic = &patch.quadratic_patches[y * num_patches_x + x];
+			quadratic->tesselation_u	 = tess_u[x];
+			quadratic->tesselation_v	 = tess_v[y];
+		}
+	}
+
+	gs_free(tess_u);
+	gs_free(tess_v);
+
 	gs_dyn_array_push(map->patches, patch);
 }
 
+bsp_surface_class _bsp_classify_surface(bsp_map_t *map, int32_t texture_index)
+{
+	if (texture_index < 0 || texture_index >= map->textures.count)
+	{
+		return BSP_SURFACE_CLASS_OPAQUE;
+	}
+
+	bsp_texture_lump_t texture = map->textures.data[texture_index];
+
+	if (texture.flags & (BSP_SURFACE_NODRAW | BSP_SURFACE_SKIP | BSP_SURFACE_HINT))
+	{
+		return BSP_SURFACE_CLASS_NODRAW;
+	}
+
+	// No sky rendering, clear color shows through
+	if (texture.flags & BSP_SURFACE_SKY)
+	{
+		return BSP_SURFACE_CLASS_SKY;
+	}
+
+	// Grates and foliage are usually also marked translucent
+	if (texture.flags & BSP_SURFACE_ALPHASHADOW)
+	{
+		return BSP_SURFACE_CLASS_ALPHA_TESTED;
+	}
+
+	int32_t translucent = BSP_CONTENT_CONTENTS_TRANSLUCENT
+			      | BSP_CONTENT_CONTENTS_WATER
+			      | BSP_CONTENT_CONTENTS_SLIME
+			      | BSP_CONTENT_CONTENTS_FOG;
+	if (texture.contents & translucent)
+	{
+		return BSP_SURFACE_CLASS_TRANSLUCENT;
+	}
+
+	return BSP_SURFACE_CLASS_OPAQUE;
+}
+
+// Surfaces seen from both sides, never backface culled
+bool _bsp_face_is_two_sided(bsp_map_t *map, bsp_face_lump_t face)
+{
+	if (face.texture < 0 || face.texture >= map->textures.count)
+	{
+		return false;
+	}
+
+	bsp_texture_lump_t texture = map->textures.data[face.texture];
+	int32_t contents	   = BSP_CONTENT_CONTENTS_WATER
+			   | BSP_CONTENT_CONTENTS_SLIME
+			   | BSP_CONTENT_CONTENTS_LAVA
+			   | BSP_CONTENT_CONTENTS_FOG
+			   | BSP_CONTENT_CONTENTS_TRANSLUCENT;
+
+	return (texture.contents & contents) || (texture.flags & BSP_SURFACE_ALPHASHADOW);
+}
+
+void _bsp_tesselate_patches(bsp_map_t *map)
+{
+	gs_dyn_array(bsp_quadratic_patch_t *) quadratics = gs_dyn_array_new(bsp_quadratic_patch_t *);
+	for (size_t i = 0; i < gs_dyn_array_size(map->patches); i++)
+	{
+		for (size_t j = 0; j < gs_dyn_array_size(map->patches[i].quadratic_patches); j++)
+		{
+			gs_dyn_array_push(quadratics, &map->patches[i].quadratic_patches[j]);
+		}
+	}
+
+	bsp_quadratic_patches_tesselate(quadratics, gs_dyn_array_size(quadratics));
+	gs_dyn_array_free(quadratics);
+
+	for (size_t i = 0; i < gs_dyn_array_size(map->patches); i++)
+	{
+		bsp_patch_t *patch = &map->patches[i];
+		for (size_t j = 0; j < gs_dyn_array_size(patch->quadratic_patches); j++)
+		{
+			bsp_quadratic_patch_t *quadratic = &patch->quadratic_patches[j];
+			if (j == 0)
+			{
+				patch->mins = quadratic->mins;
+				patch->maxs = quadratic->maxs;
+				continue;
+			}
+
+			patch->mins = gs_v3(gs_min(patch->mins.x, quadratic->mins.x), gs_min(patch->mins.y, quadratic->mins.y), gs_min(patch->mins.z, quadratic->mins.z));
+			patch->maxs = gs_v3(gs_max(patch->maxs.x, quadratic->maxs.x), gs_max(patch->maxs.y, quadratic->maxs.y), gs_max(patch->maxs.z, quadratic->maxs.z));
+		}
+	}
+}
+
 void _bsp_map_create_buffers(bsp_map_t *map)
 {
 	map->bsp_graphics_index_arr = gs_dyn_array_new(uint32_t);
@@ -326,60 +1033,506 @@ void _bsp_map_create_buffers(bsp_map_t *map)
 			int32_t first_index  = face.first_index;
 			int32_t first_vertex = face.first_vertex;
 
-			map->render_faces[i].first_ibo_index = gs_dyn_array_size(map->bsp_graphics_index_arr);
-			map->render_faces[i].num_ibo_indices = face.num_indices;
+			map->render_faces[i].first_ibo_index = gs_dyn_array_size(map->bsp_graphics_index_arr);
+			map->render_faces[i].num_ibo_indices = face.num_indices;
+
+			for (size_t j = 0; j < face.num_indices; j++)
+			{
+				gs_dyn_array_push(map->bsp_graphics_index_arr, first_vertex + map->indices.data[first_index + j].offset);
+			}
+		}
+	}
+
+	// Add patches
+	for (size_t i = 0; i < gs_dyn_array_size(map->render_faces); i++)
+	{
+		if (map->render_faces[i].type == BSP_FACE_TYPE_PATCH)
+		{
+			bsp_patch_t *patch		     = &map->patches[map->render_faces[i].index];
+			uint32_t first_vertex		     = gs_dyn_array_size(map->bsp_graphics_vert_arr);
+			patch->first_index		     = gs_dyn_array_size(map->bsp_graphics_index_arr);
+			map->render_faces[i].first_ibo_index = patch->first_index;
+
+			for (size_t j = 0; j < gs_dyn_array_size(patch->quadratic_patches); j++)
+			{
+				bsp_quadratic_patch_t quadratic = patch->quadratic_patches[j];
+				for (size_t k = 0; k < gs_dyn_array_size(quadratic.vertices); k++)
+				{
+					gs_dyn_array_push(map->bsp_graphics_vert_arr, quadratic.vertices[k]);
+				}
+			}
+
+			// LOD major, so the face range is LOD 0 of the whole patch
+			for (size_t lod = 0; lod < BSP_PATCH_LOD_COUNT; lod++)
+			{
+				uint32_t index_offset = first_vertex;
+				for (size_t j = 0; j < gs_dyn_array_size(patch->quadratic_patches); j++)
+				{
+					bsp_quadratic_patch_t *quadratic = &patch->quadratic_patches[j];
+					quadratic->lod_first_index[lod]	 = gs_dyn_array_size(map->bsp_graphics_index_arr);
+
+					for (size_t k = quadratic->lod_offsets[lod]; k < quadratic->lod_offsets[lod + 1]; k++)
+					{
+						gs_dyn_array_push(map->bsp_graphics_index_arr, quadratic->indices[k] + index_offset);
+					}
+
+					index_offset += gs_dyn_array_size(quadratic->vertices);
+				}
+
+				if (lod == 0)
+				{
+					map->render_faces[i].num_ibo_indices = gs_dyn_array_size(map->bsp_graphics_index_arr) - patch->first_index;
+				}
+			}
+
+			patch->num_indices = gs_dyn_array_size(map->bsp_graphics_index_arr) - patch->first_index;
+		}
+	}
+
+	_bsp_optimize_buffers(map);
+
+	// Index buffer
+	map->bsp_graphics_ibo = gs_graphics_index_buffer_create(
+		&(gs_graphics_index_buffer_desc_t){
+			.data  = map->bsp_graphics_index_arr,
+			.size  = sizeof(uint32_t) * gs_dyn_array_size(map->bsp_graphics_index_arr),
+			.usage = GS_GRAPHICS_BUFFER_USAGE_STATIC,
+		});
+
+	// Per frame index buffer for batched draws,
+	// every face is drawn at most once so this never grows.
+	size_t index_count = gs_dyn_array_size(map->bsp_graphics_index_arr);
+	gs_dyn_array_reserve(map->bsp_graphics_draw_index_arr, index_count);
+	map->bsp_graphics_draw_ibo = gs_graphics_index_buffer_create(
+		&(gs_graphics_index_buffer_desc_t){
+			.data  = map->bsp_graphics_index_arr,
+			.size  = sizeof(uint32_t) * index_count,
+			.usage = GS_GRAPHICS_BUFFER_USAGE_DYNAMIC,
+		});
+
+	// Vertex buffer
+	if (map->packed_vertices)
+	{
+		bsp_packed_vert_t *packed = _bsp_pack_vertices(map);
+		map->bsp_graphics_vbo	  = gs_graphics_vertex_buffer_create(
+			&(gs_graphics_vertex_buffer_desc_t){
+				.data  = packed,
+				.size  = sizeof(bsp_packed_vert_t) * gs_dyn_array_size(map->bsp_graphics_vert_arr),
+				.usage = GS_GRAPHICS_BUFFER_USAGE_STATIC,
+			});
+		gs_free(packed);
+	}
+	else
+	{
+		map->bsp_graphics_vbo = gs_graphics_vertex_buffer_create(
+			&(gs_graphics_vertex_buffer_desc_t){
+				.data  = map->bsp_graphics_vert_arr,
+				.size  = sizeof(bsp_vert_lump_t) * gs_dyn_array_size(map->bsp_graphics_vert_arr),
+				.usage = GS_GRAPHICS_BUFFER_USAGE_STATIC,
+			});
+	}
+}
+
+// Whole units to subtract from face texture coordinates
+gs_vec2 _bsp_face_uv_offset(bsp_map_t *map, uint32_t face)
+{
+	uint32_t first = map->render_faces[face].first_ibo_index;
+	uint32_t num   = map->render_faces[face].num_ibo_indices;
+	if (num == 0) return gs_v2(0, 0);
+
+	gs_vec2 min = map->bsp_graphics_vert_arr[map->bsp_graphics_index_arr[first]].tex_coord;
+	for (size_t i = 1; i < num; i++)
+	{
+		gs_vec2 uv = map->bsp_graphics_vert_arr[map->bsp_graphics_index_arr[first + i]].tex_coord;
+		min.x	   = gs_min(min.x, uv.x);
+		min.y	   = gs_min(min.y, uv.y);
+	}
+
+	return gs_v2(floorf(min.x), floorf(min.y));
+}
+
+// Weld shared vertices and reorder triangles for the post-transform cache.
+// Face index ranges stay the same, only their contents change.
+void _bsp_optimize_buffers(bsp_map_t *map)
+{
+	uint32_t index_count  = gs_dyn_array_size(map->bsp_graphics_index_arr);
+	uint32_t vertex_count = gs_dyn_array_size(map->bsp_graphics_vert_arr);
+	if (index_count == 0) return;
+
+	map->stats.acmr_before = bsp_calculate_acmr(map->bsp_graphics_index_arr, index_count, vertex_count);
+
+	// Only weld within a material, and within the same
+	// texture coordinate offset for packed vertices.
+	uint64_t *groups = gs_malloc(sizeof(uint64_t) * index_count);
+	for (size_t i = 0; i < gs_dyn_array_size(map->render_faces); i++)
+	{
+		int32_t texture;
+		int32_t lightmap;
+
+		if (map->render_faces[i].type == BSP_FACE_TYPE_PATCH)
+		{
+			texture	 = map->patches[map->render_faces[i].index].texture_idx;
+			lightmap = map->patches[map->render_faces[i].index].lightmap_idx;
+		}
+		else
+		{
+			texture	 = map->faces.data[map->render_faces[i].index].texture;
+			lightmap = map->faces.data[map->render_faces[i].index].lm_index;
+		}
+
+		gs_vec2 offset = _bsp_face_uv_offset(map, i);
+		uint64_t group = (uint64_t)(uint16_t)texture
+				 | (uint64_t)(uint16_t)lightmap << 16
+				 | (uint64_t)(uint16_t)(int16_t)offset.x << 32
+				 | (uint64_t)(uint16_t)(int16_t)offset.y << 48;
+
+		// Patches have their lower LODs after the face range
+		uint32_t first = map->render_faces[i].first_ibo_index;
+		uint32_t num   = map->render_faces[i].num_ibo_indices;
+		if (map->render_faces[i].type == BSP_FACE_TYPE_PATCH)
+		{
+			num = map->patches[map->render_faces[i].index].num_indices;
+		}
+
+		for (size_t j = 0; j < num; j++)
+		{
+			groups[first + j] = group;
+		}
+	}
+
+	gs_dyn_array(bsp_vert_lump_t) welded = gs_dyn_array_new(bsp_vert_lump_t);
+	gs_dyn_array_reserve(welded, index_count);
+	uint32_t welded_count = bsp_weld_vertices(map->bsp_graphics_vert_arr, map->bsp_graphics_index_arr, index_count, groups, welded);
+	gs_free(groups);
+
+	// Faces and quadratic patch LODs are drawn as whole index ranges,
+	// reorder within each.
+	for (size_t i = 0; i < gs_dyn_array_size(map->render_faces); i++)
+	{
+		if (map->render_faces[i].type != BSP_FACE_TYPE_PATCH)
+		{
+			bsp_optimize_triangle_order(
+				map->bsp_graphics_index_arr + map->render_faces[i].first_ibo_index,
+				map->render_faces[i].num_ibo_indices);
+			continue;
+		}
+
+		bsp_patch_t patch = map->patches[map->render_faces[i].index];
+		for (size_t j = 0; j < gs_dyn_array_size(patch.quadratic_patches); j++)
+		{
+			bsp_quadratic_patch_t quadratic = patch.quadratic_patches[j];
+			for (size_t lod = 0; lod < BSP_PATCH_LOD_COUNT; lod++)
+			{
+				bsp_optimize_triangle_order(
+					map->bsp_graphics_index_arr + quadratic.lod_first_index[lod],
+					quadratic.lod_offsets[lod + 1] - quadratic.lod_offsets[lod]);
+			}
+		}
+	}
+
+	welded_count				= bsp_optimize_vertex_fetch(welded, welded_count, map->bsp_graphics_index_arr, index_count);
+	gs_dyn_array_head(welded)->size = welded_count;
+
+	gs_dyn_array_free(map->bsp_graphics_vert_arr);
+	map->bsp_graphics_vert_arr = welded;
+
+	map->stats.acmr_after = bsp_calculate_acmr(map->bsp_graphics_index_arr, index_count, welded_count);
+
+	mg_println(
+		"_bsp_optimize_buffers: %u -> %u vertices, ACMR %.3f -> %.3f",
+		vertex_count,
+		welded_count,
+		map->stats.acmr_before,
+		map->stats.acmr_after);
+}
+
+bsp_packed_vert_t *_bsp_pack_vertices(bsp_map_t *map)
+{
+	size_t count		  = gs_dyn_array_size(map->bsp_graphics_vert_arr);
+	bsp_packed_vert_t *packed = gs_malloc(sizeof(bsp_packed_vert_t) * count);
+
+	// Texture coordinates repeat, so shift each face by whole
+	// units towards the origin to keep them within half precision.
+	// Welding never shares vertices between different offsets.
+	gs_vec2 *offsets = gs_malloc(sizeof(gs_vec2) * count);
+	memset(offsets, 0, sizeof(gs_vec2) * count);
+
+	for (size_t i = 0; i < gs_dyn_array_size(map->render_faces); i++)
+	{
+		uint32_t first = map->render_faces[i].first_ibo_index;
+		uint32_t num   = map->render_faces[i].num_ibo_indices;
+		gs_vec2 offset = _bsp_face_uv_offset(map, i);
+
+		for (size_t j = 0; j < num; j++)
+		{
+			offsets[map->bsp_graphics_index_arr[first + j]] = offset;
+		}
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		bsp_vert_lump_t v = map->bsp_graphics_vert_arr[i];
+
+		packed[i].position  = v.position;
+		packed[i].tex_coord = mg_pack_half2(gs_vec2_sub(v.tex_coord, offsets[i]));
+		packed[i].lm_coord  = mg_pack_unorm16x2(v.lm_coord);
+		packed[i].normal    = mg_pack_snorm16x2(mg_oct_encode(v.normal));
+	}
+
+	gs_free(offsets);
+
+	return packed;
+}
+
+void _bsp_create_materials(bsp_map_t *map)
+{
+	uint32_t num_textures = map->texture_assets.count + 1;
+	uint32_t num_pages    = map->lightmap_textures.count;
+
+	// Texture x lightmap page x surface class lookup, texture offset by one for missing
+	uint32_t num_keys = num_textures * num_pages * BSP_SURFACE_CLASS_COUNT;
+	int32_t *lookup	  = gs_malloc(sizeof(int32_t) * num_keys);
+	for (size_t i = 0; i < num_keys; i++)
+	{
+		lookup[i] = -1;
+	}
+
+	for (size_t i = 0; i < gs_dyn_array_size(map->render_faces); i++)
+	{
+		int32_t texture_index;
+		int32_t lm_index;
+
+		if (map->render_faces[i].type == BSP_FACE_TYPE_PATCH)
+		{
+			texture_index = map->patches[map->render_faces[i].index].texture_idx;
+			lm_index      = map->patches[map->render_faces[i].index].lightmap_idx;
+		}
+		else
+		{
+			texture_index = map->faces.data[map->render_faces[i].index].texture;
+			lm_index      = map->faces.data[map->render_faces[i].index].lm_index;
+		}
+
+		if (texture_index < 0 || texture_index >= map->texture_assets.count || map->texture_assets.data[texture_index] == NULL || !gs_handle_is_valid(map->texture_assets.data[texture_index]->hndl))
+		{
+			texture_index = -1;
+		}
+		if (lm_index < 0 || lm_index >= map->lightmaps.count)
+		{
+			// Flat lightmap
+			lm_index = map->lightmaps.count;
+		}
+		int32_t page		      = map->lightmap_pages[lm_index];
+		bsp_surface_class surface_class = map->render_faces[i].surface_class;
+
+		uint32_t key = ((texture_index + 1) * num_pages + page) * BSP_SURFACE_CLASS_COUNT + surface_class;
+		if (lookup[key] < 0)
+		{
+			lookup[key] = gs_dyn_array_size(map->materials);
+			gs_dyn_array_push(map->materials, ((bsp_material_t){.texture = texture_index, .lightmap = page, .surface_class = surface_class}));
+			gs_dyn_array_push(map->material_indices, 0);
+		}
+
+		map->render_faces[i].material = lookup[key];
+	}
+
+	gs_free(lookup);
+}
+
+// Number of indices a visible face draws this frame
+uint32_t _bsp_face_draw_index_count(bsp_map_t *map, bsp_face_renderable_t face)
+{
+	if (face.type != BSP_FACE_TYPE_PATCH)
+	{
+		return face.num_ibo_indices;
+	}
+
+	uint32_t count	  = 0;
+	bsp_patch_t patch = map->patches[face.index];
+	for (size_t i = 0; i < gs_dyn_array_size(patch.quadratic_patches); i++)
+	{
+		bsp_quadratic_patch_t *quadratic = &patch.quadratic_patches[i];
+		if (quadratic->visible)
+		{
+			count += quadratic->lod_offsets[patch.lod + 1] - quadratic->lod_offsets[patch.lod];
+		}
+	}
+
+	return count;
+}
+
+// Copy indices a visible face draws this frame to dst, returns count
+uint32_t _bsp_face_copy_draw_indices(bsp_map_t *map, bsp_face_renderable_t face, uint32_t *dst)
+{
+	if (face.type != BSP_FACE_TYPE_PATCH)
+	{
+		memcpy(dst, map->bsp_graphics_index_arr + face.first_ibo_index, sizeof(uint32_t) * face.num_ibo_indices);
+		return face.num_ibo_indices;
+	}
+
+	// Visible quadratic patches at the current LOD
+	uint32_t count	  = 0;
+	bsp_patch_t patch = map->patches[face.index];
+	for (size_t i = 0; i < gs_dyn_array_size(patch.quadratic_patches); i++)
+	{
+		bsp_quadratic_patch_t *quadratic = &patch.quadratic_patches[i];
+		if (!quadratic->visible) continue;
+
+		uint32_t num = quadratic->lod_offsets[patch.lod + 1] - quadratic->lod_offsets[patch.lod];
+		memcpy(dst + count, map->bsp_graphics_index_arr + quadratic->lod_first_index[patch.lod], sizeof(uint32_t) * num);
+		count += num;
+	}
+
+	return count;
+}
+
+// Batch opaque and alpha tested faces of one model by material.
+// Faces are in front to back order, so materials are ordered by their nearest face.
+void _bsp_batch_faces(bsp_map_t *map, int32_t model, const int32_t *faces, uint32_t count, uint32_t *total)
+{
+	gs_dyn_array_clear(map->material_order);
+
+	// Count indices per material
+	for (size_t i = 0; i < count; i++)
+	{
+		bsp_face_renderable_t face = map->render_faces[faces[i]];
+		if (face.surface_class == BSP_SURFACE_CLASS_TRANSLUCENT) continue;
+
+		uint32_t num = _bsp_face_draw_index_count(map, face);
+		if (num == 0) continue;
+
+		if (map->material_indices[face.material] == 0)
+		{
+			gs_dyn_array_push(map->material_order, face.material);
+		}
+		map->material_indices[face.material] += num;
+	}
+
+	// One batch per used material, opaque then alpha tested,
+	// material_indices becomes the write offset of each batch.
+	for (size_t pass = 0; pass < 2; pass++)
+	{
+		bsp_surface_class surface_class = pass == 0 ? BSP_SURFACE_CLASS_OPAQUE : BSP_SURFACE_CLASS_ALPHA_TESTED;
+
+		for (size_t i = 0; i < gs_dyn_array_size(map->material_order); i++)
+		{
+			uint32_t material = map->material_order[i];
+			if (map->materials[material].surface_class != surface_class) continue;
+
+			uint32_t num = map->material_indices[material];
+			gs_dyn_array_push(map->draw_batches, ((bsp_draw_batch_t){.model = model, .material = material, .first_index = *total, .num_indices = num}));
+			map->material_indices[material] = *total;
+			*total += num;
+		}
+	}
+
+	// Copy face indices into place, capacity was reserved for all faces
+	for (size_t i = 0; i < count; i++)
+	{
+		bsp_face_renderable_t face = map->render_faces[faces[i]];
+		if (face.surface_class == BSP_SURFACE_CLASS_TRANSLUCENT) continue;
+
+		uint32_t *dst = map->bsp_graphics_draw_index_arr + map->material_indices[face.material];
+		map->material_indices[face.material] += _bsp_face_copy_draw_indices(map, face, dst);
+	}
+
+	// Counters start from zero for the next model
+	for (size_t i = 0; i < gs_dyn_array_size(map->material_order); i++)
+	{
+		map->material_indices[map->material_order[i]] = 0;
+	}
+}
+
+static int _bsp_translucent_face_compare(const void *a, const void *b)
+{
+	float32_t distance_a = ((const bsp_translucent_face_t *)a)->distance;
+	float32_t distance_b = ((const bsp_translucent_face_t *)b)->distance;
+	return (distance_a < distance_b) - (distance_a > distance_b);
+}
+
+void _bsp_add_translucent_faces(bsp_map_t *map, int32_t model, const int32_t *faces, uint32_t count, const gs_vec3 view_position)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		bsp_face_renderable_t face = map->render_faces[faces[i]];
+		if (face.surface_class != BSP_SURFACE_CLASS_TRANSLUCENT) continue;
 
-			for (size_t j = 0; j < face.num_indices; j++)
-			{
-				gs_dyn_array_push(map->bsp_graphics_index_arr, first_vertex + map->indices.data[first_index + j].offset);
-			}
+		gs_vec3 center = gs_vec3_scale(gs_vec3_add(face.mins, face.maxs), 0.5f);
+		if (model >= 0)
+		{
+			gs_vec4 world = gs_mat4_mul_vec4(map->submodels[model].transform, gs_v4(center.x, center.y, center.z, 1.0f));
+			center	      = gs_v3(world.x, world.y, world.z);
 		}
+
+		gs_vec3 delta = gs_vec3_sub(center, view_position);
+		gs_dyn_array_push(map->translucent_faces, ((bsp_translucent_face_t){.model = model, .face = faces[i], .distance = gs_vec3_dot(delta, delta)}));
 	}
+}
 
-	// Add patches
-	uint32_t index_offset;
-	for (size_t i = 0; i < gs_dyn_array_size(map->render_faces); i++)
+// Batch translucent faces of the world and all submodels back to front
+// in one order so overlapping faces of different models blend correctly.
+// Runs of the same model and material are merged.
+void _bsp_batch_translucent_faces(bsp_map_t *map, const gs_vec3 view_position, uint32_t *total)
+{
+	gs_dyn_array_clear(map->translucent_faces);
+	_bsp_add_translucent_faces(map, -1, map->visible_faces, gs_dyn_array_size(map->visible_faces), view_position);
+	for (size_t i = 0; i < gs_dyn_array_size(map->submodels); i++)
 	{
-		if (map->render_faces[i].type == BSP_FACE_TYPE_PATCH)
-		{
-			bsp_patch_t patch		     = map->patches[map->render_faces[i].index];
-			map->render_faces[i].first_ibo_index = gs_dyn_array_size(map->bsp_graphics_index_arr);
+		bsp_submodel_t submodel = map->submodels[i];
+		if (!submodel.visible) continue;
 
-			for (size_t j = 0; j < gs_dyn_array_size(patch.quadratic_patches); j++)
-			{
-				bsp_quadratic_patch_t quadratic = patch.quadratic_patches[j];
-				index_offset			= gs_dyn_array_size(map->bsp_graphics_vert_arr);
+		_bsp_add_translucent_faces(map, i, map->visible_model_faces + submodel.first_visible_face, submodel.num_visible_faces, view_position);
+	}
 
-				for (size_t k = 0; k < gs_dyn_array_size(quadratic.vertices); k++)
-				{
-					gs_dyn_array_push(map->bsp_graphics_vert_arr, quadratic.vertices[k]);
-				}
+	uint32_t count = gs_dyn_array_size(map->translucent_faces);
+	if (count == 0) return;
+	qsort(map->translucent_faces, count, sizeof(bsp_translucent_face_t), _bsp_translucent_face_compare);
 
-				for (size_t k = 0; k < gs_dyn_array_size(quadratic.indices); k++)
-				{
-					gs_dyn_array_push(map->bsp_graphics_index_arr, quadratic.indices[k] + index_offset);
-				}
-			}
+	uint32_t first_batch = gs_dyn_array_size(map->draw_batches);
+	for (size_t i = 0; i < count; i++)
+	{
+		bsp_translucent_face_t translucent = map->translucent_faces[i];
+		bsp_face_renderable_t face	   = map->render_faces[translucent.face];
 
-			map->render_faces[i].num_ibo_indices = gs_dyn_array_size(map->bsp_graphics_index_arr) - map->render_faces[i].first_ibo_index;
+		uint32_t num = _bsp_face_copy_draw_indices(map, face, map->bsp_graphics_draw_index_arr + *total);
+		if (num == 0) continue;
+
+		uint32_t num_batches   = gs_dyn_array_size(map->draw_batches);
+		bsp_draw_batch_t *last = num_batches > first_batch ? &map->draw_batches[num_batches - 1] : NULL;
+		if (last != NULL && last->model == translucent.model && last->material == face.material)
+		{
+			last->num_indices += num;
 		}
+		else
+		{
+			gs_dyn_array_push(map->draw_batches, ((bsp_draw_batch_t){.model = translucent.model, .material = face.material, .first_index = *total, .num_indices = num}));
+		}
+
+		*total += num;
 	}
+}
 
-	// Index buffer
-	map->bsp_graphics_ibo = gs_graphics_index_buffer_create(
-		&(gs_graphics_index_buffer_desc_t){
-			.data  = map->bsp_graphics_index_arr,
-			.size  = sizeof(uint32_t) * gs_dyn_array_size(map->bsp_graphics_index_arr),
-			.usage = GS_GRAPHICS_BUFFER_USAGE_STATIC,
-		});
+void _bsp_build_draw_batches(bsp_map_t *map, const gs_vec3 view_position)
+{
+	gs_dyn_array_clear(map->draw_batches);
 
-	// Vertex buffer
-	map->bsp_graphics_vbo = gs_graphics_vertex_buffer_create(
-		&(gs_graphics_vertex_buffer_desc_t){
-			.data  = map->bsp_graphics_vert_arr,
-			.size  = sizeof(bsp_vert_lump_t) * gs_dyn_array_size(map->bsp_graphics_vert_arr),
-			.usage = GS_GRAPHICS_BUFFER_USAGE_STATIC,
-		});
+	// World and submodels write to the same index buffer,
+	// all opaque batches go before any translucent ones.
+	uint32_t total = 0;
+	_bsp_batch_faces(map, -1, map->visible_faces, gs_dyn_array_size(map->visible_faces), &total);
+	for (size_t i = 0; i < gs_dyn_array_size(map->submodels); i++)
+	{
+		bsp_submodel_t submodel = map->submodels[i];
+		if (!submodel.visible) continue;
+
+		_bsp_batch_faces(map, i, map->visible_model_faces + submodel.first_visible_face, submodel.num_visible_faces, &total);
+	}
+
+	_bsp_batch_translucent_faces(map, view_position, &total);
+
+	gs_dyn_array_head(map->bsp_graphics_draw_index_arr)->size = total;
+
+	map->stats.visible_batches = gs_dyn_array_size(map->draw_batches);
 }
 
 void bsp_map_update(bsp_map_t *map, gs_camera_t *cam, const gs_vec2 fb)
@@ -387,12 +1540,28 @@ void bsp_map_update(bsp_map_t *map, gs_camera_t *cam, const gs_vec2 fb)
 	mg_time_manager_vis_start();
 
 	int32_t leaf = _bsp_find_camera_leaf(map, cam->transform.position);
-	if (leaf != map->previous_leaf)
+
+	// Flood areas when the camera enters another area or a portal opens or closes
+	bool32_t areas_changed = false;
+	int32_t area	       = map->leaves.data[leaf].area;
+	if (area != map->camera_area || map->area_portals_changed)
+	{
+		areas_changed = _bsp_flood_areas(map, area);
+	}
+
+	if (leaf != map->previous_leaf || areas_changed)
 	{
-		// TODO: recalc PVS, move from _bsp_calculate_visible_faces
+		// Neighbouring leaves usually share a cluster,
+		// only rebuild when the cluster or reachable areas change.
+		int32_t cluster = map->leaves.data[leaf].cluster;
+		if (cluster != map->pvs_cluster || areas_changed)
+		{
+			_bsp_calculate_pvs(map, cluster);
+		}
 	}
 
 	_bsp_calculate_visible_faces(map, leaf, cam, fb);
+	_bsp_build_draw_batches(map, cam->transform.position);
 	map->previous_leaf = leaf;
 
 	mg_time_manager_vis_end();
@@ -428,7 +1597,7 @@ void bsp_map_render_immediate(bsp_map_t *map, gs_immediate_draw_t *gsi, gs_camer
 			{
 				bsp_quadratic_patch_t quadratic = patch.quadratic_patches[j];
 
-				for (size_t k = 0; k < gs_dyn_array_size(quadratic.indices) - 2; k += 3)
+				for (size_t k = quadratic.lod_offsets[0]; k + 2 < quadratic.lod_offsets[1]; k += 3)
 				{
 					uint32_t index1 = quadratic.indices[k + 0];
 					uint32_t index2 = quadratic.indices[k + 1];
@@ -512,6 +1681,8 @@ void bsp_map_render(bsp_map_t *map, gs_camera_t *cam, gs_handle(gs_graphics_rend
 	// Uniforms that don't chang per face
 	gs_mat4 u_proj = mg_camera_get_view_projection(cam, (s32)fb.x, (s32)fb.y);
 
+	gs_mat4 u_model = gs_mat4_identity();
+
 	// Uniform binds
 	gs_graphics_bind_uniform_desc_t uniforms[] = {
 		{
@@ -519,6 +1690,11 @@ void bsp_map_render(bsp_map_t *map, gs_camera_t *cam, gs_handle(gs_graphics_rend
 			.data	 = &u_proj,
 			.binding = 0, // VERTEX
 		},
+		{
+			.uniform = map->bsp_graphics_u_model,
+			.data	 = &u_model,
+			.binding = 0, // VERTEX
+		},
 	};
 
 	// Vertex buffer binds
@@ -554,92 +1730,180 @@ void bsp_map_render(bsp_map_t *map, gs_camera_t *cam, gs_handle(gs_graphics_rend
 	gs_graphics_pipeline_bind(cb, wireframe ? map->bsp_graphics_wire_pipe : map->bsp_graphics_pipe);
 	gs_graphics_apply_bindings(cb, &binds);
 
-	// Draw faces
-	int32_t texture_index;
-	int32_t lm_index;
-	uint32_t vis_index;
-	bsp_face_renderable_t bsp_face;
-	for (size_t i = 0; i < gs_dyn_array_size(map->render_faces); i++)
+	if (wireframe)
 	{
-		if (!map->render_faces[i].visible) continue;
+		// Debug view, draw per face from the static index buffer to color by face type
+		_bsp_render_wireframe_faces(map, cb, map->visible_faces, gs_dyn_array_size(map->visible_faces));
 
-		bsp_face      = map->render_faces[i];
-		texture_index = map->faces.data[bsp_face.index].texture;
-		lm_index      = map->faces.data[bsp_face.index].lm_index;
-
-		if (texture_index >= 0 && map->texture_assets.data[texture_index] == NULL || !gs_handle_is_valid(map->texture_assets.data[texture_index]->hndl))
-		{
-			texture_index = -1;
-		}
-		if (lm_index >= 0 && !gs_handle_is_valid(map->lightmap_textures.data[lm_index]))
+		for (size_t i = 0; i < gs_dyn_array_size(map->submodels); i++)
 		{
-			lm_index = -1;
+			bsp_submodel_t submodel = map->submodels[i];
+			if (!submodel.visible) continue;
+
+			_bsp_apply_model_transform(map, cb, &submodel.transform);
+			_bsp_render_wireframe_faces(map, cb, map->visible_model_faces + submodel.first_visible_face, submodel.num_visible_faces);
 		}
+	}
+	else
+	{
+		// Upload this frame's batched indices
+		gs_graphics_index_buffer_request_update(
+			cb,
+			map->bsp_graphics_draw_ibo,
+			&(gs_graphics_index_buffer_desc_t){
+				.data	= map->bsp_graphics_draw_index_arr,
+				.size	= sizeof(uint32_t) * gs_dyn_array_size(map->bsp_graphics_draw_index_arr),
+				.usage	= GS_GRAPHICS_BUFFER_USAGE_DYNAMIC,
+				.update = {
+					.type	= GS_GRAPHICS_BUFFER_UPDATE_SUBDATA,
+					.offset = 0,
+				},
+			});
 
-		// Face specific uniforms
-		gs_graphics_bind_uniform_desc_t face_uniforms[] = {
-			// TEXTURE OR COLOR
-			{0},
-			// LIGHTMAP
-			{0},
+		gs_graphics_bind_index_buffer_desc_t draw_ibos[] = {
+			{.buffer = map->bsp_graphics_draw_ibo},
 		};
+		gs_graphics_bind_desc_t draw_binds = {
+			.index_buffers = {
+				.desc = draw_ibos,
+				.size = sizeof(draw_ibos),
+			},
+		};
+		gs_graphics_apply_bindings(cb, &draw_binds);
 
-		uint8_t uniform_count = wireframe ? 1 : 2;
-
-		gs_vec4_t color = gs_v4(0, 0, 0, 1.0);
-
-		if (wireframe)
+		// One draw per model and material, the pipeline follows the surface class.
+		// Submodels come after the world so classes can repeat.
+		bsp_surface_class bound_class = BSP_SURFACE_CLASS_OPAQUE;
+		int32_t bound_model	      = -1;
+		for (size_t i = 0; i < gs_dyn_array_size(map->draw_batches); i++)
 		{
-			switch (map->faces.data[bsp_face.index].type)
+			bsp_draw_batch_t batch	= map->draw_batches[i];
+			bsp_material_t material = map->materials[batch.material];
+
+			if (material.surface_class != bound_class)
 			{
-			case BSP_FACE_TYPE_POLYGON:
-				color.y = 1.0;
-				break;
+				bound_class = material.surface_class;
+				switch (bound_class)
+				{
+				case BSP_SURFACE_CLASS_ALPHA_TESTED:
+					gs_graphics_pipeline_bind(cb, map->bsp_graphics_alpha_test_pipe);
+					break;
 
-			case BSP_FACE_TYPE_MESH:
-				color.z = 1.0;
-				break;
+				case BSP_SURFACE_CLASS_TRANSLUCENT:
+					gs_graphics_pipeline_bind(cb, map->bsp_graphics_translucent_pipe);
+					break;
 
-			case BSP_FACE_TYPE_PATCH:
-				color.x = 1.0;
-				break;
+				default:
+					gs_graphics_pipeline_bind(cb, map->bsp_graphics_pipe);
+					break;
+				}
 
-			default:
-				color.x = 0.5;
-				color.y = 0.5;
-				color.z = 0.5;
+				// Bindings don't survive a pipeline change, world transform is reset
+				gs_graphics_apply_bindings(cb, &binds);
+				gs_graphics_apply_bindings(cb, &draw_binds);
+				bound_model = -1;
 			}
 
-			face_uniforms[0] = (gs_graphics_bind_uniform_desc_t){
-				.uniform = map->bsp_graphics_u_color,
-				.data	 = &color,
-				.binding = 0, // FRAGMENT
+			if (batch.model != bound_model)
+			{
+				bound_model = batch.model;
+				_bsp_apply_model_transform(map, cb, bound_model >= 0 ? &map->submodels[bound_model].transform : &u_model);
+			}
+
+			gs_graphics_bind_uniform_desc_t batch_uniforms[] = {
+				{
+					.uniform = map->bsp_graphics_u_tex,
+					.data	 = material.texture >= 0 ? &map->texture_assets.data[material.texture]->hndl : &map->missing_texture,
+					.binding = 0, // FRAGMENT
+				},
+				{
+					.uniform = map->bsp_graphics_u_lm,
+					.data	 = &map->lightmap_textures.data[material.lightmap],
+					.binding = 1, // FRAGMENT
+				},
+			};
+			gs_graphics_bind_desc_t batch_binds = {
+				.uniforms = {
+					.desc = batch_uniforms,
+					.size = sizeof(batch_uniforms),
+				},
 			};
+			gs_graphics_apply_bindings(cb, &batch_binds);
+
+			gs_graphics_draw(
+				cb,
+				&(gs_graphics_draw_desc_t){
+					.start = (size_t)(intptr_t)(batch.first_index * sizeof(uint32_t)),
+					.count = (size_t)batch.num_indices,
+				});
 		}
-		else
+	}
+
+	gs_graphics_renderpass_end(cb);
+
+	mg_time_manager_bsp_end();
+}
+
+void _bsp_apply_model_transform(bsp_map_t *map, gs_command_buffer_t *cb, const gs_mat4 *transform)
+{
+	gs_graphics_bind_uniform_desc_t model_uniforms[] = {
 		{
-			face_uniforms[0] = (gs_graphics_bind_uniform_desc_t){
-				.uniform = map->bsp_graphics_u_tex,
-				.data	 = texture_index >= 0 ? &map->texture_assets.data[texture_index]->hndl : &map->missing_texture,
-				.binding = 0, // FRAGMENT
-			};
-			face_uniforms[1] = (gs_graphics_bind_uniform_desc_t){
-				.uniform = map->bsp_graphics_u_lm,
-				.data	 = lm_index >= 0 ? &map->lightmap_textures.data[lm_index] : &map->missing_lm_texture,
-				.binding = 1, // FRAGMENT
-			};
+			.uniform = map->bsp_graphics_u_model,
+			.data	 = (void *)transform,
+			.binding = 0, // VERTEX
+		},
+	};
+	gs_graphics_bind_desc_t model_binds = {
+		.uniforms = {
+			.desc = model_uniforms,
+			.size = sizeof(model_uniforms),
+		},
+	};
+	gs_graphics_apply_bindings(cb, &model_binds);
+}
+
+void _bsp_render_wireframe_faces(bsp_map_t *map, gs_command_buffer_t *cb, const int32_t *faces, uint32_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		bsp_face_renderable_t bsp_face = map->render_faces[faces[i]];
+		gs_vec4_t color		       = gs_v4(0, 0, 0, 1.0);
+
+		switch (bsp_face.type)
+		{
+		case BSP_FACE_TYPE_POLYGON:
+			color.y = 1.0;
+			break;
+
+		case BSP_FACE_TYPE_MESH:
+			color.z = 1.0;
+			break;
+
+		case BSP_FACE_TYPE_PATCH:
+			color.x = 1.0;
+			break;
+
+		default:
+			color.x = 0.5;
+			color.y = 0.5;
+			color.z = 0.5;
 		}
 
-		// Bind uniforms
+		gs_graphics_bind_uniform_desc_t face_uniforms[] = {
+			{
+				.uniform = map->bsp_graphics_u_color,
+				.data	 = &color,
+				.binding = 0, // FRAGMENT
+			},
+		};
 		gs_graphics_bind_desc_t face_binds = {
 			.uniforms = {
 				.desc = face_uniforms,
-				.size = sizeof(gs_graphics_bind_uniform_desc_t) * uniform_count,
+				.size = sizeof(face_uniforms),
 			},
 		};
 		gs_graphics_apply_bindings(cb, &face_binds);
 
-		// Draw face
 		gs_graphics_draw(
 			cb,
 			&(gs_graphics_draw_desc_t){
@@ -647,10 +1911,6 @@ void bsp_map_render(bsp_map_t *map, gs_camera_t *cam, gs_handle(gs_graphics_rend
 				.count = (size_t)bsp_face.num_ibo_indices,
 			});
 	}
-
-	gs_graphics_renderpass_end(cb);
-
-	mg_time_manager_bsp_end();
 }
 
 void bsp_map_find_spawn_point(bsp_map_t *map, gs_vec3 *position, float32_t *yaw)
@@ -712,18 +1972,43 @@ void bsp_map_free(bsp_map_t *map)
 
 	/*==== Runtime data ====*/
 
+	// Not tied to graphics, may exist without bsp_map_init
+	bsp_trace_free(map);
+
 	if (map->valid)
 	{
 		gs_graphics_vertex_buffer_destroy(map->bsp_graphics_vbo);
 		gs_graphics_index_buffer_destroy(map->bsp_graphics_ibo);
+		gs_graphics_index_buffer_destroy(map->bsp_graphics_draw_ibo);
 		gs_graphics_pipeline_destroy(map->bsp_graphics_pipe);
+		gs_graphics_pipeline_destroy(map->bsp_graphics_alpha_test_pipe);
+		gs_graphics_pipeline_destroy(map->bsp_graphics_translucent_pipe);
 		gs_graphics_pipeline_destroy(map->bsp_graphics_wire_pipe);
 		gs_graphics_uniform_destroy(map->bsp_graphics_u_proj);
+		gs_graphics_uniform_destroy(map->bsp_graphics_u_model);
 		gs_graphics_uniform_destroy(map->bsp_graphics_u_tex);
 		gs_graphics_uniform_destroy(map->bsp_graphics_u_lm);
 		gs_graphics_uniform_destroy(map->bsp_graphics_u_color);
 		gs_dyn_array_free(map->bsp_graphics_index_arr);
 		gs_dyn_array_free(map->bsp_graphics_vert_arr);
+		gs_dyn_array_free(map->bsp_graphics_draw_index_arr);
+		gs_dyn_array_free(map->visible_faces);
+		gs_dyn_array_free(map->materials);
+		gs_dyn_array_free(map->material_indices);
+		gs_dyn_array_free(map->draw_batches);
+		gs_dyn_array_free(map->material_order);
+		gs_dyn_array_free(map->translucent_faces);
+		bsp_occlusion_free(&map->occlusion);
+
+		for (size_t i = 0; i < gs_dyn_array_size(map->submodels); i++)
+		{
+			gs_dyn_array_free(map->submodels[i].leaves);
+		}
+		gs_dyn_array_free(map->submodels);
+		gs_dyn_array_free(map->visible_model_faces);
+		gs_free(map->area_visible);
+		gs_free(map->area_stack);
+		gs_dyn_array_free(map->area_portals);
 
 		for (size_t i = 0; i < gs_dyn_array_size(map->entities); i++)
 		{
@@ -737,9 +2022,28 @@ void bsp_map_free(bsp_map_t *map)
 		}
 		gs_dyn_array_free(map->patches);
 		gs_dyn_array_free(map->render_faces);
+		gs_dyn_array_free(map->pvs_leaves);
+		gs_dyn_array_free(map->pvs_faces);
 
 		map->patches	  = NULL;
 		map->render_faces = NULL;
+		gs_dyn_array_free(map->node_pvs_leaves);
+		gs_dyn_array_free(map->node_parents);
+		gs_dyn_array_free(map->leaf_parents);
+		gs_dyn_array_free(map->vis_stack);
+		gs_dyn_array_free(map->vis_leaves);
+		_bsp_bounds_soa_free(&map->leaf_bounds);
+		_bsp_bounds_soa_free(&map->vis_test_bounds);
+		gs_free(map->vis_test_results);
+		map->vis_test_results = NULL;
+
+		map->pvs_leaves	     = NULL;
+		map->pvs_faces	     = NULL;
+		map->node_pvs_leaves = NULL;
+		map->node_parents    = NULL;
+		map->leaf_parents    = NULL;
+		map->vis_stack	     = NULL;
+		map->vis_leaves	     = NULL;
 
 		// data contents will be freed by texture manager
 		gs_free(map->texture_assets.data);
@@ -750,10 +2054,11 @@ void bsp_map_free(bsp_map_t *map)
 			gs_graphics_texture_destroy(map->lightmap_textures.data[i]);
 		}
 		gs_free(map->lightmap_textures.data);
+		gs_free(map->lightmap_pages);
 		map->lightmap_textures.data = NULL;
+		map->lightmap_pages	    = NULL;
 
 		gs_graphics_texture_destroy(map->missing_texture);
-		gs_graphics_texture_destroy(map->missing_lm_texture);
 	}
 
 	/*==== File data ====*/
@@ -821,96 +2126,348 @@ int32_t _bsp_find_camera_leaf(bsp_map_t *map, gs_vec3 view_position)
 	return ~leaf_index;
 }
 
-void _bsp_calculate_visible_faces(bsp_map_t *map, int32_t leaf, gs_camera_t *cam, const gs_vec2 fb)
+void _bsp_calculate_pvs(bsp_map_t *map, int32_t view_cluster)
 {
-	uint32_t culled_leaves_pvs     = 0;
-	uint32_t culled_leaves_frustum = 0;
-	uint32_t visible_leaves	       = 0;
-	uint32_t visible_patches       = 0;
-	uint32_t visible_faces	       = 0;
-	uint32_t visible_vertices      = 0;
-	uint32_t visible_indices       = 0;
-	int32_t view_cluster	       = map->leaves.data[leaf].cluster;
+	// Faces of the previous PVS may still be flagged visible
+	for (size_t i = 0; i < gs_dyn_array_size(map->pvs_faces); i++)
+	{
+		int32_t idx		       = map->pvs_faces[i];
+		map->render_faces[idx].visible = false;
+		map->render_faces[idx].in_pvs  = false;
+	}
 
-	for (size_t i = 0; i < gs_dyn_array_size(map->render_faces); i++)
+	gs_dyn_array_clear(map->pvs_leaves);
+	gs_dyn_array_clear(map->pvs_faces);
+
+	for (size_t i = 0; i < map->nodes.count; i++)
 	{
-		map->render_faces[i].visible = false;
+		map->node_pvs_leaves[i] = 0;
 	}
 
+	map->stats.culled_leaves_area = 0;
+
 	for (size_t i = 0; i < map->leaves.count; i++)
 	{
 		bsp_leaf_lump_t lump = map->leaves.data[i];
 
-		// TODO:
-		// Store PVS, don't run every frame if leaf doesn't change
 		if (!_bsp_cluster_visible(map, view_cluster, lump.cluster))
 		{
-			culled_leaves_pvs++;
 			continue;
 		}
 
-		// Frustum culling using lump.mins and lump.maxs
-		gs_mat4 proj	       = mg_camera_get_view_projection(cam, (s32)fb.x, (s32)fb.y);
-		mg_camera_frustum_t fr = mg_camera_get_frustum_planes(proj, false);
-
-		if (!mg_camera_aabb_in_frustum(
-			    fr,
-			    gs_v3(lump.mins[0], lump.mins[1], lump.mins[2]),
-			    gs_v3(lump.maxs[0], lump.maxs[1], lump.maxs[2])))
+		// Behind a closed area portal
+		if (!_bsp_area_visible(map, lump.area))
 		{
-			culled_leaves_frustum++;
+			map->stats.culled_leaves_area++;
 			continue;
 		}
 
-		visible_leaves++;
+		gs_dyn_array_push(map->pvs_leaves, (int32_t)i);
+
+		// Mark the path to root so the visibility walk can
+		// skip subtrees with nothing potentially visible.
+		for (int32_t node = map->leaf_parents[i]; node >= 0; node = map->node_parents[node])
+		{
+			map->node_pvs_leaves[node]++;
+		}
 
-		// Add faces in this leaf to visible set
 		for (size_t j = 0; j < lump.num_leaf_faces; j++)
 		{
-			int32_t idx		   = map->leaf_faces.data[lump.first_leaf_face + j].face;
-			bsp_face_renderable_t face = map->render_faces[idx];
+			int32_t idx = map->leaf_faces.data[lump.first_leaf_face + j].face;
 
 			// Same face can be in multiple leaves
-			if (face.visible)
+			if (map->render_faces[idx].in_pvs)
 			{
 				continue;
 			}
 
-			map->render_faces[idx].visible = true;
+			map->render_faces[idx].in_pvs = true;
+			gs_dyn_array_push(map->pvs_faces, idx);
+		}
+	}
+
+	map->pvs_cluster	     = view_cluster;
+	map->stats.culled_leaves_pvs = map->leaves.count - gs_dyn_array_size(map->pvs_leaves) - map->stats.culled_leaves_area;
+}
+
+void _bsp_calculate_visible_faces(bsp_map_t *map, int32_t leaf, gs_camera_t *cam, const gs_vec2 fb)
+{
+	map->stats.culled_leaves_frustum   = 0;
+	map->stats.culled_leaves_occlusion = 0;
+	map->stats.culled_nodes_frustum	   = 0;
+	map->stats.tested_leaves_frustum   = 0;
+	map->stats.culled_faces_backface   = 0;
+	map->stats.culled_faces_occlusion  = 0;
+	map->stats.skipped_faces_nodraw	   = 0;
+	map->stats.drawn_occluders	   = 0;
+	map->stats.visible_leaves	   = 0;
+	map->stats.visible_vertices	   = 0;
+	map->stats.visible_indices	   = 0;
+	map->stats.visible_faces	   = 0;
+	map->stats.visible_patches	   = 0;
+	map->stats.current_leaf		   = leaf;
+
+	// Anything outside the PVS was already cleared in _bsp_calculate_pvs
+	for (size_t i = 0; i < gs_dyn_array_size(map->pvs_faces); i++)
+	{
+		map->render_faces[map->pvs_faces[i]].visible = false;
+	}
+	map->occlusion.rendered = false;
+
+	if (map->nodes.count == 0)
+	{
+		return;
+	}
+
+	gs_mat4 proj	       = mg_camera_get_view_projection(cam, (s32)fb.x, (s32)fb.y);
+	mg_camera_frustum_t fr = mg_camera_get_frustum_planes(proj, false);
+	gs_vec3 view_position  = cam->transform.position;
+
+	// Walk the tree front to back, node bounds contain all of their children.
+	gs_dyn_array_clear(map->vis_stack);
+	gs_dyn_array_clear(map->vis_leaves);
+	gs_dyn_array_clear(map->visible_faces);
+	map->vis_test_bounds.count = 0;
+	gs_dyn_array_push(map->vis_stack, ((bsp_vis_node_t){.index = 0, .plane_mask = 0x3f}));
 
-			// TODO billboards
-			if (face.type == BSP_FACE_TYPE_BILLBOARD)
+	while (gs_dyn_array_size(map->vis_stack) > 0)
+	{
+		bsp_vis_node_t vis = map->vis_stack[gs_dyn_array_size(map->vis_stack) - 1];
+		gs_dyn_array_pop(map->vis_stack);
+
+		if (vis.index < 0)
+		{
+			int32_t leaf_index = ~vis.index;
+
+			bsp_leaf_lump_t lump = map->leaves.data[leaf_index];
+			if (!_bsp_cluster_visible(map, map->pvs_cluster, lump.cluster) || !_bsp_area_visible(map, lump.area))
 			{
 				continue;
 			}
 
-			if (face.type == BSP_FACE_TYPE_PATCH)
+			bsp_vis_leaf_t vis_leaf = {
+				.index	    = leaf_index,
+				.test_index = -1,
+			};
+
+			// Leaves of fully inside nodes have nothing left to test
+			if (vis.plane_mask)
 			{
-				visible_patches++;
-				bsp_patch_t patch = map->patches[face.index];
-				for (size_t k = 0; k < gs_dyn_array_size(patch.quadratic_patches); k++)
-				{
-					visible_vertices += gs_dyn_array_size(patch.quadratic_patches[k].vertices);
-					visible_indices += gs_dyn_array_size(patch.quadratic_patches[k].indices);
-				}
+				bsp_bounds_soa_t *test	 = &map->vis_test_bounds;
+				vis_leaf.test_index	 = test->count;
+				test->min_x[test->count] = map->leaf_bounds.min_x[leaf_index];
+				test->min_y[test->count] = map->leaf_bounds.min_y[leaf_index];
+				test->min_z[test->count] = map->leaf_bounds.min_z[leaf_index];
+				test->max_x[test->count] = map->leaf_bounds.max_x[leaf_index];
+				test->max_y[test->count] = map->leaf_bounds.max_y[leaf_index];
+				test->max_z[test->count] = map->leaf_bounds.max_z[leaf_index];
+				test->count++;
 			}
-			else
+
+			gs_dyn_array_push(map->vis_leaves, vis_leaf);
+			continue;
+		}
+
+		uint32_t pvs_leaves = map->node_pvs_leaves[vis.index];
+		if (pvs_leaves == 0)
+		{
+			continue;
+		}
+
+		bsp_node_lump_t node = map->nodes.data[vis.index];
+
+		if (vis.plane_mask && !mg_camera_aabb_in_frustum_masked(
+					      &fr,
+					      gs_v3(node.mins[0], node.mins[1], node.mins[2]),
+					      gs_v3(node.maxs[0], node.maxs[1], node.maxs[2]),
+					      &vis.plane_mask))
+		{
+			map->stats.culled_nodes_frustum++;
+			map->stats.culled_leaves_frustum += pvs_leaves;
+			continue;
+		}
+
+		// Push far side first so near side is processed first
+		bsp_plane_lump_t plane = map->planes.data[node.plane];
+		int32_t near_side      = point_in_front_of_plane(plane.normal, plane.dist, view_position) ? 0 : 1;
+		gs_dyn_array_push(map->vis_stack, ((bsp_vis_node_t){.index = node.children[near_side ^ 1], .plane_mask = vis.plane_mask}));
+		gs_dyn_array_push(map->vis_stack, ((bsp_vis_node_t){.index = node.children[near_side], .plane_mask = vis.plane_mask}));
+	}
+
+	// Test all partially visible leaves at once
+	bsp_bounds_soa_t *test = &map->vis_test_bounds;
+	mg_camera_aabbs_in_frustum(
+		&fr,
+		test->min_x,
+		test->min_y,
+		test->min_z,
+		test->max_x,
+		test->max_y,
+		test->max_z,
+		test->count,
+		map->vis_test_results);
+	map->stats.tested_leaves_frustum = test->count;
+
+	// Rasterize occluders in the PVS and frustum, then test against them
+	bool32_t occlusion = mg_cvar("r_occlusion")->value.i && gs_dyn_array_size(map->occlusion.occluders) > 0;
+	if (occlusion)
+	{
+		map->stats.drawn_occluders = bsp_occlusion_render(&map->occlusion, map, proj, &fr, view_position);
+	}
+	map->occlusion.rendered = occlusion;
+
+	for (size_t i = 0; i < gs_dyn_array_size(map->vis_leaves); i++)
+	{
+		bsp_vis_leaf_t vis_leaf = map->vis_leaves[i];
+		if (vis_leaf.test_index >= 0 && !map->vis_test_results[vis_leaf.test_index])
+		{
+			map->stats.culled_leaves_frustum++;
+			continue;
+		}
+
+		bsp_leaf_lump_t lump = map->leaves.data[vis_leaf.index];
+		if (occlusion && !bsp_occlusion_test_aabb(
+					 &map->occlusion,
+					 gs_v3(lump.mins[0], lump.mins[1], lump.mins[2]),
+					 gs_v3(lump.maxs[0], lump.maxs[1], lump.maxs[2])))
+		{
+			map->stats.culled_leaves_occlusion++;
+			continue;
+		}
+
+		_bsp_add_leaf_faces(map, vis_leaf.index, view_position, occlusion);
+	}
+
+	_bsp_select_patch_lods(map, &fr, view_position);
+	_bsp_calculate_visible_models(map, &fr, view_position, occlusion);
+}
+
+// Pick LOD of visible patches by camera distance
+// and cull their quadratic patches individually.
+void _bsp_select_patch_lods(bsp_map_t *map, const mg_camera_frustum_t *fr, const gs_vec3 view_position)
+{
+	for (size_t i = 0; i < gs_dyn_array_size(map->visible_faces); i++)
+	{
+		bsp_face_renderable_t face = map->render_faces[map->visible_faces[i]];
+		if (face.type != BSP_FACE_TYPE_PATCH)
+		{
+			continue;
+		}
+
+		bsp_patch_t *patch = &map->patches[face.index];
+
+		// Distance to closest point of bounds
+		gs_vec3 closest = gs_v3(
+			gs_clamp(view_position.x, patch->mins.x, patch->maxs.x),
+			gs_clamp(view_position.y, patch->mins.y, patch->maxs.y),
+			gs_clamp(view_position.z, patch->mins.z, patch->maxs.z));
+		float32_t dist = gs_vec3_dist(view_position, closest);
+
+		float32_t lod_dist = BSP_PATCH_LOD_DISTANCE;
+		patch->lod	   = 0;
+		while (patch->lod < BSP_PATCH_LOD_COUNT - 1 && dist > lod_dist)
+		{
+			patch->lod++;
+			lod_dist *= 2.0f;
+		}
+
+		for (size_t j = 0; j < gs_dyn_array_size(patch->quadratic_patches); j++)
+		{
+			bsp_quadratic_patch_t *quadratic = &patch->quadratic_patches[j];
+			quadratic->visible		 = mg_camera_aabb_in_frustum(*fr, quadratic->mins, quadratic->maxs);
+			if (!quadratic->visible)
 			{
-				visible_faces++;
-				visible_vertices += map->faces.data[face.index].num_vertices;
-				visible_vertices += map->faces.data[face.index].num_indices;
+				continue;
 			}
+
+			map->stats.visible_vertices += gs_dyn_array_size(quadratic->vertices);
+			map->stats.visible_indices += quadratic->lod_offsets[patch->lod + 1] - quadratic->lod_offsets[patch->lod];
+		}
+	}
+}
+
+void _bsp_add_leaf_faces(bsp_map_t *map, int32_t leaf, const gs_vec3 view_position, bool32_t occlusion)
+{
+	bsp_leaf_lump_t lump = map->leaves.data[leaf];
+
+	map->stats.visible_leaves++;
+
+	for (size_t i = 0; i < lump.num_leaf_faces; i++)
+	{
+		int32_t idx		   = map->leaf_faces.data[lump.first_leaf_face + i].face;
+		bsp_face_renderable_t face = map->render_faces[idx];
+
+		// Same face can be in multiple leaves
+		if (face.visible)
+		{
+			continue;
+		}
+
+		map->render_faces[idx].visible = true;
+
+		// TODO billboards
+		if (face.type == BSP_FACE_TYPE_BILLBOARD)
+		{
+			continue;
+		}
+
+		if (face.surface_class == BSP_SURFACE_CLASS_SKY || face.surface_class == BSP_SURFACE_CLASS_NODRAW)
+		{
+			map->stats.skipped_faces_nodraw++;
+			continue;
+		}
+
+		// Camera behind a planar face
+		if (face.type == BSP_FACE_TYPE_POLYGON && !face.two_sided && gs_vec3_dot(face.normal, view_position) - face.dist <= 0.0f)
+		{
+			map->stats.culled_faces_backface++;
+			continue;
+		}
+
+		if (occlusion && !bsp_occlusion_test_aabb(&map->occlusion, face.mins, face.maxs))
+		{
+			map->stats.culled_faces_occlusion++;
+			continue;
+		}
+
+		gs_dyn_array_push(map->visible_faces, idx);
+
+		// Patch vertices and indices depend on LOD, see _bsp_select_patch_lods
+		if (face.type == BSP_FACE_TYPE_PATCH)
+		{
+			map->stats.visible_patches++;
+		}
+		else
+		{
+			map->stats.visible_faces++;
+			map->stats.visible_vertices += map->faces.data[face.index].num_vertices;
+			map->stats.visible_indices += map->faces.data[face.index].num_indices;
 		}
 	}
+}
 
-	map->stats.culled_leaves_pvs	 = culled_leaves_pvs;
-	map->stats.culled_leaves_frustum = culled_leaves_frustum;
-	map->stats.visible_leaves	 = visible_leaves;
-	map->stats.visible_vertices	 = visible_vertices;
-	map->stats.visible_indices	 = visible_indices;
-	map->stats.visible_faces	 = visible_faces;
-	map->stats.visible_patches	 = visible_patches;
-	map->stats.current_leaf		 = leaf;
+void _bsp_bounds_soa_alloc(bsp_bounds_soa_t *soa, uint32_t count)
+{
+	// Never allocate zero bytes
+	size_t sz  = sizeof(float32_t) * (count > 0 ? count : 1);
+	soa->count = count;
+	soa->min_x = gs_malloc(sz);
+	soa->min_y = gs_malloc(sz);
+	soa->min_z = gs_malloc(sz);
+	soa->max_x = gs_malloc(sz);
+	soa->max_y = gs_malloc(sz);
+	soa->max_z = gs_malloc(sz);
+}
+
+void _bsp_bounds_soa_free(bsp_bounds_soa_t *soa)
+{
+	gs_free(soa->min_x);
+	gs_free(soa->min_y);
+	gs_free(soa->min_z);
+	gs_free(soa->max_x);
+	gs_free(soa->max_y);
+	gs_free(soa->max_z);
+	*soa = (bsp_bounds_soa_t){0};
 }
 
 bool32_t _bsp_cluster_visible(bsp_map_t *map, int32_t view_cluster, int32_t test_cluster)
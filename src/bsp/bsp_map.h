@@ -14,6 +14,7 @@
 #include <gs/util/gs_idraw.h>
 
 #include "../graphics/types.h"
+#include "../util/camera.h"
 #include "../util/math.h"
 #include "../util/string.h"
 #include "bsp_entity.h"
@@ -26,13 +27,43 @@ void _bsp_load_textures(bsp_map_t *map);
 void _bsp_load_lightmaps(bsp_map_t *map);
 void _bsp_load_lightvols(bsp_map_t *map);
 void _bsp_create_patch(bsp_map_t *map, bsp_face_lump_t face);
+bsp_surface_class _bsp_classify_surface(bsp_map_t *map, int32_t texture_index);
+bool _bsp_face_is_two_sided(bsp_map_t *map, bsp_face_lump_t face);
+void _bsp_tesselate_patches(bsp_map_t *map);
 void _bsp_map_create_buffers(bsp_map_t *map);
+gs_vec2 _bsp_face_uv_offset(bsp_map_t *map, uint32_t face);
+void _bsp_optimize_buffers(bsp_map_t *map);
+bsp_packed_vert_t *_bsp_pack_vertices(bsp_map_t *map);
+void _bsp_create_materials(bsp_map_t *map);
+uint32_t _bsp_face_draw_index_count(bsp_map_t *map, bsp_face_renderable_t face);
+uint32_t _bsp_face_copy_draw_indices(bsp_map_t *map, bsp_face_renderable_t face, uint32_t *dst);
+void _bsp_batch_faces(bsp_map_t *map, int32_t model, const int32_t *faces, uint32_t count, uint32_t *total);
+void _bsp_add_translucent_faces(bsp_map_t *map, int32_t model, const int32_t *faces, uint32_t count, const gs_vec3 view_position);
+void _bsp_batch_translucent_faces(bsp_map_t *map, const gs_vec3 view_position, uint32_t *total);
+void _bsp_build_draw_batches(bsp_map_t *map, const gs_vec3 view_position);
 void bsp_map_update(bsp_map_t *map, gs_camera_t *cam, const gs_vec2 fb);
 void bsp_map_render_immediate(bsp_map_t *map, gs_immediate_draw_t *gsi, gs_camera_t *cam);
 void bsp_map_render(bsp_map_t *map, gs_camera_t *cam, gs_handle(gs_graphics_renderpass_t) rp, gs_command_buffer_t *cb, const gs_vec2 fb);
+void _bsp_apply_model_transform(bsp_map_t *map, gs_command_buffer_t *cb, const gs_mat4 *transform);
+void _bsp_render_wireframe_faces(bsp_map_t *map, gs_command_buffer_t *cb, const int32_t *faces, uint32_t count);
 void bsp_map_find_spawn_point(bsp_map_t *map, gs_vec3 *position, float32_t *yaw);
 void bsp_map_free(bsp_map_t *map);
 int32_t _bsp_find_camera_leaf(bsp_map_t *map, gs_vec3 view_position);
+void _bsp_calculate_pvs(bsp_map_t *map, int32_t view_cluster);
+void _bsp_load_area_portals(bsp_map_t *map);
+void _bsp_create_submodels(bsp_map_t *map);
+void _bsp_update_submodel_bounds(bsp_map_t *map, bsp_submodel_t *submodel);
+void _bsp_box_leaves(bsp_map_t *map, int32_t node, const gs_vec3 mins, const gs_vec3 maxs, bsp_submodel_t *submodel);
+void _bsp_calculate_visible_models(bsp_map_t *map, const mg_camera_frustum_t *fr, const gs_vec3 view_position, bool32_t occlusion);
+void bsp_map_set_model_transform(bsp_map_t *map, int32_t model, const gs_mat4 transform);
+void _bsp_box_areas(bsp_map_t *map, int32_t node, const gs_vec3 mins, const gs_vec3 maxs, int32_t *areas, uint32_t *count);
+bool32_t _bsp_flood_areas(bsp_map_t *map, int32_t camera_area);
+bool32_t _bsp_area_visible(bsp_map_t *map, int32_t area);
+void bsp_map_set_area_portal(bsp_map_t *map, int32_t model, bool32_t open);
+void _bsp_add_leaf_faces(bsp_map_t *map, int32_t leaf, const gs_vec3 view_position, bool32_t occlusion);
+void _bsp_select_patch_lods(bsp_map_t *map, const mg_camera_frustum_t *fr, const gs_vec3 view_position);
+void _bsp_bounds_soa_alloc(bsp_bounds_soa_t *soa, uint32_t count);
+void _bsp_bounds_soa_free(bsp_bounds_soa_t *soa);
 void _bsp_calculate_visible_faces(bsp_map_t *map, int32_t leaf, gs_camera_t *cam, const gs_vec2 fb);
 bool32_t _bsp_cluster_visible(bsp_map_t *map, int32_t view_cluster, int32_t test_cluster);
 bsp_lightvol_lump_t bsp_get_lightvol(bsp_map_t *map, gs_vec3 position, gs_vec3 *center);
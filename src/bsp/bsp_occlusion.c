@@ -0,0 +1,421 @@
+/*================================================================
+	* bsp/bsp_occlusion.c
+	*
+	* Copyright (c) 2021 Lauri Räsänen
+	* ================================
+
+	Software occlusion culling against large BSP faces.
+
+	Nearby occluders are rasterized into a small depth buffer
+	every frame, bounds are then tested against its tiles
+	and pixels before anything is submitted to the GPU.
+=================================================================*/
+
+#include <float.h>
+
+#include "bsp_occlusion.h"
+#include "../util/simd.h"
+
+#define BSP_OCCLUSION_TILES_X (BSP_OCCLUSION_WIDTH / BSP_OCCLUSION_TILE)
+#define BSP_OCCLUSION_TILES_Y (BSP_OCCLUSION_HEIGHT / BSP_OCCLUSION_TILE)
+
+// Pick opaque planar faces large enough to hide something
+void bsp_occlusion_init(bsp_occlusion_t *occlusion, bsp_map_t *map)
+{
+	occlusion->depth = gs_malloc(sizeof(float32_t) * BSP_OCCLUSION_WIDTH * BSP_OCCLUSION_HEIGHT);
+	occlusion->hiz	 = gs_malloc(sizeof(float32_t) * BSP_OCCLUSION_TILES_X * BSP_OCCLUSION_TILES_Y);
+
+	// World faces only, submodels move
+	uint32_t num_faces = map->models.count > 0 ? map->models.data[0].num_faces : 0;
+	for (size_t i = 0; i < num_faces; i++)
+	{
+		bsp_face_renderable_t face = map->render_faces[i];
+		if (face.type != BSP_FACE_TYPE_POLYGON || face.surface_class != BSP_SURFACE_CLASS_OPAQUE || face.two_sided)
+		{
+			continue;
+		}
+
+		bsp_face_lump_t lump = map->faces.data[i];
+		float32_t area	     = 0.0f;
+		for (size_t j = 0; j + 2 < lump.num_indices; j += 3)
+		{
+			gs_vec3 a = map->vertices.data[lump.first_vertex + map->indices.data[lump.first_index + j + 0].offset].position;
+			gs_vec3 b = map->vertices.data[lump.first_vertex + map->indices.data[lump.first_index + j + 1].offset].position;
+			gs_vec3 c = map->vertices.data[lump.first_vertex + map->indices.data[lump.first_index + j + 2].offset].position;
+			area += gs_vec3_len(gs_vec3_cross(gs_vec3_sub(b, a), gs_vec3_sub(c, a))) * 0.5f;
+		}
+
+		if (area < BSP_OCCLUSION_MIN_AREA)
+		{
+			continue;
+		}
+
+		bsp_occluder_t occluder = {
+			.face	      = i,
+			.first_vertex = gs_dyn_array_size(occlusion->vertices),
+			.num_vertices = lump.num_indices - lump.num_indices % 3,
+			.area	      = area,
+		};
+
+		for (size_t j = 0; j < occluder.num_vertices; j++)
+		{
+			gs_dyn_array_push(occlusion->vertices, map->vertices.data[lump.first_vertex + map->indices.data[lump.first_index + j].offset].position);
+		}
+
+		gs_dyn_array_push(occlusion->occluders, occluder);
+	}
+
+	gs_dyn_array_reserve(occlusion->candidates, gs_dyn_array_size(occlusion->occluders));
+}
+
+void bsp_occlusion_free(bsp_occlusion_t *occlusion)
+{
+	gs_free(occlusion->depth);
+	gs_free(occlusion->hiz);
+	gs_dyn_array_free(occlusion->occluders);
+	gs_dyn_array_free(occlusion->vertices);
+	gs_dyn_array_free(occlusion->candidates);
+	occlusion->depth = NULL;
+	occlusion->hiz	 = NULL;
+}
+
+static inline gs_vec4 _bsp_occlusion_transform(const gs_mat4 *m, const gs_vec3 p)
+{
+	gs_vec4 clip;
+	for (size_t i = 0; i < 4; i++)
+	{
+		clip.xyzw[i] = m->m[0][i] * p.x + m->m[1][i] * p.y + m->m[2][i] * p.z + m->m[3][i];
+	}
+	return clip;
+}
+
+// Screen position and inverse depth of a clip space point in front of the near plane
+static inline gs_vec3 _bsp_occlusion_project(const gs_vec4 clip)
+{
+	float32_t inv_w = 1.0f / clip.w;
+	return gs_v3(
+		(clip.x * inv_w * 0.5f + 0.5f) * BSP_OCCLUSION_WIDTH,
+		(clip.y * inv_w * 0.5f + 0.5f) * BSP_OCCLUSION_HEIGHT,
+		inv_w);
+}
+
+// Rasterize a screen space triangle, keeping the closest depth.
+// Conservative, only pixels the triangle covers completely are written
+// so occluders never grow past their silhouette.
+static void _bsp_occlusion_draw_triangle(bsp_occlusion_t *occlusion, gs_vec3 v0, gs_vec3 v1, gs_vec3 v2)
+{
+	float32_t area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+	if (fabsf(area) < 1e-6f)
+	{
+		return;
+	}
+
+	// Either winding, CPU already culled back faces
+	if (area < 0.0f)
+	{
+		gs_vec3 tmp = v1;
+		v1	    = v2;
+		v2	    = tmp;
+		area	    = -area;
+	}
+
+	int32_t min_x = gs_max((int32_t)floorf(gs_min(v0.x, gs_min(v1.x, v2.x))), 0);
+	int32_t min_y = gs_max((int32_t)floorf(gs_min(v0.y, gs_min(v1.y, v2.y))), 0);
+	int32_t max_x = gs_min((int32_t)ceilf(gs_max(v0.x, gs_max(v1.x, v2.x))), BSP_OCCLUSION_WIDTH - 1);
+	int32_t max_y = gs_min((int32_t)ceilf(gs_max(v0.y, gs_max(v1.y, v2.y))), BSP_OCCLUSION_HEIGHT - 1);
+	if (min_x > max_x || min_y > max_y)
+	{
+		return;
+	}
+
+	// Start rows on a SIMD boundary
+	min_x &= ~3;
+
+	// Edge functions are positive inside, step per pixel in x and y
+	float32_t e0_dx = -(v2.y - v1.y), e0_dy = v2.x - v1.x;
+	float32_t e1_dx = -(v0.y - v2.y), e1_dy = v0.x - v2.x;
+	float32_t e2_dx = -(v1.y - v0.y), e2_dy = v1.x - v0.x;
+
+	float32_t px = min_x + 0.5f;
+	float32_t py = min_y + 0.5f;
+	float32_t e0 = e0_dy * (py - v1.y) + e0_dx * (px - v1.x);
+	float32_t e1 = e1_dy * (py - v2.y) + e1_dx * (px - v2.x);
+	float32_t e2 = e2_dy * (py - v0.y) + e2_dx * (px - v0.x);
+
+	// Inverse depth is linear in screen space
+	float32_t inv_area = 1.0f / area;
+	float32_t z_dx	   = (e1_dx * (v1.z - v0.z) + e2_dx * (v2.z - v0.z)) * inv_area;
+	float32_t z_dy	   = (e1_dy * (v1.z - v0.z) + e2_dy * (v2.z - v0.z)) * inv_area;
+	float32_t z	   = v0.z + (e1 * (v1.z - v0.z) + e2 * (v2.z - v0.z)) * inv_area;
+
+	// Move edges and depth from the pixel center to the worst corner:
+	// the corner furthest outside each edge and the farthest depth.
+	e0 -= 0.5f * (fabsf(e0_dx) + fabsf(e0_dy));
+	e1 -= 0.5f * (fabsf(e1_dx) + fabsf(e1_dy));
+	e2 -= 0.5f * (fabsf(e2_dx) + fabsf(e2_dy));
+	z -= 0.5f * (fabsf(z_dx) + fabsf(z_dy));
+
+	for (int32_t y = min_y; y <= max_y; y++)
+	{
+		float32_t *row = occlusion->depth + y * BSP_OCCLUSION_WIDTH;
+		int32_t x      = min_x;
+
+#if defined(MG_SIMD_SSE)
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 lane = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+		__m128 w0	  = _mm_add_ps(_mm_set1_ps(e0), _mm_mul_ps(lane, _mm_set1_ps(e0_dx)));
+		__m128 w1	  = _mm_add_ps(_mm_set1_ps(e1), _mm_mul_ps(lane, _mm_set1_ps(e1_dx)));
+		__m128 w2	  = _mm_add_ps(_mm_set1_ps(e2), _mm_mul_ps(lane, _mm_set1_ps(e2_dx)));
+		__m128 wz	  = _mm_add_ps(_mm_set1_ps(z), _mm_mul_ps(lane, _mm_set1_ps(z_dx)));
+		const __m128 s0	  = _mm_set1_ps(e0_dx * 4.0f);
+		const __m128 s1	  = _mm_set1_ps(e1_dx * 4.0f);
+		const __m128 s2	  = _mm_set1_ps(e2_dx * 4.0f);
+		const __m128 sz	  = _mm_set1_ps(z_dx * 4.0f);
+		for (; x <= max_x; x += 4)
+		{
+			__m128 inside = _mm_and_ps(_mm_cmpge_ps(w0, zero), _mm_and_ps(_mm_cmpge_ps(w1, zero), _mm_cmpge_ps(w2, zero)));
+			if (_mm_movemask_ps(inside))
+			{
+				__m128 d = _mm_loadu_ps(row + x);
+				d	 = _mm_or_ps(_mm_and_ps(inside, _mm_max_ps(d, wz)), _mm_andnot_ps(inside, d));
+				_mm_storeu_ps(row + x, d);
+			}
+			w0 = _mm_add_ps(w0, s0);
+			w1 = _mm_add_ps(w1, s1);
+			w2 = _mm_add_ps(w2, s2);
+			wz = _mm_add_ps(wz, sz);
+		}
+#elif defined(MG_SIMD_NEON)
+		const float32x4_t zero = vdupq_n_f32(0);
+		const float32_t lanes[4] = {0.0f, 1.0f, 2.0f, 3.0f};
+		const float32x4_t lane	 = vld1q_f32(lanes);
+		float32x4_t w0		 = vmlaq_n_f32(vdupq_n_f32(e0), lane, e0_dx);
+		float32x4_t w1		 = vmlaq_n_f32(vdupq_n_f32(e1), lane, e1_dx);
+		float32x4_t w2		 = vmlaq_n_f32(vdupq_n_f32(e2), lane, e2_dx);
+		float32x4_t wz		 = vmlaq_n_f32(vdupq_n_f32(z), lane, z_dx);
+		for (; x <= max_x; x += 4)
+		{
+			uint32x4_t inside = vandq_u32(vcgeq_f32(w0, zero), vandq_u32(vcgeq_f32(w1, zero), vcgeq_f32(w2, zero)));
+			float32x4_t d	  = vld1q_f32(row + x);
+			vst1q_f32(row + x, vbslq_f32(inside, vmaxq_f32(d, wz), d));
+			w0 = vaddq_f32(w0, vdupq_n_f32(e0_dx * 4.0f));
+			w1 = vaddq_f32(w1, vdupq_n_f32(e1_dx * 4.0f));
+			w2 = vaddq_f32(w2, vdupq_n_f32(e2_dx * 4.0f));
+			wz = vaddq_f32(wz, vdupq_n_f32(z_dx * 4.0f));
+		}
+#endif
+
+		// Everything without SIMD, rows always end on a SIMD boundary
+		for (; x <= max_x; x++)
+		{
+			float32_t offset = x - min_x;
+			if (e0 + e0_dx * offset >= 0.0f && e1 + e1_dx * offset >= 0.0f && e2 + e2_dx * offset >= 0.0f)
+			{
+				row[x] = gs_max(row[x], z + z_dx * offset);
+			}
+		}
+
+		e0 += e0_dy;
+		e1 += e1_dy;
+		e2 += e2_dy;
+		z += z_dy;
+	}
+}
+
+// Clip a triangle to the near plane and rasterize what's left
+static void _bsp_occlusion_draw_clip_triangle(bsp_occlusion_t *occlusion, const gs_vec4 *tri)
+{
+	gs_vec4 poly[4];
+	uint32_t count = 0;
+
+	for (size_t i = 0; i < 3; i++)
+	{
+		gs_vec4 a	= tri[i];
+		gs_vec4 b	= tri[(i + 1) % 3];
+		bool32_t a_in	= a.w >= BSP_OCCLUSION_NEAR;
+		bool32_t b_in	= b.w >= BSP_OCCLUSION_NEAR;
+
+		if (a_in)
+		{
+			poly[count++] = a;
+		}
+
+		if (a_in != b_in)
+		{
+			float32_t t   = (BSP_OCCLUSION_NEAR - a.w) / (b.w - a.w);
+			poly[count++] = gs_vec4_add(a, gs_vec4_scale(gs_vec4_sub(b, a), t));
+		}
+	}
+
+	if (count < 3)
+	{
+		return;
+	}
+
+	gs_vec3 screen[4];
+	for (size_t i = 0; i < count; i++)
+	{
+		screen[i] = _bsp_occlusion_project(poly[i]);
+	}
+
+	for (size_t i = 1; i + 1 < count; i++)
+	{
+		_bsp_occlusion_draw_triangle(occlusion, screen[0], screen[i], screen[i + 1]);
+	}
+}
+
+static int _bsp_occluder_compare(const void *a, const void *b)
+{
+	float32_t score_a = ((const bsp_occluder_candidate_t *)a)->score;
+	float32_t score_b = ((const bsp_occluder_candidate_t *)b)->score;
+	return (score_a < score_b) - (score_a > score_b);
+}
+
+// Rasterize the largest visible occluders and build the tile depths.
+// Returns the number of occluders drawn.
+uint32_t bsp_occlusion_render(bsp_occlusion_t *occlusion, bsp_map_t *map, const gs_mat4 view_projection, const mg_camera_frustum_t *fr, const gs_vec3 view_position)
+{
+	occlusion->view_projection = view_projection;
+	memset(occlusion->depth, 0, sizeof(float32_t) * BSP_OCCLUSION_WIDTH * BSP_OCCLUSION_HEIGHT);
+
+	// Score potentially visible occluders by area over squared distance
+	gs_dyn_array_clear(occlusion->candidates);
+	for (size_t i = 0; i < gs_dyn_array_size(occlusion->occluders); i++)
+	{
+		bsp_occluder_t occluder	   = occlusion->occluders[i];
+		bsp_face_renderable_t face = map->render_faces[occluder.face];
+
+		if (!face.in_pvs || gs_vec3_dot(face.normal, view_position) - face.dist <= 0.0f)
+		{
+			continue;
+		}
+
+		if (!mg_camera_aabb_in_frustum(*fr, face.mins, face.maxs))
+		{
+			continue;
+		}
+
+		gs_vec3 closest = gs_v3(
+			gs_clamp(view_position.x, face.mins.x, face.maxs.x),
+			gs_clamp(view_position.y, face.mins.y, face.maxs.y),
+			gs_clamp(view_position.z, face.mins.z, face.maxs.z));
+		gs_vec3 delta	   = gs_vec3_sub(closest, view_position);
+		float32_t dist_sqr = gs_max(gs_vec3_dot(delta, delta), 1.0f);
+
+		gs_dyn_array_push(occlusion->candidates, ((bsp_occluder_candidate_t){.occluder = i, .score = occluder.area / dist_sqr}));
+	}
+
+	uint32_t count = gs_dyn_array_size(occlusion->candidates);
+	qsort(occlusion->candidates, count, sizeof(bsp_occluder_candidate_t), _bsp_occluder_compare);
+	count = gs_min(count, BSP_OCCLUSION_MAX_OCCLUDERS);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		bsp_occluder_t occluder = occlusion->occluders[occlusion->candidates[i].occluder];
+		for (size_t j = 0; j < occluder.num_vertices; j += 3)
+		{
+			gs_vec4 tri[3];
+			for (size_t k = 0; k < 3; k++)
+			{
+				tri[k] = _bsp_occlusion_transform(&occlusion->view_projection, occlusion->vertices[occluder.first_vertex + j + k]);
+			}
+			_bsp_occlusion_draw_clip_triangle(occlusion, tri);
+		}
+	}
+
+	// Farthest depth per tile
+	for (size_t ty = 0; ty < BSP_OCCLUSION_TILES_Y; ty++)
+	{
+		for (size_t tx = 0; tx < BSP_OCCLUSION_TILES_X; tx++)
+		{
+			float32_t farthest = FLT_MAX;
+			for (size_t y = 0; y < BSP_OCCLUSION_TILE; y++)
+			{
+				float32_t *row = occlusion->depth + (ty * BSP_OCCLUSION_TILE + y) * BSP_OCCLUSION_WIDTH + tx * BSP_OCCLUSION_TILE;
+				for (size_t x = 0; x < BSP_OCCLUSION_TILE; x++)
+				{
+					farthest = gs_min(farthest, row[x]);
+				}
+			}
+			occlusion->hiz[ty * BSP_OCCLUSION_TILES_X + tx] = farthest;
+		}
+	}
+
+	return count;
+}
+
+// Returns false if the box is completely behind rendered occluders.
+bool32_t bsp_occlusion_test_aabb(const bsp_occlusion_t *occlusion, const gs_vec3 mins, const gs_vec3 maxs)
+{
+	float32_t min_x	  = FLT_MAX;
+	float32_t min_y	  = FLT_MAX;
+	float32_t max_x	  = -FLT_MAX;
+	float32_t max_y	  = -FLT_MAX;
+	float32_t nearest = 0.0f;
+
+	for (size_t i = 0; i < 8; i++)
+	{
+		gs_vec3 corner = gs_v3(
+			i & 1 ? maxs.x : mins.x,
+			i & 2 ? maxs.y : mins.y,
+			i & 4 ? maxs.z : mins.z);
+		gs_vec4 clip = _bsp_occlusion_transform(&occlusion->view_projection, corner);
+
+		// Crosses the near plane, too close to bother
+		if (clip.w < BSP_OCCLUSION_NEAR)
+		{
+			return true;
+		}
+
+		gs_vec3 screen = _bsp_occlusion_project(clip);
+		min_x	       = gs_min(min_x, screen.x);
+		min_y	       = gs_min(min_y, screen.y);
+		max_x	       = gs_max(max_x, screen.x);
+		max_y	       = gs_max(max_y, screen.y);
+		nearest	       = gs_max(nearest, screen.z);
+	}
+
+	// Off screen, leave it for frustum culling
+	if (max_x < 0.0f || max_y < 0.0f || min_x >= BSP_OCCLUSION_WIDTH || min_y >= BSP_OCCLUSION_HEIGHT)
+	{
+		return true;
+	}
+
+	int32_t x0 = gs_max((int32_t)min_x, 0);
+	int32_t y0 = gs_max((int32_t)min_y, 0);
+	int32_t x1 = gs_min((int32_t)max_x, BSP_OCCLUSION_WIDTH - 1);
+	int32_t y1 = gs_min((int32_t)max_y, BSP_OCCLUSION_HEIGHT - 1);
+
+	// Occluded where every pixel is closer than the nearest corner
+	nearest *= 1.0f + BSP_OCCLUSION_BIAS;
+
+	for (int32_t ty = y0 / BSP_OCCLUSION_TILE; ty <= y1 / BSP_OCCLUSION_TILE; ty++)
+	{
+		for (int32_t tx = x0 / BSP_OCCLUSION_TILE; tx <= x1 / BSP_OCCLUSION_TILE; tx++)
+		{
+			if (nearest < occlusion->hiz[ty * BSP_OCCLUSION_TILES_X + tx])
+			{
+				continue;
+			}
+
+			// Tile is partially covered, check the pixels we overlap
+			int32_t px0 = gs_max(x0, tx * BSP_OCCLUSION_TILE);
+			int32_t py0 = gs_max(y0, ty * BSP_OCCLUSION_TILE);
+			int32_t px1 = gs_min(x1, tx * BSP_OCCLUSION_TILE + BSP_OCCLUSION_TILE - 1);
+			int32_t py1 = gs_min(y1, ty * BSP_OCCLUSION_TILE + BSP_OCCLUSION_TILE - 1);
+			for (int32_t y = py0; y <= py1; y++)
+			{
+				const float32_t *row = occlusion->depth + y * BSP_OCCLUSION_WIDTH;
+				for (int32_t x = px0; x <= px1; x++)
+				{
+					if (nearest >= row[x])
+					{
+						return true;
+					}
+				}
+			}
+		}
+	}
+
+	return false;
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+/*================================================================
+	* bsp/bsp_occlusion.h
+	*
+	* Copyright (c) 2021 Lauri Räsänen
+	* ================================
+
+	Software occlusion culling against large BSP faces.
+=================================================================*/
+
+#ifndef BSP_OCCLUSION_H
+#define BSP_OCCLUSION_H
+
+#include "../util/camera.h"
+#include "bsp_types.h"
+
+// Depth buffer size, width must be a multiple of 4 for SIMD
+#define BSP_OCCLUSION_WIDTH  256
+#define BSP_OCCLUSION_HEIGHT 128
+// Pixels per side of a hierarchical Z tile
+#define BSP_OCCLUSION_TILE 8
+// Occluders rasterized per frame, picked by projected size
+#define BSP_OCCLUSION_MAX_OCCLUDERS 64
+// Smallest face area used as an occluder
+#define BSP_OCCLUSION_MIN_AREA 4096.0f
+// Clip space w where occluders are clipped and tested bounds count as visible
+#define BSP_OCCLUSION_NEAR 1.0f
+// How much farther than the occluder bounds have to be to get culled
+#define BSP_OCCLUSION_BIAS 0.01f
+
+void bsp_occlusion_init(bsp_occlusion_t *occlusion, bsp_map_t *map);
+void bsp_occlusion_free(bsp_occlusion_t *occlusion);
+uint32_t bsp_occlusion_render(bsp_occlusion_t *occlusion, bsp_map_t *map, const gs_mat4 view_projection, const mg_camera_frustum_t *fr, const gs_vec3 view_position);
+bool32_t bsp_occlusion_test_aabb(const bsp_occlusion_t *occlusion, const gs_vec3 mins, const gs_vec3 maxs);
+
+#endif // BSP_OCCLUSION_H
\ No newline at end of file
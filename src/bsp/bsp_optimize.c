@@ -0,0 +1,353 @@
+/*================================================================
+	* bsp/bsp_optimize.c
+	*
+	* Copyright (c) 2021 Lauri Räsänen
+	* ================================
+
+	Load time vertex welding and triangle reordering
+	for the static BSP buffers.
+
+	Triangle order follows Tom Forsyth's
+	"Linear-Speed Vertex Cache Optimisation".
+=================================================================*/
+
+#include "bsp_optimize.h"
+
+#define BSP_FORSYTH_DECAY_POWER	  1.5f
+#define BSP_FORSYTH_LAST_TRI_SCORE  0.75f
+#define BSP_FORSYTH_VALENCE_SCALE   2.0f
+#define BSP_FORSYTH_VALENCE_POWER   0.5f
+
+static inline uint32_t _bsp_hash_bytes(const void *data, size_t size, uint32_t hash)
+{
+	// FNV-1a
+	const uint8_t *bytes = data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static inline uint32_t _bsp_table_size(uint32_t count)
+{
+	uint32_t size = 1;
+	while (size < count * 2)
+	{
+		size <<= 1;
+	}
+	return size;
+}
+
+// Merge bitwise identical vertices referenced with the same group.
+// Writes unique vertices to out in order of first use and
+// returns their count, out must have room for index_count vertices.
+uint32_t bsp_weld_vertices(const bsp_vert_lump_t *vertices, uint32_t *indices, uint32_t index_count, const uint64_t *groups, bsp_vert_lump_t *out)
+{
+	uint32_t table_size = _bsp_table_size(index_count);
+	uint32_t *table	    = gs_malloc(sizeof(uint32_t) * table_size);
+	uint64_t *out_groups = gs_malloc(sizeof(uint64_t) * index_count);
+	memset(table, 0xff, sizeof(uint32_t) * table_size);
+
+	uint32_t count = 0;
+	for (size_t i = 0; i < index_count; i++)
+	{
+		const bsp_vert_lump_t *vert = &vertices[indices[i]];
+		uint64_t group		    = groups[i];
+		uint32_t hash		    = _bsp_hash_bytes(vert, sizeof(bsp_vert_lump_t), _bsp_hash_bytes(&group, sizeof(uint64_t), 2166136261u));
+		uint32_t slot		    = hash & (table_size - 1);
+
+		while (table[slot] != uint32_max)
+		{
+			uint32_t id = table[slot];
+			if (out_groups[id] == group && memcmp(&out[id], vert, sizeof(bsp_vert_lump_t)) == 0)
+			{
+				break;
+			}
+			slot = (slot + 1) & (table_size - 1);
+		}
+
+		if (table[slot] == uint32_max)
+		{
+			table[slot]	  = count;
+			out[count]	  = *vert;
+			out_groups[count] = group;
+			count++;
+		}
+
+		indices[i] = table[slot];
+	}
+
+	gs_free(table);
+	gs_free(out_groups);
+
+	return count;
+}
+
+static float32_t _bsp_forsyth_vertex_score(int32_t cache_pos, uint32_t valence)
+{
+	// No triangles left to use this
+	if (valence == 0) return -1.0f;
+
+	float32_t score = 0.0f;
+	if (cache_pos >= 0)
+	{
+		if (cache_pos < 3)
+		{
+			// Used by the previous triangle, don't favor
+			// too much so strips don't degenerate.
+			score = BSP_FORSYTH_LAST_TRI_SCORE;
+		}
+		else
+		{
+			float32_t scale = 1.0f / (BSP_FORSYTH_CACHE_SIZE - 3);
+			score		= powf(1.0f - (cache_pos - 3) * scale, BSP_FORSYTH_DECAY_POWER);
+		}
+	}
+
+	// Favor vertices with few triangles left to finish them off
+	score += BSP_FORSYTH_VALENCE_SCALE * powf(valence, -BSP_FORSYTH_VALENCE_POWER);
+
+	return score;
+}
+
+// Reorder a triangle list in place for post-transform cache locality.
+void bsp_optimize_triangle_order(uint32_t *indices, uint32_t index_count)
+{
+	uint32_t tri_count = index_count / 3;
+	if (tri_count < 3) return;
+
+	// Map indices to local vertex ids
+	uint32_t table_size = _bsp_table_size(index_count);
+	uint32_t *table	    = gs_malloc(sizeof(uint32_t) * table_size);
+	uint32_t *globals   = gs_malloc(sizeof(uint32_t) * index_count);
+	uint32_t *tris	    = gs_malloc(sizeof(uint32_t) * index_count);
+	memset(table, 0xff, sizeof(uint32_t) * table_size);
+
+	uint32_t vert_count = 0;
+	for (size_t i = 0; i < index_count; i++)
+	{
+		uint32_t slot = (indices[i] * 2654435761u) & (table_size - 1);
+		while (table[slot] != uint32_max && globals[table[slot]] != indices[i])
+		{
+			slot = (slot + 1) & (table_size - 1);
+		}
+		if (table[slot] == uint32_max)
+		{
+			table[slot]	    = vert_count;
+			globals[vert_count] = indices[i];
+			vert_count++;
+		}
+		tris[i] = table[slot];
+	}
+
+	gs_free(table);
+
+	// Vertex to triangle adjacency
+	uint32_t *valence    = gs_malloc(sizeof(uint32_t) * vert_count);
+	uint32_t *adj_offset = gs_malloc(sizeof(uint32_t) * vert_count);
+	uint32_t *adj	     = gs_malloc(sizeof(uint32_t) * index_count);
+	int32_t *cache_pos   = gs_malloc(sizeof(int32_t) * vert_count);
+	float32_t *v_score   = gs_malloc(sizeof(float32_t) * vert_count);
+	float32_t *t_score   = gs_malloc(sizeof(float32_t) * tri_count);
+	bool32_t *emitted    = gs_malloc(sizeof(bool32_t) * tri_count);
+	uint32_t *out	     = gs_malloc(sizeof(uint32_t) * index_count);
+	memset(valence, 0, sizeof(uint32_t) * vert_count);
+	memset(emitted, 0, sizeof(bool32_t) * tri_count);
+
+	for (size_t i = 0; i < index_count; i++)
+	{
+		valence[tris[i]]++;
+	}
+
+	uint32_t offset = 0;
+	for (size_t i = 0; i < vert_count; i++)
+	{
+		adj_offset[i] = offset;
+		offset += valence[i];
+		valence[i] = 0;
+	}
+
+	for (size_t i = 0; i < index_count; i++)
+	{
+		uint32_t v			= tris[i];
+		adj[adj_offset[v] + valence[v]] = i / 3;
+		valence[v]++;
+	}
+
+	for (size_t i = 0; i < vert_count; i++)
+	{
+		cache_pos[i] = -1;
+		v_score[i]   = _bsp_forsyth_vertex_score(-1, valence[i]);
+	}
+
+	int32_t best	     = -1;
+	float32_t best_score = -1.0f;
+	for (size_t i = 0; i < tri_count; i++)
+	{
+		t_score[i] = v_score[tris[i * 3]] + v_score[tris[i * 3 + 1]] + v_score[tris[i * 3 + 2]];
+		if (t_score[i] > best_score)
+		{
+			best	   = i;
+			best_score = t_score[i];
+		}
+	}
+
+	// Room for the cache and the 3 vertices pushed out of it
+	uint32_t cache[BSP_FORSYTH_CACHE_SIZE + 3];
+	uint32_t new_cache[BSP_FORSYTH_CACHE_SIZE + 3];
+	uint32_t cache_count = 0;
+
+	for (size_t n = 0; n < tri_count; n++)
+	{
+		// Nothing in cache is usable, pick the best remaining
+		if (best < 0)
+		{
+			best_score = -1.0f;
+			for (size_t i = 0; i < tri_count; i++)
+			{
+				if (!emitted[i] && t_score[i] > best_score)
+				{
+					best	   = i;
+					best_score = t_score[i];
+				}
+			}
+		}
+
+		// Emit
+		uint32_t *tri = &tris[best * 3];
+		emitted[best] = true;
+		for (size_t k = 0; k < 3; k++)
+		{
+			out[n * 3 + k] = globals[tri[k]];
+
+			// Remove from adjacency
+			uint32_t v     = tri[k];
+			uint32_t *list = &adj[adj_offset[v]];
+			for (size_t j = 0; j < valence[v]; j++)
+			{
+				if (list[j] == (uint32_t)best)
+				{
+					list[j] = list[valence[v] - 1];
+					break;
+				}
+			}
+			valence[v]--;
+		}
+
+		// Move triangle vertices to the front of the cache
+		uint32_t new_count = 0;
+		for (size_t k = 0; k < 3; k++)
+		{
+			new_cache[new_count++] = tri[k];
+		}
+		for (size_t i = 0; i < cache_count; i++)
+		{
+			uint32_t v = cache[i];
+			if (v != tri[0] && v != tri[1] && v != tri[2])
+			{
+				new_cache[new_count++] = v;
+			}
+		}
+
+		// Update vertex scores, including the ones pushed out
+		for (size_t i = 0; i < new_count; i++)
+		{
+			uint32_t v   = new_cache[i];
+			cache_pos[v] = i < BSP_FORSYTH_CACHE_SIZE ? i : -1;
+			v_score[v]   = _bsp_forsyth_vertex_score(cache_pos[v], valence[v]);
+		}
+
+		// Update triangle scores and pick next from the cache
+		best	   = -1;
+		best_score = -1.0f;
+		for (size_t i = 0; i < new_count; i++)
+		{
+			uint32_t v = new_cache[i];
+			for (size_t j = 0; j < valence[v]; j++)
+			{
+				uint32_t t = adj[adj_offset[v] + j];
+				t_score[t] = v_score[tris[t * 3]] + v_score[tris[t * 3 + 1]] + v_score[tris[t * 3 + 2]];
+				if (t_score[t] > best_score)
+				{
+					best	   = t;
+					best_score = t_score[t];
+				}
+			}
+		}
+
+		cache_count = gs_min(new_count, BSP_FORSYTH_CACHE_SIZE);
+		memcpy(cache, new_cache, sizeof(uint32_t) * cache_count);
+	}
+
+	memcpy(indices, out, sizeof(uint32_t) * tri_count * 3);
+
+	gs_free(globals);
+	gs_free(tris);
+	gs_free(valence);
+	gs_free(adj_offset);
+	gs_free(adj);
+	gs_free(cache_pos);
+	gs_free(v_score);
+	gs_free(t_score);
+	gs_free(emitted);
+	gs_free(out);
+}
+
+// Renumber vertices in order of first use so fetches stay sequential.
+// Unreferenced vertices are dropped, returns the new vertex count.
+uint32_t bsp_optimize_vertex_fetch(bsp_vert_lump_t *vertices, uint32_t vertex_count, uint32_t *indices, uint32_t index_count)
+{
+	uint32_t *remap		= gs_malloc(sizeof(uint32_t) * vertex_count);
+	bsp_vert_lump_t *source = gs_malloc(sizeof(bsp_vert_lump_t) * vertex_count);
+	memset(remap, 0xff, sizeof(uint32_t) * vertex_count);
+	memcpy(source, vertices, sizeof(bsp_vert_lump_t) * vertex_count);
+
+	uint32_t count = 0;
+	for (size_t i = 0; i < index_count; i++)
+	{
+		uint32_t v = indices[i];
+		if (remap[v] == uint32_max)
+		{
+			remap[v]	= count;
+			vertices[count] = source[v];
+			count++;
+		}
+		indices[i] = remap[v];
+	}
+
+	gs_free(remap);
+	gs_free(source);
+
+	return count;
+}
+
+// Average cache miss ratio, transformed vertices per triangle
+// with a FIFO cache of BSP_ACMR_CACHE_SIZE.
+float32_t bsp_calculate_acmr(const uint32_t *indices, uint32_t index_count, uint32_t vertex_count)
+{
+	if (index_count < 3) return 0.0f;
+
+	uint32_t *stamps = gs_malloc(sizeof(uint32_t) * vertex_count);
+	memset(stamps, 0, sizeof(uint32_t) * vertex_count);
+
+	// Vertex is cached if it was added within the last
+	// BSP_ACMR_CACHE_SIZE misses. Start past the zeroed stamps.
+	uint32_t time	= BSP_ACMR_CACHE_SIZE + 1;
+	uint32_t misses = 0;
+	for (size_t i = 0; i < index_count; i++)
+	{
+		uint32_t v = indices[i];
+		if (time - stamps[v] > BSP_ACMR_CACHE_SIZE)
+		{
+			stamps[v] = time;
+			time++;
+			misses++;
+		}
+	}
+
+	gs_free(stamps);
+
+	return (float32_t)misses / (index_count / 3);
+}
\ No newline at end of file
@@ -0,0 +1,26 @@
+/*================================================================
+	* bsp/bsp_optimize.h
+	*
+	* Copyright (c) 2021 Lauri Räsänen
+	* ================================
+
+	Load time vertex welding and triangle reordering
+	for the static BSP buffers.
+=================================================================*/
+
+#ifndef BSP_OPTIMIZE_H
+#define BSP_OPTIMIZE_H
+
+#include "bsp_types.h"
+
+// FIFO size used when reporting ACMR
+#define BSP_ACMR_CACHE_SIZE 16
+// LRU size modelled by the triangle reordering
+#define BSP_FORSYTH_CACHE_SIZE 32
+
+uint32_t bsp_weld_vertices(const bsp_vert_lump_t *vertices, uint32_t *indices, uint32_t index_count, const uint64_t *groups, bsp_vert_lump_t *out);
+void bsp_optimize_triangle_order(uint32_t *indices, uint32_t index_count);
+uint32_t bsp_optimize_vertex_fetch(bsp_vert_lump_t *vertices, uint32_t vertex_count, uint32_t *indices, uint32_t index_count);
+float32_t bsp_calculate_acmr(const uint32_t *indices, uint32_t index_count, uint32_t vertex_count);
+
+#endif // BSP_OPTIMIZE_H
\ No newline at end of file
@@ -11,74 +11,247 @@
 =================================================================*/
 
 #include "bsp_patch.h"
+#include "../util/simd.h"
+#include "../util/thread.h"
+
+// Subdivisions needed for a quadratic curve to stay within BSP_PATCH_TOLERANCE.
+// Max deviation from a chord is |p0 - 2p1 + p2| / 4, splitting into n segments
+// divides it by n^2. Rounded up to a power of two so LODs can skip vertices.
+int32_t bsp_quadratic_curve_tesselation(const gs_vec3 p0, const gs_vec3 p1, const gs_vec3 p2)
+{
+	gs_vec3 d	    = gs_vec3_add(gs_vec3_sub(p0, gs_vec3_scale(p1, 2.0f)), p2);
+	float32_t deviation = gs_vec3_len(d) * 0.25f;
+
+	int32_t tesselation = 1;
+	while (tesselation < BSP_PATCH_MAX_TESSELATION && deviation > BSP_PATCH_TOLERANCE * tesselation * tesselation)
+	{
+		tesselation <<= 1;
+	}
+
+	return tesselation;
+}
+
+// Subdivisions needed along control point columns (u) and rows (v)
+void bsp_quadratic_patch_get_tesselation(const bsp_quadratic_patch_t *patch, int32_t *u, int32_t *v)
+{
+	*u = 1;
+	*v = 1;
+
+	for (size_t i = 0; i < 3; i++)
+	{
+		const bsp_vert_lump_t *cp = patch->control_points;
+		*u			  = gs_max(*u, bsp_quadratic_curve_tesselation(cp[i * 3].position, cp[i * 3 + 1].position, cp[i * 3 + 2].position));
+		*v			  = gs_max(*v, bsp_quadratic_curve_tesselation(cp[i].position, cp[i + 3].position, cp[i + 6].position));
+	}
+}
+
+// Position xyz, tex coord uv, lightmap coord uv
+#define BSP_PATCH_ATTRIBUTES 7
+// Room for a row of samples padded to SIMD width
+#define BSP_PATCH_ROW_SIZE (BSP_PATCH_MAX_TESSELATION + 4)
+
+// out[attr][j] = t[attr][0] * w0[j] + t[attr][1] * w1[j] + t[attr][2] * w2[j]
+// count must be a multiple of 4.
+static inline void _bsp_patch_eval_row(
+	const float32_t t[BSP_PATCH_ATTRIBUTES][3],
+	const float32_t *w0,
+	const float32_t *w1,
+	const float32_t *w2,
+	uint32_t count,
+	float32_t out[BSP_PATCH_ATTRIBUTES][BSP_PATCH_ROW_SIZE])
+{
+	for (size_t attr = 0; attr < BSP_PATCH_ATTRIBUTES; attr++)
+	{
+#if defined(MG_SIMD_SSE)
+		__m128 t0 = _mm_set1_ps(t[attr][0]);
+		__m128 t1 = _mm_set1_ps(t[attr][1]);
+		__m128 t2 = _mm_set1_ps(t[attr][2]);
+		for (size_t j = 0; j < count; j += 4)
+		{
+			__m128 v = _mm_add_ps(
+				_mm_mul_ps(t0, _mm_loadu_ps(w0 + j)),
+				_mm_add_ps(
+					_mm_mul_ps(t1, _mm_loadu_ps(w1 + j)),
+					_mm_mul_ps(t2, _mm_loadu_ps(w2 + j))));
+			_mm_storeu_ps(out[attr] + j, v);
+		}
+#elif defined(MG_SIMD_NEON)
+		for (size_t j = 0; j < count; j += 4)
+		{
+			float32x4_t v = vmulq_n_f32(vld1q_f32(w0 + j), t[attr][0]);
+			v	      = vmlaq_n_f32(v, vld1q_f32(w1 + j), t[attr][1]);
+			v	      = vmlaq_n_f32(v, vld1q_f32(w2 + j), t[attr][2]);
+			vst1q_f32(out[attr] + j, v);
+		}
+#else
+		for (size_t j = 0; j < count; j++)
+		{
+			out[attr][j] = t[attr][0] * w0[j] + t[attr][1] * w1[j] + t[attr][2] * w2[j];
+		}
+#endif
+	}
+}
 
 // Tesselate quadratic patch to wanted level
 void bsp_quadratic_patch_tesselate(bsp_quadratic_patch_t *patch)
 {
-	gs_dyn_array_reserve(patch->vertices, (patch->tesselation + 1) * (patch->tesselation + 1));
-	gs_dyn_array_head(patch->vertices)->size = (patch->tesselation + 1) * (patch->tesselation + 1);
+	int32_t tess_u	  = patch->tesselation_u;
+	int32_t tess_v	  = patch->tesselation_v;
+	uint32_t row_size = tess_v + 1;
 
-	// Sample (tesselation + 1)^2 points
-	// for our vertices from the bezier patch.
-	for (size_t i = 0; i <= patch->tesselation; i++)
+	gs_dyn_array_reserve(patch->vertices, (tess_u + 1) * row_size);
+	gs_dyn_array_head(patch->vertices)->size = (tess_u + 1) * row_size;
+
+	// Control point attributes as SoA
+	float32_t cp[BSP_PATCH_ATTRIBUTES][9];
+	for (size_t i = 0; i < 9; i++)
 	{
-		// How far into the row are we?
-		float32_t a = (float32_t)i / patch->tesselation;
+		bsp_vert_lump_t v = patch->control_points[i];
+		cp[0][i]	  = v.position.x;
+		cp[1][i]	  = v.position.y;
+		cp[2][i]	  = v.position.z;
+		cp[3][i]	  = v.tex_coord.x;
+		cp[4][i]	  = v.tex_coord.y;
+		cp[5][i]	  = v.lm_coord.x;
+		cp[6][i]	  = v.lm_coord.y;
+	}
+
+	// Bernstein weights of each column, zero padded
+	float32_t w0[BSP_PATCH_ROW_SIZE] = {0};
+	float32_t w1[BSP_PATCH_ROW_SIZE] = {0};
+	float32_t w2[BSP_PATCH_ROW_SIZE] = {0};
+	for (size_t j = 0; j < row_size; j++)
+	{
+		float32_t a = (float32_t)j / tess_v;
 		float32_t b = 1.0f - a;
+		w0[j]	    = b * b;
+		w1[j]	    = 2 * b * a;
+		w2[j]	    = a * a;
+	}
+	uint32_t padded_size = (row_size + 3) & ~3;
+
+	// Normal and color are not interpolated
+	bsp_vert_lump_t base = patch->control_points[0];
+
+	float32_t row[BSP_PATCH_ATTRIBUTES][BSP_PATCH_ROW_SIZE];
+	for (size_t i = 0; i <= tess_u; i++)
+	{
+		// How far into the row are we?
+		float32_t a  = (float32_t)i / tess_u;
+		float32_t b  = 1.0f - a;
+		float32_t r0 = b * b;
+		float32_t r1 = 2 * b * a;
+		float32_t r2 = a * a;
 
-		// Sample each row into temp variable
-		bsp_vert_lump_t temp[3];
-		for (size_t j = 0; j < 3; j++)
+		// Collapse each control point row to one point
+		float32_t t[BSP_PATCH_ATTRIBUTES][3];
+		for (size_t attr = 0; attr < BSP_PATCH_ATTRIBUTES; attr++)
 		{
-			int32_t k = j * 3;
-
-			// cp[k + 0] * (b * b) +
-			// cp[k + 1] * (2 * b * b) +
-			// cp[k + 2] * (a * a)
-			temp[j] = bsp_vert_lump_add(
-				bsp_vert_lump_mul(patch->control_points[k + 0], (b * b)),
-				bsp_vert_lump_add(
-					bsp_vert_lump_mul(patch->control_points[k + 1], (2 * b * a)),
-					bsp_vert_lump_mul(patch->control_points[k + 2], (a * a))));
+			for (size_t k = 0; k < 3; k++)
+			{
+				t[attr][k] = cp[attr][k * 3] * r0 + cp[attr][k * 3 + 1] * r1 + cp[attr][k * 3 + 2] * r2;
+			}
 		}
 
-		// Sample each column using row values
-		for (size_t j = 0; j <= patch->tesselation; j++)
+		// Sample the whole column range at once
+		_bsp_patch_eval_row(t, w0, w1, w2, padded_size, row);
+
+		bsp_vert_lump_t *out = patch->vertices + i * row_size;
+		for (size_t j = 0; j < row_size; j++)
 		{
-			// How far into the column are we?
-			a = (float32_t)j / patch->tesselation;
-			b = 1.0f - a;
-
-			// temp[k + 0] * (b * b) +
-			// temp[k + 1] * (2 * b * b) +
-			// temp[k + 2] * (a * a)
-			bsp_vert_lump_t val = bsp_vert_lump_add(
-				bsp_vert_lump_mul(temp[0], b * b),
-				bsp_vert_lump_add(
-					bsp_vert_lump_mul(temp[1], 2 * b * a),
-					bsp_vert_lump_mul(temp[2], a * a)));
-
-			gs_dyn_array_set_data_i(&patch->vertices, &val, sizeof(bsp_vert_lump_t), i * (patch->tesselation + 1) + j);
+			out[j]		 = base;
+			out[j].position	 = gs_v3(row[0][j], row[1][j], row[2][j]);
+			out[j].tex_coord = gs_v2(row[3][j], row[4][j]);
+			out[j].lm_coord	 = gs_v2(row[5][j], row[6][j]);
 		}
 	}
 
-	// Triangulate
-	gs_dyn_array_reserve(patch->indices, patch->tesselation * patch->tesselation * 6);
-	for (size_t row = 0; row < patch->tesselation; row++)
+	// Curve is within the control point hull
+	patch->mins = patch->control_points[0].position;
+	patch->maxs = patch->control_points[0].position;
+	for (size_t i = 1; i < 9; i++)
 	{
-		for (size_t col = 0; col < patch->tesselation; col++)
+		gs_vec3 p   = patch->control_points[i].position;
+		patch->mins = gs_v3(gs_min(patch->mins.x, p.x), gs_min(patch->mins.y, p.y), gs_min(patch->mins.z, p.z));
+		patch->maxs = gs_v3(gs_max(patch->maxs.x, p.x), gs_max(patch->maxs.y, p.y), gs_max(patch->maxs.z, p.z));
+	}
+
+	// Triangulate each LOD from the same vertices,
+	// LOD n steps over 2^n rows and columns at a time.
+	uint32_t num_indices = 0;
+	for (size_t lod = 0; lod < BSP_PATCH_LOD_COUNT; lod++)
+	{
+		int32_t step_u		= gs_min(1 << lod, tess_u);
+		int32_t step_v		= gs_min(1 << lod, tess_v);
+		patch->lod_offsets[lod] = num_indices;
+		num_indices += (tess_u / step_u) * (tess_v / step_v) * 6;
+	}
+	patch->lod_offsets[BSP_PATCH_LOD_COUNT] = num_indices;
+
+	gs_dyn_array_reserve(patch->indices, num_indices);
+	gs_dyn_array_head(patch->indices)->size = num_indices;
+
+	uint16_t *index = patch->indices;
+	for (size_t lod = 0; lod < BSP_PATCH_LOD_COUNT; lod++)
+	{
+		int32_t step_u = gs_min(1 << lod, tess_u);
+		int32_t step_v = gs_min(1 << lod, tess_v);
+
+		for (size_t row = 0; row < tess_u; row += step_u)
 		{
-			gs_dyn_array_push(patch->indices, (row + 1) * (patch->tesselation + 1) + col);
-			gs_dyn_array_push(patch->indices, (row + 0) * (patch->tesselation + 1) + col);
-			gs_dyn_array_push(patch->indices, (row + 1) * (patch->tesselation + 1) + col + 1);
+			for (size_t col = 0; col < tess_v; col += step_v)
+			{
+				*index++ = (row + step_u) * row_size + col;
+				*index++ = (row + 0) * row_size + col;
+				*index++ = (row + step_u) * row_size + col + step_v;
 
-			gs_dyn_array_push(patch->indices, (row + 1) * (patch->tesselation + 1) + col + 1);
-			gs_dyn_array_push(patch->indices, (row + 0) * (patch->tesselation + 1) + col);
-			gs_dyn_array_push(patch->indices, (row + 0) * (patch->tesselation + 1) + col + 1);
+				*index++ = (row + step_u) * row_size + col + step_v;
+				*index++ = (row + 0) * row_size + col;
+				*index++ = (row + 0) * row_size + col + step_v;
+			}
 		}
 	}
 }
 
+typedef struct bsp_tesselate_job_t
+{
+	bsp_quadratic_patch_t **patches;
+	uint32_t count;
+	uint32_t first;
+	uint32_t stride;
+} bsp_tesselate_job_t;
+
+static void _bsp_tesselate_job(void *arg)
+{
+	bsp_tesselate_job_t *job = arg;
+
+	// Interleaved so workers get a similar mix of sizes
+	for (size_t i = job->first; i < job->count; i += job->stride)
+	{
+		bsp_quadratic_patch_tesselate(job->patches[i]);
+	}
+}
+
+// Tesselate quadratic patches on worker threads
+void bsp_quadratic_patches_tesselate(bsp_quadratic_patch_t **patches, uint32_t count)
+{
+	bsp_tesselate_job_t jobs[MG_THREAD_MAX_WORKERS];
+
+	// Not worth starting threads for a few patches
+	uint32_t workers = gs_min(mg_thread_worker_count(), count / 32 + 1);
+	for (size_t i = 0; i < workers; i++)
+	{
+		jobs[i] = (bsp_tesselate_job_t){
+			.patches = patches,
+			.count	 = count,
+			.first	 = i,
+			.stride	 = workers,
+		};
+	}
+
+	mg_thread_run(_bsp_tesselate_job, jobs, sizeof(bsp_tesselate_job_t), workers);
+}
+
 void bsp_quadratic_patch_free(bsp_quadratic_patch_t *patch)
 {
 	gs_dyn_array_free(patch->vertices);
@@ -35,7 +35,10 @@ static inline bsp_vert_lump_t bsp_vert_lump_add(bsp_vert_lump_t a, bsp_vert_lump
 	return result;
 }
 
+int32_t bsp_quadratic_curve_tesselation(const gs_vec3 p0, const gs_vec3 p1, const gs_vec3 p2);
+void bsp_quadratic_patch_get_tesselation(const bsp_quadratic_patch_t *patch, int32_t *u, int32_t *v);
 void bsp_quadratic_patch_tesselate(bsp_quadratic_patch_t *patch);
+void bsp_quadratic_patches_tesselate(bsp_quadratic_patch_t **patches, uint32_t count);
 void bsp_quadratic_patch_free(bsp_quadratic_patch_t *patch);
 void bsp_patch_free(bsp_patch_t *patch);
 
@@ -9,7 +9,18 @@
 	http://www.devmaster.net/articles/quake3collision/
 =================================================================*/
 
+#include <float.h>
+
 #include "bsp_trace.h"
+#include "../util/simd.h"
+#include "../util/thread.h"
+#include "../util/timer.h"
+
+bsp_trace_stats_t g_bsp_trace_stats;
+
+// Tells apart maps in thread scratch, 0 is never used
+static uint32_t _bsp_trace_map_serial = 0;
+static __thread bsp_trace_scratch_t _bsp_trace_scratch;
 
 void bsp_trace_ray(bsp_trace_t *trace, gs_vec3 start, gs_vec3 end, int32_t content_mask)
 {
@@ -46,16 +57,186 @@ void bsp_trace_box(bsp_trace_t *trace, gs_vec3 start, gs_vec3 end, gs_vec3 mins,
 	_bsp_trace(trace, start, end, content_mask);
 }
 
+void bsp_trace_query(bsp_trace_t *trace, const bsp_trace_query_t *query)
+{
+	switch (query->type)
+	{
+	case RAY:
+		bsp_trace_ray(trace, query->start, query->end, query->content_mask);
+		break;
+
+	case SPHERE:
+		bsp_trace_sphere(trace, query->start, query->end, query->radius, query->content_mask);
+		break;
+
+	case BOX:
+		bsp_trace_box(trace, query->start, query->end, query->mins, query->maxs, query->content_mask);
+		break;
+
+	default:
+		break;
+	}
+}
+
+static int _bsp_trace_batch_compare(const void *a, const void *b)
+{
+	const bsp_trace_batch_item_t *item_a = a;
+	const bsp_trace_batch_item_t *item_b = b;
+	if (item_a->leaf != item_b->leaf)
+	{
+		return (item_a->leaf > item_b->leaf) - (item_a->leaf < item_b->leaf);
+	}
+	return (item_a->query > item_b->query) - (item_a->query < item_b->query);
+}
+
+static void _bsp_trace_batch_job(void *arg)
+{
+	bsp_trace_batch_job_t *job = arg;
+
+	for (size_t i = job->first; i < job->first + job->count; i++)
+	{
+		uint32_t query	    = job->items[i].query;
+		job->results[query] = (bsp_trace_t){
+			.map	= job->map,
+			.caller = job->queries[query].caller,
+		};
+		bsp_trace_query(&job->results[query], &job->queries[query]);
+	}
+
+	// Thread is about to exit
+	if (job->worker)
+	{
+		bsp_trace_free_thread_scratch();
+	}
+}
+
+// Run count traces, results[i] is the result of queries[i].
+// Queries starting in the same leaf run together so they hit the
+// same nodes and brushes. If threaded, the sorted queries are split
+// into contiguous runs over worker threads.
+void bsp_trace_batch(bsp_map_t *map, const bsp_trace_query_t *queries, bsp_trace_t *results, uint32_t count, bool32_t threaded)
+{
+	if (count == 0) return;
+
+	bsp_trace_batch_item_t *items = gs_malloc(sizeof(bsp_trace_batch_item_t) * count);
+	for (size_t i = 0; i < count; i++)
+	{
+		items[i] = (bsp_trace_batch_item_t){
+			.leaf  = bsp_trace_point_leaf(map, queries[i].start),
+			.query = i,
+		};
+	}
+	qsort(items, count, sizeof(bsp_trace_batch_item_t), _bsp_trace_batch_compare);
+
+	uint32_t workers = 1;
+	if (threaded)
+	{
+		workers = gs_min(mg_thread_worker_count(), count / BSP_TRACE_BATCH_MIN_PER_THREAD + 1);
+	}
+
+	bsp_trace_batch_job_t jobs[MG_THREAD_MAX_WORKERS];
+	uint32_t per_worker = (count + workers - 1) / workers;
+	for (size_t i = 0; i < workers; i++)
+	{
+		uint32_t first = gs_min(i * per_worker, count);
+
+		jobs[i] = (bsp_trace_batch_job_t){
+			.map	 = map,
+			.queries = queries,
+			.results = results,
+			.items	 = items,
+			.first	 = first,
+			.count	 = gs_min(per_worker, count - first),
+			.worker	 = i > 0,
+		};
+	}
+
+	mg_thread_run(_bsp_trace_batch_job, jobs, sizeof(bsp_trace_batch_job_t), workers);
+
+	gs_free(items);
+}
+
+// Leaf containing point, or -1 for an empty tree
+int32_t bsp_trace_point_leaf(bsp_map_t *map, gs_vec3 point)
+{
+	if (map->nodes.count == 0) return -1;
+
+	int32_t index = 0;
+	while (index >= 0)
+	{
+		const bsp_trace_node_t *node = &map->trace_nodes[index];
+		float32_t distance;
+
+		if (node->type < BSP_PLANE_NON_AXIAL)
+		{
+			distance = point.xyz[node->type] - node->dist;
+		}
+		else
+		{
+			distance = gs_vec3_dot(point, node->normal) - node->dist;
+		}
+
+		index = node->children[distance >= 0 ? 0 : 1];
+	}
+
+	return ~index;
+}
+
 void _bsp_trace(bsp_trace_t *trace, gs_vec3 start, gs_vec3 end, int32_t content_mask)
 {
 	gs_assert(trace->map != NULL);
+	gs_assert(trace->map->trace_nodes != NULL || trace->map->nodes.count == 0);
+
+	bool32_t timing	    = g_bsp_trace_stats.timing;
+	uint64_t start_time = timing ? mg_timer_now_ns() : 0;
 
 	trace->start_solid = false;
 	trace->all_solid   = false;
 	trace->fraction	   = 1.0f;
+	trace->model	   = -1;
+
+	_bsp_trace_set_offsets(trace);
+	if (trace->map->nodes.count > 0)
+	{
+		_bsp_trace_set_sweep(trace, start, end);
+	}
+
+	if (trace->cache != NULL && _bsp_trace_cache_contains(trace->cache, trace, content_mask))
+	{
+		// Only brushes near the caller
+		_bsp_trace_check_cache(trace, trace->cache, start, end, content_mask);
+	}
+	else if (trace->map->nodes.count > 0)
+	{
+		// Walk through the BSP tree
+		_bsp_trace_next_check(trace->map);
+
+		switch (trace->type)
+		{
+		case RAY:
+			_bsp_trace_walk_ray(trace, start, end, content_mask);
+			break;
+
+		case SPHERE:
+			_bsp_trace_walk_sphere(trace, start, end, content_mask);
+			break;
+
+		case BOX:
+			_bsp_trace_walk_box(trace, start, end, content_mask);
+			break;
 
-	// Walk through the BSP tree
-	_bsp_trace_check_node(trace, 0, 0.0f, 1.0f, start, end, content_mask);
+		default:
+			break;
+		}
+	}
+
+	if (trace->fraction < 1.0f || trace->start_solid)
+	{
+		trace->model = 0;
+	}
+
+	// Brush entities, nearest hit wins
+	_bsp_trace_submodels(trace, start, end, content_mask);
 
 	if (trace->fraction == 1.0f)
 	{
@@ -68,201 +249,903 @@ void _bsp_trace(bsp_trace_t *trace, gs_vec3 start, gs_vec3 end, int32_t content_
 		//           start + fraction * (end - start);
 		trace->end = gs_vec3_add(start, gs_vec3_scale(gs_vec3_sub(end, start), trace->fraction));
 	}
+
+	_bsp_trace_add_counters(trace->caller, trace->type, timing ? mg_timer_now_ns() - start_time : 0);
+}
+
+// Add one trace's counters to this thread's totals
+void _bsp_trace_add_counters(bsp_trace_caller caller, bsp_trace_type type, uint64_t time_ns)
+{
+	bsp_trace_counters_t *counters = &_bsp_trace_scratch.counters;
+	bsp_trace_counters_t *totals   = &_bsp_trace_scratch.totals[caller];
+
+	totals->traces[type]++;
+	totals->nodes += counters->nodes;
+	totals->leaves += counters->leaves;
+	totals->brushes += counters->brushes;
+	totals->sides += counters->sides;
+	totals->patches += counters->patches;
+	totals->time_ns += time_ns;
+
+	*counters = (bsp_trace_counters_t){0};
+}
+
+// Move this thread's totals to the frame stats.
+// Atomic so worker threads can merge theirs when done.
+void _bsp_trace_merge_counters()
+{
+	for (size_t i = 0; i < BSP_TRACE_CALLER_COUNT; i++)
+	{
+		bsp_trace_counters_t *totals = &_bsp_trace_scratch.totals[i];
+		bsp_trace_counters_t *frame  = &g_bsp_trace_stats.frame[i];
+
+		for (size_t j = 0; j < BSP_TRACE_TYPE_COUNT; j++)
+		{
+			__atomic_fetch_add(&frame->traces[j], totals->traces[j], __ATOMIC_RELAXED);
+		}
+		__atomic_fetch_add(&frame->nodes, totals->nodes, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&frame->leaves, totals->leaves, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&frame->brushes, totals->brushes, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&frame->sides, totals->sides, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&frame->patches, totals->patches, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&frame->time_ns, totals->time_ns, __ATOMIC_RELAXED);
+
+		*totals = (bsp_trace_counters_t){0};
+	}
+}
+
+// Make the counters gathered so far the last frame's and start over.
+// Call once per frame from the main thread when no traces are running.
+void bsp_trace_stats_end_frame()
+{
+	_bsp_trace_merge_counters();
+	memcpy(g_bsp_trace_stats.last, g_bsp_trace_stats.frame, sizeof(g_bsp_trace_stats.last));
+	memset(g_bsp_trace_stats.frame, 0, sizeof(g_bsp_trace_stats.frame));
+}
+
+// Sum of counters for all callers
+bsp_trace_counters_t bsp_trace_stats_total(const bsp_trace_counters_t *counters)
+{
+	bsp_trace_counters_t total = {0};
+	for (size_t i = 0; i < BSP_TRACE_CALLER_COUNT; i++)
+	{
+		for (size_t j = 0; j < BSP_TRACE_TYPE_COUNT; j++)
+		{
+			total.traces[j] += counters[i].traces[j];
+		}
+		total.nodes += counters[i].nodes;
+		total.leaves += counters[i].leaves;
+		total.brushes += counters[i].brushes;
+		total.sides += counters[i].sides;
+		total.patches += counters[i].patches;
+		total.time_ns += counters[i].time_ns;
+	}
+	return total;
+}
+
+const char *bsp_trace_caller_name(bsp_trace_caller caller)
+{
+	switch (caller)
+	{
+	case BSP_TRACE_CALLER_PLAYER:
+		return "player";
+	case BSP_TRACE_CALLER_MONSTER:
+		return "monster";
+	case BSP_TRACE_CALLER_ROCKET:
+		return "rocket";
+	default:
+		return "other";
+	}
+}
+
+// Build the compact node and leaf arrays used by traces.
+// Only needs the loaded lumps, not a graphics context.
+void bsp_trace_init(bsp_map_t *map)
+{
+	map->trace_nodes  = gs_malloc(sizeof(bsp_trace_node_t) * (map->nodes.count > 0 ? map->nodes.count : 1));
+	map->trace_leaves = gs_malloc(sizeof(bsp_trace_leaf_t) * (map->leaves.count > 0 ? map->leaves.count : 1));
+	map->trace_serial = __sync_add_and_fetch(&_bsp_trace_map_serial, 1);
+
+	for (size_t i = 0; i < map->nodes.count; i++)
+	{
+		bsp_node_lump_t node   = map->nodes.data[i];
+		bsp_plane_lump_t plane = map->planes.data[node.plane];
+		bsp_trace_node_t *out  = &map->trace_nodes[i];
+
+		out->normal	 = plane.normal;
+		out->dist	 = plane.dist;
+		out->children[0] = node.children[0];
+		out->children[1] = node.children[1];
+
+		if (plane.normal.x == 1.0f) out->type = BSP_PLANE_X;
+		else if (plane.normal.y == 1.0f) out->type = BSP_PLANE_Y;
+		else if (plane.normal.z == 1.0f) out->type = BSP_PLANE_Z;
+		else out->type = BSP_PLANE_NON_AXIAL;
+	}
+
+	// Patch facets go after the brushes
+	gs_dyn_array(bsp_trace_facet_t) facets = bsp_trace_patches_init(map, map->brushes.count);
+	_bsp_trace_init_brushes(map, facets, gs_dyn_array_size(facets));
+	gs_dyn_array_free(facets);
+
+	for (size_t i = 0; i < map->leaves.count; i++)
+	{
+		map->trace_leaves[i] = (bsp_trace_leaf_t){
+			.first_leaf_brush = map->leaves.data[i].first_leaf_brush,
+			.num_leaf_brushes = map->leaves.data[i].num_leaf_brushes,
+		};
+	}
+
+	bsp_trace_patches_link_leaves(map);
+}
+
+// Start a new trace on this thread, returns the stamp for its brush checks.
+uint32_t _bsp_trace_next_check(bsp_map_t *map)
+{
+	bsp_trace_scratch_t *scratch = &_bsp_trace_scratch;
+
+	uint32_t num_patches	     = gs_dyn_array_size(map->trace_patches);
+
+	if (scratch->map_serial != map->trace_serial || scratch->num_brushes < map->num_trace_brushes || scratch->num_patches < num_patches)
+	{
+		// Different map or first trace on this thread
+		gs_free(scratch->brush_checks);
+		gs_free(scratch->patch_checks);
+		scratch->brush_checks = gs_malloc(sizeof(uint32_t) * (map->num_trace_brushes > 0 ? map->num_trace_brushes : 1));
+		scratch->patch_checks = gs_malloc(sizeof(uint32_t) * (num_patches > 0 ? num_patches : 1));
+		scratch->num_brushes  = map->num_trace_brushes;
+		scratch->num_patches  = num_patches;
+		scratch->map_serial   = map->trace_serial;
+		scratch->check_count  = 0;
+		memset(scratch->brush_checks, 0, sizeof(uint32_t) * scratch->num_brushes);
+		memset(scratch->patch_checks, 0, sizeof(uint32_t) * scratch->num_patches);
+	}
+
+	scratch->check_count++;
+	if (scratch->check_count == 0)
+	{
+		// Wrapped around, old stamps could match again
+		memset(scratch->brush_checks, 0, sizeof(uint32_t) * scratch->num_brushes);
+		memset(scratch->patch_checks, 0, sizeof(uint32_t) * scratch->num_patches);
+		scratch->check_count = 1;
+	}
+
+	return scratch->check_count;
 }
 
-void _bsp_trace_check_node(bsp_trace_t *trace, int32_t node_index, float32_t start_fraction, float32_t end_fraction, gs_vec3 start, gs_vec3 end, int32_t content_mask)
+// Free the calling thread's trace scratch.
+// Worker threads should call this before exiting,
+// their counters are merged to the frame stats.
+void bsp_trace_free_thread_scratch()
 {
-	if (node_index < 0)
+	_bsp_trace_merge_counters();
+	gs_free(_bsp_trace_scratch.brush_checks);
+	gs_free(_bsp_trace_scratch.patch_checks);
+	_bsp_trace_scratch = (bsp_trace_scratch_t){0};
+}
+
+// Collect world brushes touching the volume between mins and maxs,
+// traces inside it can then skip the tree. Traces reaching outside
+// or with contents not in content_mask still walk the tree.
+void bsp_trace_cache_build(bsp_trace_cache_t *cache, bsp_map_t *map, gs_vec3 mins, gs_vec3 maxs, int32_t content_mask)
+{
+	cache->map	    = map;
+	cache->mins	    = mins;
+	cache->maxs	    = maxs;
+	cache->content_mask = content_mask;
+	cache->num_brushes  = 0;
+	cache->valid	    = false;
+
+	if (map->nodes.count == 0) return;
+
+	int32_t stack[BSP_TRACE_STACK_SIZE];
+	uint32_t stack_size = 0;
+	uint32_t check	    = _bsp_trace_next_check(map);
+	uint32_t *checks    = _bsp_trace_scratch.brush_checks;
+
+	stack[stack_size++] = 0;
+	while (stack_size > 0)
 	{
-		// This is a leaf
-		bsp_leaf_lump_t leaf = trace->map->leaves.data[-(node_index + 1)];
-		int32_t brush_index;
-		bsp_brush_lump_t brush;
-		for (size_t i = 0; i < leaf.num_leaf_brushes; i++)
+		int32_t index = stack[--stack_size];
+
+		if (index < 0)
+		{
+			const bsp_trace_leaf_t *leaf = &map->trace_leaves[~index];
+			for (size_t i = 0; i < leaf->num_leaf_brushes; i++)
+			{
+				int32_t brush_index = map->leaf_brushes.data[leaf->first_leaf_brush + i].brush;
+				if (checks[brush_index] == check)
+				{
+					continue;
+				}
+				checks[brush_index] = check;
+
+				const bsp_trace_brush_t *brush = &map->trace_brushes[brush_index];
+				if (brush->num_sides == 0 || (brush->contents & content_mask) == 0
+				    || mins.x > brush->maxs.x || maxs.x < brush->mins.x
+				    || mins.y > brush->maxs.y || maxs.y < brush->mins.y
+				    || mins.z > brush->maxs.z || maxs.z < brush->mins.z)
+				{
+					continue;
+				}
+
+				if (cache->num_brushes == BSP_TRACE_CACHE_MAX_BRUSHES)
+				{
+					// Too crowded, traces walk the tree instead
+					return;
+				}
+				cache->brushes[cache->num_brushes++] = brush_index;
+			}
+
+			for (size_t i = 0; i < leaf->num_leaf_patches; i++)
+			{
+				uint32_t patch_index = map->trace_leaf_patches[leaf->first_leaf_patch + i];
+				if (_bsp_trace_scratch.patch_checks[patch_index] == check)
+				{
+					continue;
+				}
+				_bsp_trace_scratch.patch_checks[patch_index] = check;
+
+				const bsp_trace_patch_t *patch = &map->trace_patches[patch_index];
+				if ((patch->contents & content_mask) == 0
+				    || mins.x > patch->maxs.x || maxs.x < patch->mins.x
+				    || mins.y > patch->maxs.y || maxs.y < patch->mins.y
+				    || mins.z > patch->maxs.z || maxs.z < patch->mins.z)
+				{
+					continue;
+				}
+
+				for (size_t j = patch->first_node; j < patch->first_node + patch->num_nodes;)
+				{
+					const bsp_trace_patch_node_t *node = &map->trace_patch_nodes[j];
+					if (mins.x > node->maxs.x || maxs.x < node->mins.x
+					    || mins.y > node->maxs.y || maxs.y < node->mins.y
+					    || mins.z > node->maxs.z || maxs.z < node->mins.z)
+					{
+						j = node->skip;
+						continue;
+					}
+
+					for (size_t k = 0; k < node->num_brushes; k++)
+					{
+						if (cache->num_brushes == BSP_TRACE_CACHE_MAX_BRUSHES)
+						{
+							return;
+						}
+						cache->brushes[cache->num_brushes++] = node->first_brush + k;
+					}
+					j++;
+				}
+			}
+			continue;
+		}
+
+		const bsp_trace_node_t *node = &map->trace_nodes[index];
+		float32_t min_distance;
+		float32_t max_distance;
+
+		if (node->type < BSP_PLANE_NON_AXIAL)
 		{
-			brush_index = trace->map->leaf_brushes.data[leaf.first_leaf_brush + i].brush;
-			brush	    = trace->map->brushes.data[brush_index];
-			if (brush.num_brush_sides > 0 && (trace->map->textures.data[brush.texture].contents & content_mask) != 0)
+			min_distance = mins.xyz[node->type] - node->dist;
+			max_distance = maxs.xyz[node->type] - node->dist;
+		}
+		else
+		{
+			// Box corners nearest and farthest along the normal
+			min_distance = -node->dist;
+			max_distance = -node->dist;
+			for (size_t i = 0; i < 3; i++)
 			{
-				_bsp_trace_check_brush(trace, brush, start, end);
+				bool32_t negative = node->normal.xyz[i] < 0;
+				min_distance += node->normal.xyz[i] * (negative ? maxs.xyz[i] : mins.xyz[i]);
+				max_distance += node->normal.xyz[i] * (negative ? mins.xyz[i] : maxs.xyz[i]);
 			}
 		}
 
-		// Don't have to do anything else for leaves
-		return;
+		gs_assert(stack_size + 2 <= BSP_TRACE_STACK_SIZE);
+		if (max_distance >= 0)
+		{
+			stack[stack_size++] = node->children[0];
+		}
+		if (min_distance < 0)
+		{
+			stack[stack_size++] = node->children[1];
+		}
 	}
 
-	// This is a node
-	bsp_node_lump_t node   = trace->map->nodes.data[node_index];
-	bsp_plane_lump_t plane = trace->map->planes.data[node.plane];
+	cache->valid = true;
+}
 
-	float32_t offset	 = 0;
-	float32_t start_distance = gs_vec3_dot(start, plane.normal) - plane.dist;
-	float32_t end_distance	 = gs_vec3_dot(end, plane.normal) - plane.dist;
+bool32_t _bsp_trace_cache_contains(const bsp_trace_cache_t *cache, const bsp_trace_t *trace, int32_t content_mask)
+{
+	return cache->valid
+	       && cache->map == trace->map
+	       && (content_mask & ~cache->content_mask) == 0
+	       && trace->sweep_mins.x >= cache->mins.x && trace->sweep_maxs.x <= cache->maxs.x
+	       && trace->sweep_mins.y >= cache->mins.y && trace->sweep_maxs.y <= cache->maxs.y
+	       && trace->sweep_mins.z >= cache->mins.z && trace->sweep_maxs.z <= cache->maxs.z;
+}
 
-	if (trace->type == SPHERE)
+void _bsp_trace_check_cache(bsp_trace_t *trace, const bsp_trace_cache_t *cache, gs_vec3 start, gs_vec3 end, int32_t content_mask)
+{
+	for (size_t i = 0; i < cache->num_brushes; i++)
 	{
-		offset = trace->radius;
+		const bsp_trace_brush_t *brush = &trace->map->trace_brushes[cache->brushes[i]];
+		if ((brush->contents & content_mask) != 0)
+		{
+			_bsp_trace_check_brush(trace, brush, start, end);
+		}
 	}
-	else if (trace->type == BOX)
+}
+
+static inline void _bsp_trace_add_side(bsp_trace_sides_t *sides, bsp_trace_brush_t *brush, uint32_t side, gs_vec3 normal, float32_t dist, int32_t texture)
+{
+	sides->normal_x[side] = normal.x;
+	sides->normal_y[side] = normal.y;
+	sides->normal_z[side] = normal.z;
+	sides->dist[side]     = dist;
+	sides->texture[side]  = texture;
+	sides->signbits[side] = 0;
+
+	for (size_t k = 0; k < 3; k++)
 	{
-		// Dot product but we want the absolute values
-		offset = fabsf(trace->extents.x * plane.normal.x) +
-			 fabsf(trace->extents.y * plane.normal.y) +
-			 fabsf(trace->extents.z * plane.normal.z);
+		if (normal.xyz[k] < 0)
+		{
+			sides->signbits[side] |= 1 << k;
+		}
+
+		// q3map2 gives every brush axial bevels
+		if (normal.xyz[k] == 1.0f)
+		{
+			brush->maxs.xyz[k] = dist;
+		}
+		else if (normal.xyz[k] == -1.0f)
+		{
+			brush->mins.xyz[k] = -dist;
+		}
 	}
+}
+
+// Brush bounds and side planes in SIMD friendly layout.
+// Patch facets are added as brushes after the ones in the map.
+void _bsp_trace_init_brushes(bsp_map_t *map, const bsp_trace_facet_t *facets, uint32_t num_facets)
+{
+	bsp_trace_sides_t *sides = &map->trace_sides;
+	map->num_trace_brushes	 = map->brushes.count + num_facets;
+	map->trace_brushes	 = gs_malloc(sizeof(bsp_trace_brush_t) * (map->num_trace_brushes > 0 ? map->num_trace_brushes : 1));
 
-	if (start_distance >= offset && end_distance >= offset)
+	sides->count = 0;
+	for (size_t i = 0; i < map->brushes.count; i++)
 	{
-		// Both points are in front of the plane,
-		// check the front child.
-		_bsp_trace_check_node(trace, node.children[0], start_fraction, end_fraction, start, end, content_mask);
+		sides->count += (map->brushes.data[i].num_brush_sides + 3) & ~3;
 	}
-	else if (start_distance < -offset && end_distance < -offset)
+	for (size_t i = 0; i < num_facets; i++)
 	{
-		// Both points are behind the plane,
-		// check back child.
-		_bsp_trace_check_node(trace, node.children[1], start_fraction, end_fraction, start, end, content_mask);
+		sides->count += (facets[i].num_planes + 3) & ~3;
 	}
-	else
+
+	uint32_t size	 = sides->count > 0 ? sides->count : 1;
+	sides->normal_x	 = gs_malloc(sizeof(float32_t) * size);
+	sides->normal_y	 = gs_malloc(sizeof(float32_t) * size);
+	sides->normal_z	 = gs_malloc(sizeof(float32_t) * size);
+	sides->dist	 = gs_malloc(sizeof(float32_t) * size);
+	sides->signbits	 = gs_malloc(sizeof(uint8_t) * size);
+	sides->texture	 = gs_malloc(sizeof(int32_t) * size);
+
+	uint32_t side = 0;
+	for (size_t i = 0; i < map->num_trace_brushes; i++)
 	{
-		// The line crosses through the splitting plane.
-		int32_t side;
-		float32_t fraction1;
-		float32_t fraction2;
-		float32_t middle_fraction;
-		gs_vec3 middle;
+		bool32_t is_facet	= i >= map->brushes.count;
+		uint32_t num_planes	= is_facet ? facets[i - map->brushes.count].num_planes : map->brushes.data[i].num_brush_sides;
+		bsp_trace_brush_t *out	= &map->trace_brushes[i];
+
+		out->first_side = side;
+		out->num_sides	= (num_planes + 3) & ~3;
+		out->contents	= is_facet ? facets[i - map->brushes.count].contents : map->textures.data[map->brushes.data[i].texture].contents;
+		// Unbounded unless axial sides are found
+		out->mins = gs_v3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		out->maxs = gs_v3(FLT_MAX, FLT_MAX, FLT_MAX);
 
-		// STEP 1: Split the segment into two.
-		if (start_distance < end_distance)
+		for (size_t j = 0; j < out->num_sides; j++, side++)
 		{
-			side			   = 1; // back
-			float32_t inverse_distance = 1.0f / (start_distance - end_distance);
-			fraction1		   = (start_distance - offset + BSP_TRACE_EPSILON) * inverse_distance;
-			fraction2		   = (start_distance + offset + BSP_TRACE_EPSILON) * inverse_distance;
+			if (j >= num_planes)
+			{
+				// Padding, always behind so it never clips
+				_bsp_trace_add_side(sides, out, side, gs_v3(0, 0, 0), 1e9f, 0);
+			}
+			else if (is_facet)
+			{
+				const bsp_trace_facet_t *facet = &facets[i - map->brushes.count];
+				_bsp_trace_add_side(sides, out, side, facet->planes[j].normal, facet->planes[j].dist, facet->texture);
+			}
+			else
+			{
+				bsp_brush_side_lump_t brush_side = map->brush_sides.data[map->brushes.data[i].first_brush_side + j];
+				bsp_plane_lump_t plane		 = map->planes.data[brush_side.plane];
+				_bsp_trace_add_side(sides, out, side, plane.normal, plane.dist, brush_side.texture);
+			}
 		}
-		else if (end_distance < start_distance)
+	}
+}
+
+// Box corner closest to each sign combination of a plane normal,
+// same for every brush side the trace is checked against.
+void _bsp_trace_set_offsets(bsp_trace_t *trace)
+{
+	for (size_t i = 0; i < 8; i++)
+	{
+		for (size_t j = 0; j < 3; j++)
 		{
-			side			   = 0; // front
-			float32_t inverse_distance = 1.0f / (start_distance - end_distance);
-			fraction1		   = (start_distance + offset + BSP_TRACE_EPSILON) * inverse_distance;
-			fraction2		   = (start_distance - offset - BSP_TRACE_EPSILON) * inverse_distance;
+			if (trace->type == BOX)
+			{
+				trace->offsets[i][j] = (i & (1 << j)) ? trace->maxs.xyz[j] : trace->mins.xyz[j];
+			}
+			else
+			{
+				trace->offsets[i][j] = 0.0f;
+			}
 		}
-		else
+	}
+}
+
+// Bounds swept by the trace between start and end, for rejecting brushes
+void _bsp_trace_set_sweep(bsp_trace_t *trace, gs_vec3 start, gs_vec3 end)
+{
+	gs_vec3 mins = gs_v3(-trace->radius, -trace->radius, -trace->radius);
+	gs_vec3 maxs = gs_v3(trace->radius, trace->radius, trace->radius);
+	if (trace->type == BOX)
+	{
+		mins = trace->mins;
+		maxs = trace->maxs;
+	}
+
+	for (size_t i = 0; i < 3; i++)
+	{
+		trace->sweep_mins.xyz[i] = gs_min(start.xyz[i], end.xyz[i]) + mins.xyz[i] - 1.0f;
+		trace->sweep_maxs.xyz[i] = gs_max(start.xyz[i], end.xyz[i]) + maxs.xyz[i] + 1.0f;
+	}
+}
+
+void bsp_trace_free(bsp_map_t *map)
+{
+	bsp_trace_sides_t *sides = &map->trace_sides;
+	gs_free(sides->normal_x);
+	gs_free(sides->normal_y);
+	gs_free(sides->normal_z);
+	gs_free(sides->dist);
+	gs_free(sides->signbits);
+	gs_free(sides->texture);
+	*sides = (bsp_trace_sides_t){0};
+
+	bsp_trace_patches_free(map);
+
+	gs_free(map->trace_nodes);
+	gs_free(map->trace_leaves);
+	gs_free(map->trace_brushes);
+	map->trace_nodes	   = NULL;
+	map->trace_leaves	   = NULL;
+	map->trace_brushes	   = NULL;
+	map->num_trace_brushes = 0;
+}
+
+void _bsp_trace_submodels(bsp_trace_t *trace, gs_vec3 start, gs_vec3 end, int32_t content_mask)
+{
+	bsp_map_t *map = trace->map;
+	if (gs_dyn_array_size(map->submodels) == 0)
+	{
+		return;
+	}
+
+	// Bounds of the whole trace for rejecting models
+	gs_vec3 extents = gs_v3(trace->radius, trace->radius, trace->radius);
+	if (trace->type == BOX)
+	{
+		extents = trace->extents;
+	}
+	gs_vec3 mins = gs_vec3_sub(gs_v3(gs_min(start.x, end.x), gs_min(start.y, end.y), gs_min(start.z, end.z)), extents);
+	gs_vec3 maxs = gs_vec3_add(gs_v3(gs_max(start.x, end.x), gs_max(start.y, end.y), gs_max(start.z, end.z)), extents);
+
+	for (size_t i = 0; i < gs_dyn_array_size(map->submodels); i++)
+	{
+		bsp_submodel_t *submodel = &map->submodels[i];
+		bsp_model_lump_t model	 = map->models.data[submodel->model];
+
+		if (model.num_brushes == 0
+		    || mins.x > submodel->maxs.x || maxs.x < submodel->mins.x
+		    || mins.y > submodel->maxs.y || maxs.y < submodel->mins.y
+		    || mins.z > submodel->maxs.z || maxs.z < submodel->mins.z)
+		{
+			continue;
+		}
+
+		// Trace in model space. Boxes stay axis aligned,
+		// close enough for movers that only translate or spin around z.
+		gs_vec4 local_start = gs_mat4_mul_vec4(submodel->inverse, gs_v4(start.x, start.y, start.z, 1.0f));
+		gs_vec4 local_end   = gs_mat4_mul_vec4(submodel->inverse, gs_v4(end.x, end.y, end.z, 1.0f));
+
+		gs_vec3 brush_start  = gs_v3(local_start.x, local_start.y, local_start.z);
+		gs_vec3 brush_end    = gs_v3(local_end.x, local_end.y, local_end.z);
+		float32_t fraction   = trace->fraction;
+		bool32_t start_solid = trace->start_solid;
+		_bsp_trace_set_sweep(trace, brush_start, brush_end);
+
+		for (size_t j = 0; j < model.num_brushes; j++)
+		{
+			const bsp_trace_brush_t *brush = &map->trace_brushes[model.first_brush + j];
+			if (brush->num_sides > 0 && (brush->contents & content_mask) != 0)
+			{
+				_bsp_trace_check_brush(trace, brush, brush_start, brush_end);
+			}
+		}
+
+		if (trace->fraction < fraction)
 		{
-			side	  = 0; // front
-			fraction1 = 1.0f;
-			fraction2 = 0.0f;
+			// Normal back to world space
+			gs_vec4 normal = gs_mat4_mul_vec4(submodel->transform, gs_v4(trace->normal.x, trace->normal.y, trace->normal.z, 0.0f));
+			trace->normal  = gs_vec3_norm(gs_v3(normal.x, normal.y, normal.z));
+			trace->model   = submodel->model;
 		}
+		else if (trace->start_solid && !start_solid)
+		{
+			trace->model = submodel->model;
+		}
+	}
+}
 
-		// STEP 2: Make sure the numbers are valid.
-		fraction1 = fminf(1.0f, fmaxf(0.0f, fraction1));
-		fraction2 = fminf(1.0f, fmaxf(0.0f, fraction2));
+static inline void _bsp_trace_check_leaf(bsp_trace_t *trace, int32_t leaf_index, const gs_vec3 start, const gs_vec3 end, int32_t content_mask)
+{
+	bsp_map_t *map		     = trace->map;
+	const bsp_trace_leaf_t *leaf = &map->trace_leaves[leaf_index];
+	uint32_t *brush_checks	     = _bsp_trace_scratch.brush_checks;
+	uint32_t check_count	     = _bsp_trace_scratch.check_count;
 
-		// STEP 3: Calculate the middle point for the first side
-		middle_fraction = start_fraction + (end_fraction - start_fraction) * fraction1;
-		middle		= gs_vec3_add(start, gs_vec3_scale(gs_vec3_sub(end, start), fraction1));
+	_bsp_trace_scratch.counters.leaves++;
 
-		// STEP 4: Check the first side
-		_bsp_trace_check_node(trace, node.children[side], start_fraction, middle_fraction, start, middle, content_mask);
+	for (size_t i = 0; i < leaf->num_leaf_brushes; i++)
+	{
+		int32_t brush_index = map->leaf_brushes.data[leaf->first_leaf_brush + i].brush;
 
-		// STEP 5: Calculate the middle point for the second side
-		middle_fraction = start_fraction + (end_fraction - start_fraction) * fraction2;
-		middle		= gs_vec3_add(start, gs_vec3_scale(gs_vec3_sub(end, start), fraction2));
+		// Already checked in another leaf
+		if (brush_checks[brush_index] == check_count)
+		{
+			continue;
+		}
+		brush_checks[brush_index] = check_count;
 
-		// STEP 6: Check the second side
-		_bsp_trace_check_node(trace, node.children[1 - side], middle_fraction, end_fraction, middle, end, content_mask);
+		const bsp_trace_brush_t *brush = &map->trace_brushes[brush_index];
+		if (brush->num_sides > 0 && (brush->contents & content_mask) != 0)
+		{
+			_bsp_trace_check_brush(trace, brush, start, end);
+		}
+	}
+
+	uint32_t *patch_checks = _bsp_trace_scratch.patch_checks;
+	for (size_t i = 0; i < leaf->num_leaf_patches; i++)
+	{
+		uint32_t patch_index = map->trace_leaf_patches[leaf->first_leaf_patch + i];
+		if (patch_checks[patch_index] == check_count)
+		{
+			continue;
+		}
+		patch_checks[patch_index] = check_count;
+
+		const bsp_trace_patch_t *patch = &map->trace_patches[patch_index];
+		if ((patch->contents & content_mask) != 0)
+		{
+			_bsp_trace_scratch.counters.patches++;
+			_bsp_trace_check_patch(trace, patch, start, end);
+		}
+	}
+}
+
+// Walk the patch bounding hierarchy, facets are checked like brushes
+void _bsp_trace_check_patch(bsp_trace_t *trace, const bsp_trace_patch_t *patch, gs_vec3 start, gs_vec3 end)
+{
+	bsp_map_t *map = trace->map;
+
+	if (trace->sweep_mins.x > patch->maxs.x || trace->sweep_maxs.x < patch->mins.x
+	    || trace->sweep_mins.y > patch->maxs.y || trace->sweep_maxs.y < patch->mins.y
+	    || trace->sweep_mins.z > patch->maxs.z || trace->sweep_maxs.z < patch->mins.z)
+	{
+		return;
+	}
+
+	for (size_t i = patch->first_node; i < patch->first_node + patch->num_nodes;)
+	{
+		const bsp_trace_patch_node_t *node = &map->trace_patch_nodes[i];
+		if (trace->sweep_mins.x > node->maxs.x || trace->sweep_maxs.x < node->mins.x
+		    || trace->sweep_mins.y > node->maxs.y || trace->sweep_maxs.y < node->mins.y
+		    || trace->sweep_mins.z > node->maxs.z || trace->sweep_maxs.z < node->mins.z)
+		{
+			i = node->skip;
+			continue;
+		}
+
+		for (size_t j = 0; j < node->num_brushes; j++)
+		{
+			_bsp_trace_check_brush(trace, &map->trace_brushes[node->first_brush + j], start, end);
+		}
+		i++;
 	}
 }
 
-void _bsp_trace_check_brush(bsp_trace_t *trace, bsp_brush_lump_t brush, gs_vec3 start, gs_vec3 end)
+// Walk the tree with an explicit stack. type is a constant in each caller
+// so the plane offset branches fold away. Segments are split at planes
+// to find leaves, but brushes are always checked against the whole trace.
+static inline void _bsp_trace_walk(bsp_trace_t *trace, const gs_vec3 trace_start, const gs_vec3 trace_end, int32_t content_mask, const bsp_trace_type type)
 {
-	float32_t start_fraction = -1.0f;
-	float end_fraction	 = 1.0f;
-	bool32_t starts_out	 = false;
-	bool32_t ends_out	 = false;
+	const bsp_trace_node_t *nodes = trace->map->trace_nodes;
+	bsp_trace_segment_t stack[BSP_TRACE_STACK_SIZE];
+	uint32_t stack_size    = 0;
+	uint32_t visited_nodes = 0;
 
-	bsp_brush_side_lump_t brush_side;
-	bsp_brush_side_lump_t clip_brush_side;
-	bsp_plane_lump_t plane;
-	bsp_plane_lump_t clip_plane;
-	gs_vec3 offset		 = gs_v3(0, 0, 0);
-	float32_t start_distance = 0;
-	float32_t end_distance	 = 0;
-	float32_t fraction	 = 0;
+	stack[stack_size++] = (bsp_trace_segment_t){
+		.node		= 0,
+		.start_fraction = 0.0f,
+		.end_fraction	= 1.0f,
+		.start		= trace_start,
+		.end		= trace_end,
+	};
 
-	for (size_t i = 0; i < brush.num_brush_sides; i++)
+	while (stack_size > 0)
 	{
-		brush_side = trace->map->brush_sides.data[brush.first_brush_side + i];
-		plane	   = trace->map->planes.data[brush_side.plane];
-		offset	   = gs_v3(0, 0, 0);
+		bsp_trace_segment_t segment = stack[--stack_size];
 
-		if (trace->type == BOX)
+		// Already hit something before this segment
+		if (trace->fraction <= segment.start_fraction)
 		{
-			for (size_t j = 0; j < 3; j++)
+			continue;
+		}
+
+		while (segment.node >= 0)
+		{
+			const bsp_trace_node_t *node = &nodes[segment.node];
+			visited_nodes++;
+			float32_t start_distance;
+			float32_t end_distance;
+			float32_t offset = 0.0f;
+
+			if (node->type < BSP_PLANE_NON_AXIAL)
 			{
-				if (plane.normal.xyz[j] < 0)
-				{
-					offset.xyz[j] = trace->maxs.xyz[j];
-				}
-				else
+				start_distance = segment.start.xyz[node->type] - node->dist;
+				end_distance   = segment.end.xyz[node->type] - node->dist;
+				if (type == BOX) offset = trace->extents.xyz[node->type];
+			}
+			else
+			{
+				start_distance = gs_vec3_dot(segment.start, node->normal) - node->dist;
+				end_distance   = gs_vec3_dot(segment.end, node->normal) - node->dist;
+				if (type == BOX)
 				{
-					offset.xyz[j] = trace->mins.xyz[j];
+					// Dot product but we want the absolute values
+					offset = fabsf(trace->extents.x * node->normal.x) +
+						 fabsf(trace->extents.y * node->normal.y) +
+						 fabsf(trace->extents.z * node->normal.z);
 				}
 			}
+
+			if (type == SPHERE)
+			{
+				offset = trace->radius;
+			}
+
+			if (start_distance >= offset && end_distance >= offset)
+			{
+				// Both points are in front of the plane
+				segment.node = node->children[0];
+				continue;
+			}
+
+			if (start_distance < -offset && end_distance < -offset)
+			{
+				// Both points are behind the plane
+				segment.node = node->children[1];
+				continue;
+			}
+
+			// The segment crosses the plane, split it in two
+			int32_t side;
+			float32_t fraction1;
+			float32_t fraction2;
+
+			if (start_distance < end_distance)
+			{
+				side			   = 1; // back
+				float32_t inverse_distance = 1.0f / (start_distance - end_distance);
+				fraction1		   = (start_distance - offset + BSP_TRACE_EPSILON) * inverse_distance;
+				fraction2		   = (start_distance + offset + BSP_TRACE_EPSILON) * inverse_distance;
+			}
+			else if (end_distance < start_distance)
+			{
+				side			   = 0; // front
+				float32_t inverse_distance = 1.0f / (start_distance - end_distance);
+				fraction1		   = (start_distance + offset + BSP_TRACE_EPSILON) * inverse_distance;
+				fraction2		   = (start_distance - offset - BSP_TRACE_EPSILON) * inverse_distance;
+			}
+			else
+			{
+				side	  = 0; // front
+				fraction1 = 1.0f;
+				fraction2 = 0.0f;
+			}
+
+			fraction1 = fminf(1.0f, fmaxf(0.0f, fraction1));
+			fraction2 = fminf(1.0f, fmaxf(0.0f, fraction2));
+
+			gs_vec3 delta		 = gs_vec3_sub(segment.end, segment.start);
+			float32_t delta_fraction = segment.end_fraction - segment.start_fraction;
+
+			// Second side is checked later
+			gs_assert(stack_size < BSP_TRACE_STACK_SIZE);
+			stack[stack_size++] = (bsp_trace_segment_t){
+				.node		= node->children[side ^ 1],
+				.start_fraction = segment.start_fraction + delta_fraction * fraction2,
+				.end_fraction	= segment.end_fraction,
+				.start		= gs_vec3_add(segment.start, gs_vec3_scale(delta, fraction2)),
+				.end		= segment.end,
+			};
+
+			// Continue down the first side
+			segment.node	     = node->children[side];
+			segment.end_fraction = segment.start_fraction + delta_fraction * fraction1;
+			segment.end	     = gs_vec3_add(segment.start, gs_vec3_scale(delta, fraction1));
 		}
 
-		// NOTE: offset should be zero if not BOX,
-		// and radius should be zero if not SPHERE.
-		start_distance = gs_vec3_dot(gs_vec3_add(start, offset), plane.normal) - (plane.dist + trace->radius);
-		end_distance   = gs_vec3_dot(gs_vec3_add(end, offset), plane.normal) - (plane.dist + trace->radius);
+		_bsp_trace_check_leaf(trace, ~segment.node, trace_start, trace_end, content_mask);
+	}
+
+	_bsp_trace_scratch.counters.nodes += visited_nodes;
+}
+
+void _bsp_trace_walk_ray(bsp_trace_t *trace, gs_vec3 start, gs_vec3 end, int32_t content_mask)
+{
+	_bsp_trace_walk(trace, start, end, content_mask, RAY);
+}
+
+void _bsp_trace_walk_sphere(bsp_trace_t *trace, gs_vec3 start, gs_vec3 end, int32_t content_mask)
+{
+	_bsp_trace_walk(trace, start, end, content_mask, SPHERE);
+}
+
+void _bsp_trace_walk_box(bsp_trace_t *trace, gs_vec3 start, gs_vec3 end, int32_t content_mask)
+{
+	_bsp_trace_walk(trace, start, end, content_mask, BOX);
+}
+
+void _bsp_trace_check_brush(bsp_trace_t *trace, const bsp_trace_brush_t *brush, gs_vec3 start, gs_vec3 end)
+{
+	// Swept bounds don't touch the brush
+	if (trace->sweep_mins.x > brush->maxs.x || trace->sweep_maxs.x < brush->mins.x
+	    || trace->sweep_mins.y > brush->maxs.y || trace->sweep_maxs.y < brush->mins.y
+	    || trace->sweep_mins.z > brush->maxs.z || trace->sweep_maxs.z < brush->mins.z)
+	{
+		return;
+	}
+
+	_bsp_trace_scratch.counters.brushes++;
+
+	const bsp_trace_sides_t *sides = &trace->map->trace_sides;
+	float32_t start_fraction       = -1.0f;
+	float end_fraction	       = 1.0f;
+	bool32_t starts_out	       = false;
+	bool32_t ends_out	       = false;
+	int32_t clip_side	       = -1;
 
-		// Don't reset these to false,
-		// we are outside the brush if in front of any plane.
-		if (start_distance > 0)
-			starts_out = true;
-		if (end_distance > 0)
-			ends_out = true;
+	float32_t start_distances[4];
+	float32_t end_distances[4];
 
-		// Make sure the trace isn't completely on one side of the plane.
-		// Make sure end_distance can't get too close to the plane.
-		if (start_distance > 0 && (end_distance >= BSP_TRACE_EPSILON || end_distance >= start_distance))
+	for (size_t i = brush->first_side; i < brush->first_side + brush->num_sides; i += 4)
+	{
+		const float32_t *nx = sides->normal_x + i;
+		const float32_t *ny = sides->normal_y + i;
+		const float32_t *nz = sides->normal_z + i;
+		float32_t ox[4];
+		float32_t oy[4];
+		float32_t oz[4];
+		float32_t dist[4];
+
+		_bsp_trace_scratch.counters.sides += 4;
+
+		for (size_t j = 0; j < 4; j++)
 		{
-			// Both are in front of the plane, outside of the brush
-			return;
+			// Radius is zero if not SPHERE so it can go in here too
+			const float32_t *offset = trace->offsets[sides->signbits[i + j]];
+			ox[j]			= offset[0];
+			oy[j]			= offset[1];
+			oz[j]			= offset[2];
+			dist[j]			= sides->dist[i + j] + trace->radius;
 		}
-		if (start_distance <= 0 && end_distance <= 0)
+
+#if defined(MG_SIMD_SSE)
+		__m128 x  = _mm_loadu_ps(nx);
+		__m128 y  = _mm_loadu_ps(ny);
+		__m128 z  = _mm_loadu_ps(nz);
+		__m128 d  = _mm_sub_ps(
+			 _mm_add_ps(_mm_mul_ps(x, _mm_loadu_ps(ox)), _mm_add_ps(_mm_mul_ps(y, _mm_loadu_ps(oy)), _mm_mul_ps(z, _mm_loadu_ps(oz)))),
+			 _mm_loadu_ps(dist));
+		__m128 sd = _mm_add_ps(d, _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(start.x)), _mm_add_ps(_mm_mul_ps(y, _mm_set1_ps(start.y)), _mm_mul_ps(z, _mm_set1_ps(start.z)))));
+		__m128 ed = _mm_add_ps(d, _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(end.x)), _mm_add_ps(_mm_mul_ps(y, _mm_set1_ps(end.y)), _mm_mul_ps(z, _mm_set1_ps(end.z)))));
+
+		// Skip the scalar part if all 4 are behind
+		__m128 zero = _mm_setzero_ps();
+		if (_mm_movemask_ps(_mm_or_ps(_mm_cmpgt_ps(sd, zero), _mm_cmpgt_ps(ed, zero))) == 0)
 		{
-			// Both are behind this plane, check the next one
 			continue;
 		}
+		_mm_storeu_ps(start_distances, sd);
+		_mm_storeu_ps(end_distances, ed);
+#elif defined(MG_SIMD_NEON)
+		float32x4_t x  = vld1q_f32(nx);
+		float32x4_t y  = vld1q_f32(ny);
+		float32x4_t z  = vld1q_f32(nz);
+		float32x4_t d  = vmulq_f32(x, vld1q_f32(ox));
+		d	       = vmlaq_f32(d, y, vld1q_f32(oy));
+		d	       = vmlaq_f32(d, z, vld1q_f32(oz));
+		d	       = vsubq_f32(d, vld1q_f32(dist));
+		float32x4_t sd = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(d, x, start.x), y, start.y), z, start.z);
+		float32x4_t ed = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(d, x, end.x), y, end.y), z, end.z);
+		vst1q_f32(start_distances, sd);
+		vst1q_f32(end_distances, ed);
+#else
+		for (size_t j = 0; j < 4; j++)
+		{
+			float32_t d	   = nx[j] * ox[j] + ny[j] * oy[j] + nz[j] * oz[j] - dist[j];
+			start_distances[j] = d + nx[j] * start.x + ny[j] * start.y + nz[j] * start.z;
+			end_distances[j]   = d + nx[j] * end.x + ny[j] * end.y + nz[j] * end.z;
+		}
+#endif
 
-		if (start_distance > end_distance)
+		for (size_t j = 0; j < 4; j++)
 		{
-			// The line is entering the plane
-			fraction = (start_distance - BSP_TRACE_EPSILON) / (start_distance - end_distance);
-			if (fraction < 0)
+			float32_t start_distance = start_distances[j];
+			float32_t end_distance	 = end_distances[j];
+
+			// Don't reset these to false,
+			// we are outside the brush if in front of any plane.
+			if (start_distance > 0)
+				starts_out = true;
+			if (end_distance > 0)
+				ends_out = true;
+
+			// Make sure the trace isn't completely on one side of the plane.
+			// Make sure end_distance can't get too close to the plane.
+			if (start_distance > 0 && (end_distance >= BSP_TRACE_EPSILON || end_distance >= start_distance))
 			{
-				fraction = 0;
+				// Both are in front of the plane, outside of the brush
+				return;
 			}
-			if (fraction > start_fraction)
+			if (start_distance <= 0 && end_distance <= 0)
 			{
-				start_fraction	= fraction;
-				clip_plane	= plane;
-				clip_brush_side = brush_side;
+				// Both are behind this plane, check the next one
+				continue;
 			}
-		}
-		else
-		{
-			// The line is leaving the plane
-			fraction = (start_distance + BSP_TRACE_EPSILON) / (start_distance - end_distance);
-			if (fraction > 1.0f)
+
+			if (start_distance > end_distance)
 			{
-				fraction = 1.0f;
+				// The line is entering the plane
+				float32_t fraction = (start_distance - BSP_TRACE_EPSILON) / (start_distance - end_distance);
+				if (fraction < 0)
+				{
+					fraction = 0;
+				}
+				if (fraction > start_fraction)
+				{
+					start_fraction = fraction;
+					clip_side      = i + j;
+				}
 			}
-			if (fraction < end_fraction)
+			else
 			{
-				end_fraction = fraction;
+				// The line is leaving the plane
+				float32_t fraction = (start_distance + BSP_TRACE_EPSILON) / (start_distance - end_distance);
+				if (fraction > 1.0f)
+				{
+					fraction = 1.0f;
+				}
+				if (fraction < end_fraction)
+				{
+					end_fraction = fraction;
+				}
 			}
 		}
 	}
@@ -277,7 +1160,7 @@ void _bsp_trace_check_brush(bsp_trace_t *trace, bsp_brush_lump_t brush, gs_vec3
 		{
 			trace->all_solid = true;
 			trace->fraction	 = 0;
-			trace->contents	 = trace->map->textures.data[brush.texture].contents;
+			trace->contents	 = brush->contents;
 		}
 		return;
 	}
@@ -287,9 +1170,9 @@ void _bsp_trace_check_brush(bsp_trace_t *trace, bsp_brush_lump_t brush, gs_vec3
 		if (start_fraction > -1.0f && start_fraction < trace->fraction)
 		{
 			trace->fraction	     = fmaxf(0.0f, start_fraction);
-			trace->normal	     = clip_plane.normal;
-			trace->contents	     = trace->map->textures.data[brush.texture].contents;
-			trace->surface_flags = trace->map->textures.data[clip_brush_side.texture].flags;
+			trace->normal	     = gs_v3(sides->normal_x[clip_side], sides->normal_y[clip_side], sides->normal_z[clip_side]);
+			trace->contents	     = brush->contents;
+			trace->surface_flags = trace->map->textures.data[sides->texture[clip_side]].flags;
 		}
 	}
 }
\ No newline at end of file
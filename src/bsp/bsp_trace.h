@@ -12,20 +12,74 @@
 
 #include <gs/gs.h>
 
+#include "bsp_trace_patch.h"
 #include "bsp_types.h"
 
 #define BSP_TRACE_EPSILON 0.125f
+// Deeper than any tree q3map2 builds
+#define BSP_TRACE_STACK_SIZE 128
+// Brushes kept by a trace cache
+#define BSP_TRACE_CACHE_MAX_BRUSHES 256
+// Smallest batch share worth starting a thread for
+#define BSP_TRACE_BATCH_MIN_PER_THREAD 64
 
 typedef enum bsp_trace_type
 {
 	RAY,
 	SPHERE,
 	BOX,
+	BSP_TRACE_TYPE_COUNT,
 } bsp_trace_type;
 
+// Who a trace is for, only used for stats
+typedef enum bsp_trace_caller
+{
+	BSP_TRACE_CALLER_OTHER,
+	BSP_TRACE_CALLER_PLAYER,
+	BSP_TRACE_CALLER_MONSTER,
+	BSP_TRACE_CALLER_ROCKET,
+	BSP_TRACE_CALLER_COUNT,
+} bsp_trace_caller;
+
+typedef struct bsp_trace_counters_t
+{
+	uint64_t traces[BSP_TRACE_TYPE_COUNT];
+	uint64_t nodes;
+	uint64_t leaves;
+	uint64_t brushes;
+	uint64_t sides;
+	uint64_t patches;
+	uint64_t time_ns;
+} bsp_trace_counters_t;
+
+// Counters per caller, frame is being gathered and last is complete
+typedef struct bsp_trace_stats_t
+{
+	bsp_trace_counters_t frame[BSP_TRACE_CALLER_COUNT];
+	bsp_trace_counters_t last[BSP_TRACE_CALLER_COUNT];
+	// Time every trace, costs two timer reads each
+	bool32_t timing;
+} bsp_trace_stats_t;
+
+// World brushes around a volume, such as what an entity
+// can reach in one tick. See bsp_trace_cache_build.
+typedef struct bsp_trace_cache_t
+{
+	bsp_map_t *map;
+	gs_vec3 mins;
+	gs_vec3 maxs;
+	int32_t content_mask;
+	bool32_t valid;
+	uint32_t num_brushes;
+	int32_t brushes[BSP_TRACE_CACHE_MAX_BRUSHES];
+} bsp_trace_cache_t;
+
 typedef struct bsp_trace_t
 {
 	bsp_map_t *map;
+	bsp_trace_caller caller;
+	// Optional, used when the trace fits inside it
+	const bsp_trace_cache_t *cache;
 	bsp_trace_type type;
 	float32_t fraction;
 	float32_t radius;
@@ -38,13 +92,101 @@ typedef struct bsp_trace_t
 	gs_vec3 extents;
 	int32_t contents;
 	int32_t surface_flags;
+	// Brush model hit, 0 for world and -1 if nothing
+	int32_t model;
+	// Swept bounds for rejecting brushes, in the space brushes are checked
+	gs_vec3 sweep_mins;
+	gs_vec3 sweep_maxs;
+	// Box corner for each sign combination of a plane normal, zero if not BOX
+	float32_t offsets[8][3];
 } bsp_trace_t;
 
+// Part of a trace left to walk through the tree
+typedef struct bsp_trace_segment_t
+{
+	int32_t node;
+	float32_t start_fraction;
+	float32_t end_fraction;
+	gs_vec3 start;
+	gs_vec3 end;
+} bsp_trace_segment_t;
+
+// One trace of a batch, type picks which of the shape fields are used
+typedef struct bsp_trace_query_t
+{
+	bsp_trace_type type;
+	gs_vec3 start;
+	gs_vec3 end;
+	gs_vec3 mins;
+	gs_vec3 maxs;
+	float32_t radius;
+	int32_t content_mask;
+	bsp_trace_caller caller;
+} bsp_trace_query_t;
+
+// Query sorted by the leaf it starts in
+typedef struct bsp_trace_batch_item_t
+{
+	int32_t leaf;
+	uint32_t query;
+} bsp_trace_batch_item_t;
+
+typedef struct bsp_trace_batch_job_t
+{
+	bsp_map_t *map;
+	const bsp_trace_query_t *queries;
+	bsp_trace_t *results;
+	const bsp_trace_batch_item_t *items;
+	uint32_t first;
+	uint32_t count;
+	bool32_t worker;
+} bsp_trace_batch_job_t;
+
+// Per thread brush check stamps, so brushes in several
+// leaves are only checked once per trace.
+typedef struct bsp_trace_scratch_t
+{
+	uint32_t map_serial;
+	uint32_t check_count;
+	uint32_t num_brushes;
+	uint32_t num_patches;
+	uint32_t *brush_checks;
+	uint32_t *patch_checks;
+	// Counted during one trace, added to totals after it
+	bsp_trace_counters_t counters;
+	// This thread's traces since the last merge to stats
+	bsp_trace_counters_t totals[BSP_TRACE_CALLER_COUNT];
+} bsp_trace_scratch_t;
+
+void bsp_trace_init(bsp_map_t *map);
+void bsp_trace_free(bsp_map_t *map);
+void bsp_trace_free_thread_scratch();
+void bsp_trace_stats_end_frame();
+bsp_trace_counters_t bsp_trace_stats_total(const bsp_trace_counters_t *counters);
+const char *bsp_trace_caller_name(bsp_trace_caller caller);
 void bsp_trace_ray(bsp_trace_t *trace, gs_vec3 start, gs_vec3 end, int32_t content_mask);
 void bsp_trace_sphere(bsp_trace_t *trace, gs_vec3 start, gs_vec3 end, float32_t radius, int32_t content_mask);
 void bsp_trace_box(bsp_trace_t *trace, gs_vec3 start, gs_vec3 end, gs_vec3 mins, gs_vec3 maxs, int32_t content_mask);
+void bsp_trace_query(bsp_trace_t *trace, const bsp_trace_query_t *query);
+void bsp_trace_batch(bsp_map_t *map, const bsp_trace_query_t *queries, bsp_trace_t *results, uint32_t count, bool32_t threaded);
+int32_t bsp_trace_point_leaf(bsp_map_t *map, gs_vec3 point);
+void bsp_trace_cache_build(bsp_trace_cache_t *cache, bsp_map_t *map, gs_vec3 mins, gs_vec3 maxs, int32_t content_mask);
 void _bsp_trace(bsp_trace_t *trace, gs_vec3 start, gs_vec3 end, int32_t content_mask);
-void _bsp_trace_check_node(bsp_trace_t *trace, int32_t node_index, float32_t start_fraction, float32_t end_fraction, gs_vec3 start, gs_vec3 end, int32_t content_mask);
-void _bsp_trace_check_brush(bsp_trace_t *trace, bsp_brush_lump_t brush, gs_vec3 start, gs_vec3 end);
+uint32_t _bsp_trace_next_check(bsp_map_t *map);
+void _bsp_trace_add_counters(bsp_trace_caller caller, bsp_trace_type type, uint64_t time_ns);
+void _bsp_trace_merge_counters();
+bool32_t _bsp_trace_cache_contains(const bsp_trace_cache_t *cache, const bsp_trace_t *trace, int32_t content_mask);
+void _bsp_trace_check_cache(bsp_trace_t *trace, const bsp_trace_cache_t *cache, gs_vec3 start, gs_vec3 end, int32_t content_mask);
+void _bsp_trace_submodels(bsp_trace_t *trace, gs_vec3 start, gs_vec3 end, int32_t content_mask);
+void _bsp_trace_walk_ray(bsp_trace_t *trace, gs_vec3 start, gs_vec3 end, int32_t content_mask);
+void _bsp_trace_walk_sphere(bsp_trace_t *trace, gs_vec3 start, gs_vec3 end, int32_t content_mask);
+void _bsp_trace_walk_box(bsp_trace_t *trace, gs_vec3 start, gs_vec3 end, int32_t content_mask);
+void _bsp_trace_init_brushes(bsp_map_t *map, const bsp_trace_facet_t *facets, uint32_t num_facets);
+void _bsp_trace_set_offsets(bsp_trace_t *trace);
+void _bsp_trace_set_sweep(bsp_trace_t *trace, gs_vec3 start, gs_vec3 end);
+void _bsp_trace_check_patch(bsp_trace_t *trace, const bsp_trace_patch_t *patch, gs_vec3 start, gs_vec3 end);
+void _bsp_trace_check_brush(bsp_trace_t *trace, const bsp_trace_brush_t *brush, gs_vec3 start, gs_vec3 end);
+
+extern bsp_trace_stats_t g_bsp_trace_stats;
 
 #endif // BSP_TRACE_H
\ No newline at end of file
@@ -0,0 +1,376 @@
+/*================================================================
+	* bsp/bsp_trace_patch.c
+	*
+	* Copyright (c) 2021 Lauri Räsänen
+	* ================================
+
+	Collision facets for curved patches.
+
+	Similar to cm_patch in Quake 3, the control grid is
+	subdivided at a fixed level and every triangle becomes
+	a thin brush with edge and axial bevels. Facets of a patch
+	are found through a small bounding volume hierarchy.
+=================================================================*/
+
+#include "bsp_trace_patch.h"
+
+static inline gs_vec3 _bsp_vec3_min(gs_vec3 a, gs_vec3 b)
+{
+	return gs_v3(gs_min(a.x, b.x), gs_min(a.y, b.y), gs_min(a.z, b.z));
+}
+
+static inline gs_vec3 _bsp_vec3_max(gs_vec3 a, gs_vec3 b)
+{
+	return gs_v3(gs_max(a.x, b.x), gs_max(a.y, b.y), gs_max(a.z, b.z));
+}
+
+static inline bool32_t _bsp_trace_facet_has_plane(const bsp_trace_facet_t *facet, gs_vec3 normal)
+{
+	for (size_t i = 0; i < facet->num_planes; i++)
+	{
+		if (gs_vec3_dot(facet->planes[i].normal, normal) > 0.999f)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Build facets and bounding hierarchies for all solid patches.
+// Facet i becomes trace brush first_brush + i, returns the facets.
+gs_dyn_array(bsp_trace_facet_t) bsp_trace_patches_init(bsp_map_t *map, uint32_t first_brush)
+{
+	gs_dyn_array(bsp_trace_facet_t) facets = NULL;
+
+	for (size_t i = 0; i < map->faces.count; i++)
+	{
+		bsp_face_lump_t face = map->faces.data[i];
+		if (face.type != BSP_FACE_TYPE_PATCH || face.size[0] < 3 || face.size[1] < 3)
+		{
+			continue;
+		}
+
+		bsp_texture_lump_t texture = map->textures.data[face.texture];
+		if (texture.contents == 0 || (texture.flags & BSP_SURFACE_NONSOLID) != 0)
+		{
+			continue;
+		}
+
+		uint32_t grid_width  = ((face.size[0] - 1) >> 1) * BSP_TRACE_PATCH_SUBDIVISIONS + 1;
+		uint32_t grid_height = ((face.size[1] - 1) >> 1) * BSP_TRACE_PATCH_SUBDIVISIONS + 1;
+		gs_vec3 *points	     = gs_malloc(sizeof(gs_vec3) * grid_width * grid_height);
+		gs_vec3 *normals     = gs_malloc(sizeof(gs_vec3) * grid_width * grid_height);
+		_bsp_trace_patch_tesselate(map, face, points, normals, grid_width, grid_height);
+
+		uint32_t first_facet = gs_dyn_array_size(facets);
+		for (size_t y = 0; y + 1 < grid_height; y++)
+		{
+			for (size_t x = 0; x + 1 < grid_width; x++)
+			{
+				uint32_t a = y * grid_width + x;
+				uint32_t b = a + 1;
+				uint32_t c = a + grid_width;
+				uint32_t d = c + 1;
+				gs_vec3 up = gs_vec3_add(gs_vec3_add(normals[a], normals[b]), gs_vec3_add(normals[c], normals[d]));
+
+				_bsp_trace_patch_add_facet(&facets, points[a], points[b], points[d], up, face.texture, texture.contents);
+				_bsp_trace_patch_add_facet(&facets, points[a], points[d], points[c], up, face.texture, texture.contents);
+			}
+		}
+
+		gs_free(points);
+		gs_free(normals);
+
+		uint32_t count = gs_dyn_array_size(facets) - first_facet;
+		if (count == 0)
+		{
+			continue;
+		}
+
+		bsp_trace_patch_t patch = {
+			.mins	    = facets[first_facet].mins,
+			.maxs	    = facets[first_facet].maxs,
+			.face	    = i,
+			.contents   = texture.contents,
+			.first_node = gs_dyn_array_size(map->trace_patch_nodes),
+		};
+		for (size_t j = first_facet + 1; j < first_facet + count; j++)
+		{
+			patch.mins = _bsp_vec3_min(patch.mins, facets[j].mins);
+			patch.maxs = _bsp_vec3_max(patch.maxs, facets[j].maxs);
+		}
+
+		// Build the hierarchy on facet indices, then put the facets in its order once
+		bsp_trace_facet_sort_t *order = gs_malloc(sizeof(bsp_trace_facet_sort_t) * count);
+		for (size_t j = 0; j < count; j++)
+		{
+			order[j].facet = first_facet + j;
+		}
+		_bsp_trace_patch_build_nodes(map, facets, order, 0, count, first_brush + first_facet);
+		patch.num_nodes = gs_dyn_array_size(map->trace_patch_nodes) - patch.first_node;
+
+		bsp_trace_facet_t *sorted = gs_malloc(sizeof(bsp_trace_facet_t) * count);
+		for (size_t j = 0; j < count; j++)
+		{
+			sorted[j] = facets[order[j].facet];
+		}
+		memcpy(facets + first_facet, sorted, sizeof(bsp_trace_facet_t) * count);
+		gs_free(sorted);
+		gs_free(order);
+
+		gs_dyn_array_push(map->trace_patches, patch);
+	}
+
+	return facets;
+}
+
+// List the patches in each leaf, after trace leaves are created
+void bsp_trace_patches_link_leaves(bsp_map_t *map)
+{
+	int32_t *face_patches = gs_malloc(sizeof(int32_t) * (map->faces.count > 0 ? map->faces.count : 1));
+	memset(face_patches, 0xff, sizeof(int32_t) * map->faces.count);
+
+	for (size_t i = 0; i < gs_dyn_array_size(map->trace_patches); i++)
+	{
+		face_patches[map->trace_patches[i].face] = i;
+	}
+
+	for (size_t i = 0; i < map->leaves.count; i++)
+	{
+		bsp_leaf_lump_t leaf  = map->leaves.data[i];
+		bsp_trace_leaf_t *out = &map->trace_leaves[i];
+
+		out->first_leaf_patch = gs_dyn_array_size(map->trace_leaf_patches);
+		out->num_leaf_patches = 0;
+
+		for (size_t j = 0; j < leaf.num_leaf_faces; j++)
+		{
+			int32_t patch = face_patches[map->leaf_faces.data[leaf.first_leaf_face + j].face];
+			if (patch >= 0)
+			{
+				gs_dyn_array_push(map->trace_leaf_patches, (uint32_t)patch);
+				out->num_leaf_patches++;
+			}
+		}
+	}
+
+	gs_free(face_patches);
+}
+
+void bsp_trace_patches_free(bsp_map_t *map)
+{
+	gs_dyn_array_free(map->trace_patches);
+	gs_dyn_array_free(map->trace_patch_nodes);
+	gs_dyn_array_free(map->trace_leaf_patches);
+	map->trace_patches	= NULL;
+	map->trace_patch_nodes	= NULL;
+	map->trace_leaf_patches = NULL;
+}
+
+// Evaluate the control grid at a fixed subdivision level
+void _bsp_trace_patch_tesselate(bsp_map_t *map, bsp_face_lump_t face, gs_vec3 *points, gs_vec3 *normals, uint32_t grid_width, uint32_t grid_height)
+{
+	uint32_t num_patches_x = (face.size[0] - 1) >> 1;
+	uint32_t num_patches_y = (face.size[1] - 1) >> 1;
+
+	for (size_t y = 0; y < grid_height; y++)
+	{
+		uint32_t patch_y = gs_min(y / BSP_TRACE_PATCH_SUBDIVISIONS, num_patches_y - 1);
+		float32_t v	 = (float32_t)(y - patch_y * BSP_TRACE_PATCH_SUBDIVISIONS) / BSP_TRACE_PATCH_SUBDIVISIONS;
+		float32_t bv[3]	 = {(1.0f - v) * (1.0f - v), 2.0f * v * (1.0f - v), v * v};
+
+		for (size_t x = 0; x < grid_width; x++)
+		{
+			uint32_t patch_x = gs_min(x / BSP_TRACE_PATCH_SUBDIVISIONS, num_patches_x - 1);
+			float32_t u	 = (float32_t)(x - patch_x * BSP_TRACE_PATCH_SUBDIVISIONS) / BSP_TRACE_PATCH_SUBDIVISIONS;
+			float32_t bu[3]	 = {(1.0f - u) * (1.0f - u), 2.0f * u * (1.0f - u), u * u};
+
+			gs_vec3 point  = gs_v3(0, 0, 0);
+			gs_vec3 normal = gs_v3(0, 0, 0);
+			for (size_t row = 0; row < 3; row++)
+			{
+				for (size_t col = 0; col < 3; col++)
+				{
+					uint32_t index	     = face.first_vertex + (2 * patch_y + row) * face.size[0] + 2 * patch_x + col;
+					bsp_vert_lump_t vert = map->vertices.data[index];
+					point		     = gs_vec3_add(point, gs_vec3_scale(vert.position, bv[row] * bu[col]));
+					normal		     = gs_vec3_add(normal, gs_vec3_scale(vert.normal, bv[row] * bu[col]));
+				}
+			}
+
+			points[y * grid_width + x]  = point;
+			normals[y * grid_width + x] = normal;
+		}
+	}
+}
+
+// Triangle as a thin brush facing up, degenerate ones are dropped
+void _bsp_trace_patch_add_facet(bsp_trace_facet_t **facets, gs_vec3 a, gs_vec3 b, gs_vec3 c, gs_vec3 up, int32_t texture, int32_t contents)
+{
+	gs_vec3 normal = gs_vec3_cross(gs_vec3_sub(b, a), gs_vec3_sub(c, a));
+	float32_t len  = gs_vec3_len(normal);
+	if (len < 0.001f)
+	{
+		return;
+	}
+	normal = gs_vec3_scale(normal, 1.0f / len);
+
+	if (gs_vec3_dot(normal, up) < 0)
+	{
+		// Wind so the normal points out of the visible side
+		gs_vec3 temp = b;
+		b	     = c;
+		c	     = temp;
+		normal	     = gs_vec3_scale(normal, -1.0f);
+	}
+
+	bsp_trace_facet_t facet = {
+		.texture  = texture,
+		.contents = contents,
+		.center	  = gs_vec3_scale(gs_vec3_add(a, gs_vec3_add(b, c)), 1.0f / 3.0f),
+	};
+
+	float32_t dist			  = gs_vec3_dot(normal, a);
+	facet.planes[facet.num_planes++] = (bsp_plane_lump_t){.normal = normal, .dist = dist};
+	facet.planes[facet.num_planes++] = (bsp_plane_lump_t){.normal = gs_vec3_scale(normal, -1.0f), .dist = -(dist - BSP_TRACE_PATCH_THICKNESS)};
+
+	// Edges, pointing away from the triangle
+	gs_vec3 verts[3] = {a, b, c};
+	for (size_t i = 0; i < 3; i++)
+	{
+		gs_vec3 edge_normal = gs_vec3_cross(gs_vec3_sub(verts[(i + 1) % 3], verts[i]), normal);
+		float32_t edge_len  = gs_vec3_len(edge_normal);
+		if (edge_len < 0.001f)
+		{
+			continue;
+		}
+		edge_normal			 = gs_vec3_scale(edge_normal, 1.0f / edge_len);
+		facet.planes[facet.num_planes++] = (bsp_plane_lump_t){.normal = edge_normal, .dist = gs_vec3_dot(edge_normal, verts[i])};
+	}
+
+	// Bounds including thickness, axial bevels keep boxes from catching on edges
+	gs_vec3 back = gs_vec3_scale(normal, -BSP_TRACE_PATCH_THICKNESS);
+	facet.mins   = a;
+	facet.maxs   = a;
+	for (size_t i = 0; i < 3; i++)
+	{
+		facet.mins = _bsp_vec3_min(facet.mins, _bsp_vec3_min(verts[i], gs_vec3_add(verts[i], back)));
+		facet.maxs = _bsp_vec3_max(facet.maxs, _bsp_vec3_max(verts[i], gs_vec3_add(verts[i], back)));
+	}
+
+	for (size_t i = 0; i < 3; i++)
+	{
+		gs_vec3 axis = gs_v3(0, 0, 0);
+		axis.xyz[i]  = 1.0f;
+
+		facet.planes[facet.num_planes++] = (bsp_plane_lump_t){.normal = axis, .dist = facet.maxs.xyz[i]};
+		facet.planes[facet.num_planes++] = (bsp_plane_lump_t){.normal = gs_vec3_scale(axis, -1.0f), .dist = -facet.mins.xyz[i]};
+	}
+
+	// Edge bevels like cm_patch, planes along each edge facing the axes
+	// keep boxes from snagging on or slipping past sharp edges.
+	gs_vec3 corners[6];
+	for (size_t i = 0; i < 3; i++)
+	{
+		corners[i]     = verts[i];
+		corners[i + 3] = gs_vec3_add(verts[i], back);
+	}
+
+	for (size_t i = 0; i < 3; i++)
+	{
+		gs_vec3 edge	   = gs_vec3_sub(verts[(i + 1) % 3], verts[i]);
+		float32_t edge_len = gs_vec3_len(edge);
+		if (edge_len < 0.001f)
+		{
+			continue;
+		}
+		edge = gs_vec3_scale(edge, 1.0f / edge_len);
+
+		for (size_t j = 0; j < 6; j++)
+		{
+			gs_vec3 axis	= gs_v3(0, 0, 0);
+			axis.xyz[j % 3] = j < 3 ? 1.0f : -1.0f;
+
+			// Edge along the axis, covered by the axial bevels
+			gs_vec3 bevel	    = gs_vec3_cross(edge, axis);
+			float32_t bevel_len = gs_vec3_len(bevel);
+			if (bevel_len < 0.001f)
+			{
+				continue;
+			}
+			bevel = gs_vec3_scale(bevel, 1.0f / bevel_len);
+
+			if (_bsp_trace_facet_has_plane(&facet, bevel))
+			{
+				continue;
+			}
+
+			// Touch the facet without cutting into it
+			float32_t dist = gs_vec3_dot(bevel, corners[0]);
+			for (size_t k = 1; k < 6; k++)
+			{
+				dist = gs_max(dist, gs_vec3_dot(bevel, corners[k]));
+			}
+
+			facet.planes[facet.num_planes++] = (bsp_plane_lump_t){.normal = bevel, .dist = dist};
+		}
+	}
+
+	gs_dyn_array_push(*facets, facet);
+}
+
+static int _bsp_trace_facet_sort_compare(const void *a, const void *b)
+{
+	const bsp_trace_facet_sort_t *item_a = a;
+	const bsp_trace_facet_sort_t *item_b = b;
+	if (item_a->center != item_b->center)
+	{
+		return (item_a->center > item_b->center) - (item_a->center < item_b->center);
+	}
+	return (item_a->facet > item_b->facet) - (item_a->facet < item_b->facet);
+}
+
+// Split facets at the median along the longest axis until few
+// enough are left. Only order is sorted, facets are moved to
+// match it after the whole hierarchy is built.
+void _bsp_trace_patch_build_nodes(bsp_map_t *map, const bsp_trace_facet_t *facets, bsp_trace_facet_sort_t *order, uint32_t first, uint32_t count, uint32_t first_brush)
+{
+	bsp_trace_patch_node_t node = {
+		.mins	     = facets[order[first].facet].mins,
+		.maxs	     = facets[order[first].facet].maxs,
+		.first_brush = first_brush + first,
+	};
+	for (size_t i = first + 1; i < first + count; i++)
+	{
+		node.mins = _bsp_vec3_min(node.mins, facets[order[i].facet].mins);
+		node.maxs = _bsp_vec3_max(node.maxs, facets[order[i].facet].maxs);
+	}
+
+	uint32_t index = gs_dyn_array_size(map->trace_patch_nodes);
+	if (count <= BSP_TRACE_PATCH_LEAF_FACETS)
+	{
+		node.num_brushes = count;
+		node.skip	 = index + 1;
+		gs_dyn_array_push(map->trace_patch_nodes, node);
+		return;
+	}
+
+	gs_dyn_array_push(map->trace_patch_nodes, node);
+
+	gs_vec3 size = gs_vec3_sub(node.maxs, node.mins);
+	uint32_t axis = 0;
+	if (size.y > size.xyz[axis]) axis = 1;
+	if (size.z > size.xyz[axis]) axis = 2;
+
+	for (size_t i = first; i < first + count; i++)
+	{
+		order[i].center = facets[order[i].facet].center.xyz[axis];
+	}
+	qsort(order + first, count, sizeof(bsp_trace_facet_sort_t), _bsp_trace_facet_sort_compare);
+
+	uint32_t half = count / 2;
+	_bsp_trace_patch_build_nodes(map, facets, order, first, half, first_brush);
+	_bsp_trace_patch_build_nodes(map, facets, order, first + half, count - half, first_brush);
+
+	map->trace_patch_nodes[index].skip = gs_dyn_array_size(map->trace_patch_nodes);
+}
\ No newline at end of file
@@ -0,0 +1,53 @@
+/*================================================================
+	* bsp/bsp_trace_patch.h
+	*
+	* Copyright (c) 2021 Lauri Räsänen
+	* ================================
+
+	Collision facets for curved patches.
+=================================================================*/
+
+#ifndef BSP_TRACE_PATCH_H
+#define BSP_TRACE_PATCH_H
+
+#include <gs/gs.h>
+
+#include "bsp_types.h"
+
+// Collision subdivisions per quadratic patch side,
+// independent of the rendered level of detail.
+#define BSP_TRACE_PATCH_SUBDIVISIONS 4
+// How far facets reach behind the curve
+#define BSP_TRACE_PATCH_THICKNESS 1.0f
+// Facets per bounding hierarchy leaf
+#define BSP_TRACE_PATCH_LEAF_FACETS 4
+// Front, back, 3 edges, 6 axial bevels and up to 18 edge bevels
+#define BSP_TRACE_FACET_PLANES 29
+
+// One triangle of a patch as a thin brush, only used while loading
+typedef struct bsp_trace_facet_t
+{
+	bsp_plane_lump_t planes[BSP_TRACE_FACET_PLANES];
+	uint32_t num_planes;
+	int32_t texture;
+	int32_t contents;
+	gs_vec3 mins;
+	gs_vec3 maxs;
+	gs_vec3 center;
+} bsp_trace_facet_t;
+
+// Facet and its center on the split axis, sorted instead of whole facets
+typedef struct bsp_trace_facet_sort_t
+{
+	uint32_t facet;
+	float32_t center;
+} bsp_trace_facet_sort_t;
+
+gs_dyn_array(bsp_trace_facet_t) bsp_trace_patches_init(bsp_map_t *map, uint32_t first_brush);
+void bsp_trace_patches_link_leaves(bsp_map_t *map);
+void bsp_trace_patches_free(bsp_map_t *map);
+void _bsp_trace_patch_tesselate(bsp_map_t *map, bsp_face_lump_t face, gs_vec3 *points, gs_vec3 *normals, uint32_t grid_width, uint32_t grid_height);
+void _bsp_trace_patch_add_facet(bsp_trace_facet_t **facets, gs_vec3 a, gs_vec3 b, gs_vec3 c, gs_vec3 up, int32_t texture, int32_t contents);
+void _bsp_trace_patch_build_nodes(bsp_map_t *map, const bsp_trace_facet_t *facets, bsp_trace_facet_sort_t *order, uint32_t first, uint32_t count, uint32_t first_brush);
+
+#endif // BSP_TRACE_PATCH_H
\ No newline at end of file
@@ -15,6 +15,24 @@
 
 #include <gs/gs.h>
 
+#define BSP_LIGHTMAP_SIZE	   128
+#define BSP_LIGHTMAP_ATLAS_SIZE	   1024
+// Border texels around lightmaps in the atlas to avoid bleeding
+#define BSP_LIGHTMAP_ATLAS_PADDING 1
+// Overbright and gamma baked into the atlas,
+// stored divided by range to fit in 8 bits.
+#define BSP_LIGHTMAP_STRENGTH	   2.8f
+#define BSP_LIGHTMAP_GAMMA	   1.15f
+#define BSP_LIGHTMAP_RANGE	   2.5f
+
+// Max distance between tesselated and true patch surface at LOD 0
+#define BSP_PATCH_TOLERANCE	   1.0f
+#define BSP_PATCH_MAX_TESSELATION  16
+// Each LOD halves patch tesselation on both axes
+#define BSP_PATCH_LOD_COUNT	   3
+// Camera distance of the first LOD switch, doubles for each LOD
+#define BSP_PATCH_LOD_DISTANCE	   768.0f
+
 /*========
 // ENUMS
 =========*/
@@ -30,8 +48,33 @@ typedef enum bsp_content
 	BSP_CONTENT_CONTENTS_MONSTER	 = 128,
 	BSP_CONTENT_CONTENTS_PLAYERCLIP	 = 256,
 	BSP_CONTENT_CONTENTS_MONSTERCLIP = 512,
+	BSP_CONTENT_CONTENTS_TRANSLUCENT = 0x20000000,
 } bsp_content;
 
+// Texture surface flags, see q3 surfaceflags.h
+typedef enum bsp_surface_flags
+{
+	BSP_SURFACE_NODAMAGE	= 0x1,
+	BSP_SURFACE_SLICK	= 0x2,
+	BSP_SURFACE_SKY		= 0x4,
+	BSP_SURFACE_LADDER	= 0x8,
+	BSP_SURFACE_NOIMPACT	= 0x10,
+	BSP_SURFACE_NOMARKS	= 0x20,
+	BSP_SURFACE_FLESH	= 0x40,
+	BSP_SURFACE_NODRAW	= 0x80,
+	BSP_SURFACE_HINT	= 0x100,
+	BSP_SURFACE_SKIP	= 0x200,
+	BSP_SURFACE_NOLIGHTMAP	= 0x400,
+	BSP_SURFACE_POINTLIGHT	= 0x800,
+	BSP_SURFACE_METALSTEPS	= 0x1000,
+	BSP_SURFACE_NOSTEPS	= 0x2000,
+	BSP_SURFACE_NONSOLID	= 0x4000,
+	BSP_SURFACE_LIGHTFILTER = 0x8000,
+	BSP_SURFACE_ALPHASHADOW = 0x10000,
+	BSP_SURFACE_NODLIGHT	= 0x20000,
+	BSP_SURFACE_DUST	= 0x40000,
+} bsp_surface_flags;
+
 typedef enum bsp_face_type
 {
 	BSP_FACE_TYPE_POLYGON = 1,
@@ -41,6 +84,17 @@ typedef enum bsp_face_type
 	BSP_FACE_TYPE_COUNT
 } bsp_face_type;
 
+// How a surface is drawn, from texture flags and contents
+typedef enum bsp_surface_class
+{
+	BSP_SURFACE_CLASS_OPAQUE = 0,
+	BSP_SURFACE_CLASS_ALPHA_TESTED,
+	BSP_SURFACE_CLASS_TRANSLUCENT,
+	BSP_SURFACE_CLASS_SKY,
+	BSP_SURFACE_CLASS_NODRAW,
+	BSP_SURFACE_CLASS_COUNT
+} bsp_surface_class;
+
 typedef enum bsp_render_flags
 {
 	SHOW_WIREFRAME	 = 1 << 0,
@@ -86,16 +140,31 @@ typedef struct bsp_stats_t
 	uint32_t total_faces;
 	uint32_t total_patches;
 	uint32_t culled_leaves_pvs;
+	uint32_t culled_leaves_area;
 	uint32_t culled_leaves_frustum;
+	uint32_t culled_leaves_occlusion;
+	uint32_t culled_nodes_frustum;
+	uint32_t tested_leaves_frustum;
+	uint32_t culled_faces_backface;
+	uint32_t skipped_faces_nodraw;
+	uint32_t culled_faces_occlusion;
+	uint32_t culled_renderables_occlusion;
+	uint32_t drawn_occluders;
 	uint32_t visible_leaves;
 	uint32_t visible_vertices;
 	uint32_t visible_indices;
 	uint32_t visible_faces;
 	uint32_t visible_patches;
+	uint32_t visible_batches;
+	uint32_t total_materials;
 	uint32_t total_textures;
 	uint32_t loaded_textures;
 	uint32_t models;
+	uint32_t visible_models;
+	uint32_t culled_models;
 	int32_t current_leaf;
+	float32_t acmr_before;
+	float32_t acmr_after;
 } bsp_stats_t;
 
 typedef struct bsp_face_renderable_t
@@ -104,9 +173,206 @@ typedef struct bsp_face_renderable_t
 	int32_t index;
 	uint32_t first_ibo_index;
 	uint32_t num_ibo_indices;
+	uint32_t material;
+	bsp_surface_class surface_class;
+	// Plane of polygon faces for backface culling
+	gs_vec3 normal;
+	float32_t dist;
+	// Bounds for occlusion tests
+	gs_vec3 mins;
+	gs_vec3 maxs;
+	bool two_sided;
 	bool visible;
+	bool in_pvs;
 } bsp_face_renderable_t;
 
+// Unique texture and lightmap atlas page pair, texture is -1 if missing
+typedef struct bsp_material_t
+{
+	int32_t texture;
+	int32_t lightmap;
+	bsp_surface_class surface_class;
+} bsp_material_t;
+
+typedef struct bsp_draw_batch_t
+{
+	// Index to submodels, -1 for world faces
+	int32_t model;
+	uint32_t material;
+	uint32_t first_index;
+	uint32_t num_indices;
+} bsp_draw_batch_t;
+
+// Visible translucent face of any model, sorted back to front
+typedef struct bsp_translucent_face_t
+{
+	// Index to submodels, -1 for world faces
+	int32_t model;
+	int32_t face;
+	// Squared view distance to the world space center of the face
+	float32_t distance;
+} bsp_translucent_face_t;
+
+typedef struct bsp_vis_node_t
+{
+	int32_t index;
+	uint8_t plane_mask;
+} bsp_vis_node_t;
+
+typedef struct bsp_vis_leaf_t
+{
+	int32_t index;
+	// Index to frustum test results, -1 if inside a fully visible node
+	int32_t test_index;
+} bsp_vis_leaf_t;
+
+// Bounding boxes as structure of arrays for SIMD culling
+typedef struct bsp_bounds_soa_t
+{
+	uint32_t count;
+	float32_t *min_x;
+	float32_t *min_y;
+	float32_t *min_z;
+	float32_t *max_x;
+	float32_t *max_y;
+	float32_t *max_z;
+} bsp_bounds_soa_t;
+
+// Spawnflag of func_door, spawns at its open position
+#define BSP_DOOR_START_OPEN	1
+// How far a door can be from its compiled position and still count as closed
+#define BSP_DOOR_CLOSED_EPSILON 0.5f
+
+// Door brush model between two areas.
+// Areas only see each other through open portals.
+typedef struct bsp_area_portal_t
+{
+	int32_t model;
+	int32_t areas[2];
+	bool32_t open;
+} bsp_area_portal_t;
+
+// Brush model other than the world, such as a door or a platform.
+// Faces are stored in world space, transform moves them from there.
+typedef struct bsp_submodel_t
+{
+	int32_t model;
+	gs_mat4 transform;
+	gs_mat4 inverse;
+	// World space bounds and the leaves they touch
+	gs_vec3 mins;
+	gs_vec3 maxs;
+	gs_dyn_array(int32_t) leaves;
+	// Range in bsp_map_t.visible_model_faces
+	uint32_t first_visible_face;
+	uint32_t num_visible_faces;
+	bool32_t visible;
+} bsp_submodel_t;
+
+// Plane types of trace nodes, axial planes skip the dot product
+typedef enum bsp_plane_type
+{
+	BSP_PLANE_X = 0,
+	BSP_PLANE_Y,
+	BSP_PLANE_Z,
+	BSP_PLANE_NON_AXIAL,
+} bsp_plane_type;
+
+// Node with its plane inline for trace traversal
+typedef struct bsp_trace_node_t
+{
+	gs_vec3 normal;
+	float32_t dist;
+	int32_t children[2];
+	int32_t type;
+} bsp_trace_node_t;
+
+typedef struct bsp_trace_leaf_t
+{
+	int32_t first_leaf_brush;
+	int32_t num_leaf_brushes;
+	uint32_t first_leaf_patch;
+	uint32_t num_leaf_patches;
+} bsp_trace_leaf_t;
+
+// Collision for a curved patch, facets are thin trace brushes
+// found through a bounding hierarchy of trace_patch_nodes.
+typedef struct bsp_trace_patch_t
+{
+	gs_vec3 mins;
+	gs_vec3 maxs;
+	int32_t face;
+	int32_t contents;
+	uint32_t first_node;
+	uint32_t num_nodes;
+} bsp_trace_patch_t;
+
+// Depth first, skip is the next node if bounds are missed.
+// Leaf nodes have num_brushes > 0.
+typedef struct bsp_trace_patch_node_t
+{
+	gs_vec3 mins;
+	gs_vec3 maxs;
+	uint32_t first_brush;
+	uint32_t num_brushes;
+	uint32_t skip;
+} bsp_trace_patch_node_t;
+
+// Brush with load time bounds, sides are in bsp_trace_sides_t
+typedef struct bsp_trace_brush_t
+{
+	gs_vec3 mins;
+	gs_vec3 maxs;
+	uint32_t first_side;
+	// Padded to a multiple of 4
+	uint32_t num_sides;
+	int32_t contents;
+} bsp_trace_brush_t;
+
+// Brush side planes as SoA for SIMD
+typedef struct bsp_trace_sides_t
+{
+	uint32_t count;
+	float32_t *normal_x;
+	float32_t *normal_y;
+	float32_t *normal_z;
+	float32_t *dist;
+	// Bit per axis if the normal is negative
+	uint8_t *signbits;
+	int32_t *texture;
+} bsp_trace_sides_t;
+
+// Large planar face rasterized into the occlusion buffer
+typedef struct bsp_occluder_t
+{
+	int32_t face;
+	// Triangle list in bsp_occlusion_t.vertices
+	uint32_t first_vertex;
+	uint32_t num_vertices;
+	float32_t area;
+} bsp_occluder_t;
+
+typedef struct bsp_occluder_candidate_t
+{
+	uint32_t occluder;
+	float32_t score;
+} bsp_occluder_candidate_t;
+
+// Low resolution software depth buffer for occlusion culling.
+// Stores inverse view depth, 0 is empty and larger is closer.
+typedef struct bsp_occlusion_t
+{
+	float32_t *depth;
+	// Farthest depth of each tile
+	float32_t *hiz;
+	gs_mat4 view_projection;
+	gs_dyn_array(bsp_occluder_t) occluders;
+	gs_dyn_array(gs_vec3) vertices;
+	gs_dyn_array(bsp_occluder_candidate_t) candidates;
+	// Rendered this frame, safe to test against
+	bool32_t rendered;
+} bsp_occlusion_t;
+
 /*
 typedef struct bsp_leaf_renderable_t
 {
@@ -204,6 +470,19 @@ typedef struct bsp_vert_lump_t
 	gs_color_t color;
 } bsp_vert_lump_t;
 
+// Packed rendering vertex, 24 bytes instead of 44.
+// Position stays float, world coordinates need the precision.
+typedef struct bsp_packed_vert_t
+{
+	gs_vec3 position;
+	// half2, rebased per face
+	uint32_t tex_coord;
+	// unorm16x2
+	uint32_t lm_coord;
+	// octahedral snorm16x2
+	uint32_t normal;
+} bsp_packed_vert_t;
+
 typedef struct bsp_index_lump_t
 {
 	int32_t offset;
@@ -259,10 +538,19 @@ typedef struct bsp_visdata_lump_t
 
 typedef struct bsp_quadratic_patch_t
 {
-	int32_t tesselation;
+	// Subdivisions along control point columns and rows, powers of two
+	int32_t tesselation_u;
+	int32_t tesselation_v;
 	bsp_vert_lump_t control_points[9];
+	gs_vec3 mins;
+	gs_vec3 maxs;
 	gs_dyn_array(bsp_vert_lump_t) vertices;
+	// Indices of all LODs, LOD n is lod_offsets[n] to lod_offsets[n + 1]
 	gs_dyn_array(uint16_t) indices;
+	uint32_t lod_offsets[BSP_PATCH_LOD_COUNT + 1];
+	// Start of each LOD in the map index buffer
+	uint32_t lod_first_index[BSP_PATCH_LOD_COUNT];
+	bool visible;
 } bsp_quadratic_patch_t;
 
 typedef struct bsp_patch_t
@@ -271,6 +559,12 @@ typedef struct bsp_patch_t
 	int32_t lightmap_idx;
 	int32_t width;
 	int32_t height;
+	gs_vec3 mins;
+	gs_vec3 maxs;
+	int32_t lod;
+	// Range of all LODs in the map index buffer
+	uint32_t first_index;
+	uint32_t num_indices;
 	gs_dyn_array(bsp_quadratic_patch_t) quadratic_patches;
 } bsp_patch_t;
 
@@ -406,23 +700,90 @@ typedef struct bsp_map_t
 		gs_handle(gs_graphics_texture_t) * data;
 	} lightmap_textures;
 
+	// Atlas page of each lightmap, last entry is a flat lightmap
+	// used for faces without one.
+	int32_t *lightmap_pages;
+
 	gs_handle(gs_graphics_texture_t) missing_texture;
-	gs_handle(gs_graphics_texture_t) missing_lm_texture;
 
 	int32_t previous_leaf;
 
+	// Potentially visible set of the current view cluster,
+	// only rebuilt when the camera moves to another cluster.
+	int32_t pvs_cluster;
+	gs_dyn_array(int32_t) pvs_leaves;
+	gs_dyn_array(int32_t) pvs_faces;
+
+	// Areas reachable from the camera area through open portals,
+	// flooded again when either changes. Unreachable leaves are left out of the PVS.
+	int32_t num_areas;
+	int32_t camera_area;
+	bool32_t area_portals_changed;
+	uint8_t *area_visible;
+	int32_t *area_stack;
+	gs_dyn_array(bsp_area_portal_t) area_portals;
+
+	// Number of PVS leaves under each node, nodes without any are skipped.
+	gs_dyn_array(uint32_t) node_pvs_leaves;
+	gs_dyn_array(int32_t) node_parents;
+	gs_dyn_array(int32_t) leaf_parents;
+	gs_dyn_array(bsp_vis_node_t) vis_stack;
+
+	// Leaves reached by the node walk in front to back order,
+	// partially visible ones are gathered for a batched frustum test.
+	bsp_bounds_soa_t leaf_bounds;
+	bsp_bounds_soa_t vis_test_bounds;
+	uint8_t *vis_test_results;
+	gs_dyn_array(bsp_vis_leaf_t) vis_leaves;
+
+	// Collision data, see bsp_trace_init
+	bsp_trace_node_t *trace_nodes;
+	bsp_trace_leaf_t *trace_leaves;
+	bsp_trace_brush_t *trace_brushes;
+	uint32_t num_trace_brushes;
+	bsp_trace_sides_t trace_sides;
+	gs_dyn_array(bsp_trace_patch_t) trace_patches;
+	gs_dyn_array(bsp_trace_patch_node_t) trace_patch_nodes;
+	gs_dyn_array(uint32_t) trace_leaf_patches;
+	uint32_t trace_serial;
+
+	// Occluders rendered after frustum culling,
+	// leaves and faces behind them are skipped.
+	bsp_occlusion_t occlusion;
+
+	// Visible faces in front to back order,
+	// regrouped by material into batches every frame.
+	gs_dyn_array(int32_t) visible_faces;
+	gs_dyn_array(bsp_material_t) materials;
+	gs_dyn_array(uint32_t) material_indices;
+	gs_dyn_array(bsp_draw_batch_t) draw_batches;
+	// Materials in order of first visible face this frame
+	gs_dyn_array(uint32_t) material_order;
+	// Translucent faces of the world and submodels in one draw order
+	gs_dyn_array(bsp_translucent_face_t) translucent_faces;
+
+	// models[1..], culled as a whole and batched per model
+	gs_dyn_array(bsp_submodel_t) submodels;
+	gs_dyn_array(int32_t) visible_model_faces;
+
 	gs_dyn_array(bsp_entity_t) entities;
 
 	gs_handle(gs_graphics_vertex_buffer_t) bsp_graphics_vbo;
 	gs_handle(gs_graphics_index_buffer_t) bsp_graphics_ibo;
 	gs_handle(gs_graphics_pipeline_t) bsp_graphics_pipe;
+	gs_handle(gs_graphics_pipeline_t) bsp_graphics_alpha_test_pipe;
+	gs_handle(gs_graphics_pipeline_t) bsp_graphics_translucent_pipe;
 	gs_handle(gs_graphics_pipeline_t) bsp_graphics_wire_pipe;
 	gs_handle(gs_graphics_uniform_t) bsp_graphics_u_proj;
+	gs_handle(gs_graphics_uniform_t) bsp_graphics_u_model;
 	gs_handle(gs_graphics_uniform_t) bsp_graphics_u_tex;
 	gs_handle(gs_graphics_uniform_t) bsp_graphics_u_lm;
 	gs_handle(gs_graphics_uniform_t) bsp_graphics_u_color;
 	gs_dyn_array(uint32_t) bsp_graphics_index_arr;
 	gs_dyn_array(bsp_vert_lump_t) bsp_graphics_vert_arr;
+	bool32_t packed_vertices;
+	gs_handle(gs_graphics_index_buffer_t) bsp_graphics_draw_ibo;
+	gs_dyn_array(uint32_t) bsp_graphics_draw_index_arr;
 } bsp_map_t;
 
 #endif // BSP_TYPES_H
\ No newline at end of file
@@ -14,12 +14,15 @@
 #include <gs/gs.h>
 
 #include "../bsp/bsp_trace.h"
+#include "../game/console.h"
 #include "../game/game_manager.h"
 #include "../graphics/renderer.h"
 
 typedef struct mg_entity_t
 {
 	uint32_t id;
+	// Proxy in the entity manager grid
+	uint32_t grid_id;
 	gs_vqs transform;
 	gs_vec3 velocity;
 	gs_vec3 mins;
@@ -112,17 +115,36 @@ static inline bool mg_ent_slidemove(
 	const float max_step_height,
 	const bool grounded,
 	const int32_t content_mask,
-	const float delta_time)
+	const float delta_time,
+	const bsp_trace_caller caller)
 {
 	uint16_t current_iter = 0;
 	uint16_t max_iter     = 10;
 	gs_vec3 start;
 	gs_vec3 end;
-	bsp_trace_t trace = {.map = g_game_manager->map};
+	bsp_trace_t trace = {.map = g_game_manager->map, .caller = caller};
 	float32_t prev_frac;
 	gs_vec3 prev_normal;
 	float dt = delta_time;
 
+	// Standing still, don't pay for the cache
+	if (gs_vec3_len2(*velocity) == 0)
+	{
+		return true;
+	}
+
+	// Gather brushes within reach this tick once, sub-traces use them
+	// instead of walking the tree. Anything reaching further falls back.
+	bsp_trace_cache_t cache;
+	float reach = gs_vec3_len(*velocity) * delta_time + max_step_height + BSP_TRACE_EPSILON * 2.0f + 1.0f;
+	bsp_trace_cache_build(
+		&cache,
+		trace.map,
+		gs_vec3_add(gs_vec3_add(transform->position, mins), gs_v3(-reach, -reach, -reach)),
+		gs_vec3_add(gs_vec3_add(transform->position, maxs), gs_v3(reach, reach, reach)),
+		content_mask);
+	trace.cache = &cache;
+
 	while (dt > 0)
 	{
 		if (gs_vec3_len2(*velocity) == 0)
@@ -288,4 +310,52 @@ static inline bool mg_ent_slidemove(
 	return true;
 }
 
+/**
+ * Remember the brush model stood on for mg_ent_ride_mover, 0 if none.
+ */
+static inline void mg_ent_set_ground_model(int32_t *ground_model, gs_mat4 *ground_transform, const int32_t model)
+{
+	bsp_map_t *map = g_game_manager->map;
+	int32_t mover  = model > 0 && model <= gs_dyn_array_size(map->submodels) ? model : 0;
+	if (mover == *ground_model) return;
+
+	*ground_model = mover;
+	if (mover > 0)
+	{
+		*ground_transform = map->submodels[mover - 1].transform;
+	}
+}
+
+/**
+ * Carry entity along with the brush model it stands on
+ * by how much the model moved since the last call.
+ */
+static inline void mg_ent_ride_mover(
+	gs_vqs *transform,
+	int32_t *ground_model,
+	gs_mat4 *ground_transform,
+	const gs_vec3 mins,
+	const gs_vec3 maxs,
+	const int32_t content_mask,
+	const bsp_trace_caller caller)
+{
+	bsp_map_t *map = g_game_manager->map;
+	if (*ground_model <= 0 || *ground_model > gs_dyn_array_size(map->submodels)) return;
+
+	gs_mat4 model_transform = map->submodels[*ground_model - 1].transform;
+	gs_mat4 delta		= gs_mat4_mul(model_transform, gs_mat4_inverse(*ground_transform));
+	*ground_transform	= model_transform;
+
+	gs_vec3 start  = transform->position;
+	gs_vec4 moved  = gs_mat4_mul_vec4(delta, gs_v4(start.x, start.y, start.z, 1.0f));
+	gs_vec3 target = gs_v3(moved.x, moved.y, moved.z);
+	if (gs_vec3_len2(gs_vec3_sub(target, start)) < GS_EPSILON) return;
+
+	// Don't get carried into walls. Starting inside the mover
+	// means it moved up into us, stay on top of it.
+	bsp_trace_t trace = {.map = map, .caller = caller};
+	bsp_trace_box(&trace, start, target, mins, maxs, content_mask);
+	transform->position = trace.start_solid ? target : trace.end;
+}
+
 #endif // MG_ENTITY_H
\ No newline at end of file
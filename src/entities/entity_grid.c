@@ -0,0 +1,480 @@
+/*================================================================
+	* entities/entity_grid.c
+	*
+	* Copyright (c) 2022 Lauri Räsänen
+	* ================================
+
+	Spatial hash of entity bounds. Proxies are linked to every
+	cell their bounds touch, queries stamp proxies so ones in
+	several cells are only reported once. Large proxies are
+	kept in a single list instead of filling many cells.
+=================================================================*/
+
+#include <float.h>
+
+#include "entity_grid.h"
+
+void mg_entity_grid_init(mg_entity_grid_t *grid)
+{
+	*grid = (mg_entity_grid_t){
+		.proxies  = gs_dyn_array_new(mg_entity_grid_proxy_t),
+		.free_ids = gs_dyn_array_new(uint32_t),
+		.large	  = gs_dyn_array_new(uint32_t),
+	};
+}
+
+void mg_entity_grid_free(mg_entity_grid_t *grid)
+{
+	for (size_t i = 0; i < MG_ENTITY_GRID_BUCKETS; i++)
+	{
+		gs_dyn_array_free(grid->buckets[i]);
+	}
+	gs_dyn_array_free(grid->proxies);
+	gs_dyn_array_free(grid->free_ids);
+	gs_dyn_array_free(grid->large);
+	*grid = (mg_entity_grid_t){0};
+}
+
+uint32_t mg_entity_grid_insert(mg_entity_grid_t *grid, mg_entity_grid_type type, void *owner, gs_vec3 mins, gs_vec3 maxs)
+{
+	mg_entity_grid_proxy_t proxy = {
+		.mins  = mins,
+		.maxs  = maxs,
+		.type  = type,
+		.owner = owner,
+		.used  = true,
+	};
+
+	uint32_t id;
+	if (gs_dyn_array_size(grid->free_ids) > 0)
+	{
+		id = gs_dyn_array_back(grid->free_ids);
+		gs_dyn_array_pop(grid->free_ids);
+		grid->proxies[id] = proxy;
+	}
+	else
+	{
+		id = gs_dyn_array_size(grid->proxies);
+		gs_dyn_array_push(grid->proxies, proxy);
+	}
+
+	_mg_entity_grid_link(grid, id, &grid->proxies[id]);
+	return id;
+}
+
+// Cheap when the proxy stays in the same cells
+void mg_entity_grid_move(mg_entity_grid_t *grid, uint32_t id, gs_vec3 mins, gs_vec3 maxs)
+{
+	mg_entity_grid_proxy_t *proxy = mg_entity_grid_get(grid, id);
+	if (proxy == NULL) return;
+
+	proxy->mins = mins;
+	proxy->maxs = maxs;
+
+	int32_t cell_mins[3];
+	int32_t cell_maxs[3];
+	_mg_entity_grid_cells(mins, maxs, cell_mins, cell_maxs);
+	if (memcmp(cell_mins, proxy->cell_mins, sizeof(cell_mins)) == 0 && memcmp(cell_maxs, proxy->cell_maxs, sizeof(cell_maxs)) == 0)
+	{
+		return;
+	}
+
+	_mg_entity_grid_unlink(grid, id, proxy);
+	_mg_entity_grid_link(grid, id, proxy);
+}
+
+// Same as mg_entity_grid_move with bounds relative to origin
+void mg_entity_grid_move_origin(mg_entity_grid_t *grid, uint32_t id, gs_vec3 origin, gs_vec3 mins, gs_vec3 maxs)
+{
+	mg_entity_grid_move(grid, id, gs_vec3_add(origin, mins), gs_vec3_add(origin, maxs));
+}
+
+void mg_entity_grid_remove(mg_entity_grid_t *grid, uint32_t id)
+{
+	mg_entity_grid_proxy_t *proxy = mg_entity_grid_get(grid, id);
+	if (proxy == NULL) return;
+
+	_mg_entity_grid_unlink(grid, id, proxy);
+	proxy->used  = false;
+	proxy->owner = NULL;
+	gs_dyn_array_push(grid->free_ids, id);
+}
+
+// NULL if id isn't in use
+mg_entity_grid_proxy_t *mg_entity_grid_get(mg_entity_grid_t *grid, uint32_t id)
+{
+	if (id >= gs_dyn_array_size(grid->proxies) || !grid->proxies[id].used) return NULL;
+	return &grid->proxies[id];
+}
+
+// Replace results with ids of proxies overlapping the box
+void mg_entity_grid_query_box(mg_entity_grid_t *grid, gs_vec3 mins, gs_vec3 maxs, uint32_t type_mask, uint32_t **results)
+{
+	gs_dyn_array_clear(*results);
+	uint32_t stamp = _mg_entity_grid_next_stamp(grid);
+
+	int32_t cell_mins[3];
+	int32_t cell_maxs[3];
+	_mg_entity_grid_cells(mins, maxs, cell_mins, cell_maxs);
+	uint64_t num_cells = (uint64_t)(cell_maxs[0] - cell_mins[0] + 1) * (cell_maxs[1] - cell_mins[1] + 1) * (cell_maxs[2] - cell_mins[2] + 1);
+
+	// Going through every proxy is cheaper than a box this big
+	if (num_cells > gs_dyn_array_size(grid->proxies))
+	{
+		for (uint32_t id = 0; id < gs_dyn_array_size(grid->proxies); id++)
+		{
+			mg_entity_grid_proxy_t *proxy = &grid->proxies[id];
+			if (!proxy->used || (proxy->type & type_mask) == 0) continue;
+			if (proxy->mins.x > maxs.x || proxy->maxs.x < mins.x) continue;
+			if (proxy->mins.y > maxs.y || proxy->maxs.y < mins.y) continue;
+			if (proxy->mins.z > maxs.z || proxy->maxs.z < mins.z) continue;
+			gs_dyn_array_push(*results, id);
+		}
+		return;
+	}
+
+	for (int32_t x = cell_mins[0]; x <= cell_maxs[0]; x++)
+	{
+		for (int32_t y = cell_mins[1]; y <= cell_maxs[1]; y++)
+		{
+			for (int32_t z = cell_mins[2]; z <= cell_maxs[2]; z++)
+			{
+				uint32_t *bucket = grid->buckets[_mg_entity_grid_hash(x, y, z)];
+				for (size_t i = 0; i < gs_dyn_array_size(bucket); i++)
+				{
+					uint32_t id		      = bucket[i];
+					mg_entity_grid_proxy_t *proxy = &grid->proxies[id];
+					if (proxy->stamp == stamp) continue;
+					proxy->stamp = stamp;
+
+					if ((proxy->type & type_mask) == 0) continue;
+					if (proxy->mins.x > maxs.x || proxy->maxs.x < mins.x) continue;
+					if (proxy->mins.y > maxs.y || proxy->maxs.y < mins.y) continue;
+					if (proxy->mins.z > maxs.z || proxy->maxs.z < mins.z) continue;
+					gs_dyn_array_push(*results, id);
+				}
+			}
+		}
+	}
+
+	for (size_t i = 0; i < gs_dyn_array_size(grid->large); i++)
+	{
+		uint32_t id		      = grid->large[i];
+		mg_entity_grid_proxy_t *proxy = &grid->proxies[id];
+		if ((proxy->type & type_mask) == 0) continue;
+		if (proxy->mins.x > maxs.x || proxy->maxs.x < mins.x) continue;
+		if (proxy->mins.y > maxs.y || proxy->maxs.y < mins.y) continue;
+		if (proxy->mins.z > maxs.z || proxy->maxs.z < mins.z) continue;
+		gs_dyn_array_push(*results, id);
+	}
+}
+
+// Replace results with ids of proxies whose bounds touch the sphere
+void mg_entity_grid_query_sphere(mg_entity_grid_t *grid, gs_vec3 center, float32_t radius, uint32_t type_mask, uint32_t **results)
+{
+	gs_vec3 extents = gs_v3(radius, radius, radius);
+	mg_entity_grid_query_box(grid, gs_vec3_sub(center, extents), gs_vec3_add(center, extents), type_mask, results);
+
+	// Drop boxes that only touch the corners of the query box
+	float32_t radius_sq = radius * radius;
+	size_t count	    = 0;
+	for (size_t i = 0; i < gs_dyn_array_size(*results); i++)
+	{
+		mg_entity_grid_proxy_t *proxy = &grid->proxies[(*results)[i]];
+		gs_vec3 closest		      = gs_v3(
+			      gs_clamp(center.x, proxy->mins.x, proxy->maxs.x),
+			      gs_clamp(center.y, proxy->mins.y, proxy->maxs.y),
+			      gs_clamp(center.z, proxy->mins.z, proxy->maxs.z));
+		gs_vec3 delta = gs_vec3_sub(closest, center);
+		if (gs_vec3_dot(delta, delta) > radius_sq) continue;
+		(*results)[count++] = (*results)[i];
+	}
+	if (count < gs_dyn_array_size(*results))
+	{
+		gs_dyn_array_head(*results)->size = count;
+	}
+}
+
+// Sweep a box against proxies only, ignore is a proxy id or MG_ENTITY_GRID_NONE
+void mg_entity_grid_trace(mg_entity_grid_t *grid, mg_entity_trace_t *trace, gs_vec3 start, gs_vec3 end, gs_vec3 mins, gs_vec3 maxs, uint32_t type_mask, uint32_t ignore)
+{
+	trace->fraction	   = 1.0f;
+	trace->normal	   = gs_v3(0, 0, 0);
+	trace->start_solid = false;
+	trace->proxy	   = MG_ENTITY_GRID_NONE;
+	trace->type	   = 0;
+	trace->owner	   = NULL;
+
+	_mg_entity_grid_sweep(grid, trace, start, end, mins, maxs, type_mask, ignore);
+
+	trace->end = gs_vec3_add(start, gs_vec3_scale(gs_vec3_sub(end, start), trace->fraction));
+}
+
+// Nearest hit of the world and proxies
+void mg_entity_grid_trace_world(mg_entity_grid_t *grid, bsp_map_t *map, mg_entity_trace_t *trace, gs_vec3 start, gs_vec3 end, gs_vec3 mins, gs_vec3 maxs, int32_t content_mask, uint32_t type_mask, uint32_t ignore, bsp_trace_caller caller)
+{
+	trace->world = (bsp_trace_t){.map = map, .caller = caller};
+	bsp_trace_box(&trace->world, start, end, mins, maxs, content_mask);
+
+	trace->fraction	   = trace->world.fraction;
+	trace->normal	   = trace->world.normal;
+	trace->start_solid = trace->world.start_solid;
+	trace->proxy	   = MG_ENTITY_GRID_NONE;
+	trace->type	   = 0;
+	trace->owner	   = NULL;
+
+	// Only proxies in front of the world hit matter
+	_mg_entity_grid_sweep(grid, trace, start, end, mins, maxs, type_mask, ignore);
+
+	trace->end = gs_vec3_add(start, gs_vec3_scale(gs_vec3_sub(end, start), trace->fraction));
+}
+
+// Check the trace in pieces of about a cell each so long traces
+// only visit cells near the line instead of their whole bounding box.
+// A hit within a piece always comes from the cells of that piece,
+// so the first piece that ends past the nearest hit is the last one.
+void _mg_entity_grid_sweep(mg_entity_grid_t *grid, mg_entity_trace_t *trace, gs_vec3 start, gs_vec3 end, gs_vec3 mins, gs_vec3 maxs, uint32_t type_mask, uint32_t ignore)
+{
+	if (gs_dyn_array_size(grid->proxies) == gs_dyn_array_size(grid->free_ids)) return;
+
+	uint32_t stamp	   = _mg_entity_grid_next_stamp(grid);
+	gs_vec3 delta	   = gs_vec3_sub(end, start);
+	float32_t length   = gs_vec3_len(delta);
+	uint32_t pieces	   = gs_max(1, (uint32_t)ceilf(length / MG_ENTITY_GRID_CELL_SIZE));
+	float32_t piece_fr = 1.0f / pieces;
+	// Hits are pulled back by this much from where they enter
+	float32_t pullback = length > 0 ? BSP_TRACE_EPSILON / length : 0;
+
+	for (size_t i = 0; i < gs_dyn_array_size(grid->large); i++)
+	{
+		uint32_t id		      = grid->large[i];
+		mg_entity_grid_proxy_t *proxy = &grid->proxies[id];
+		if (id == ignore || (proxy->type & type_mask) == 0) continue;
+		_mg_entity_grid_trace_proxy(trace, id, proxy, start, end, mins, maxs);
+	}
+
+	for (uint32_t piece = 0; piece < pieces; piece++)
+	{
+		float32_t start_fr = piece * piece_fr;
+		float32_t end_fr   = piece == pieces - 1 ? 1.0f : start_fr + piece_fr;
+		if (start_fr - pullback >= trace->fraction) break;
+
+		gs_vec3 piece_start = gs_vec3_add(start, gs_vec3_scale(delta, start_fr));
+		gs_vec3 piece_end   = gs_vec3_add(start, gs_vec3_scale(delta, end_fr));
+		// Padded so proxies just touching the piece on a cell border aren't lost to rounding
+		gs_vec3 sweep_mins = gs_v3(
+			gs_min(piece_start.x, piece_end.x) + mins.x - 1.0f,
+			gs_min(piece_start.y, piece_end.y) + mins.y - 1.0f,
+			gs_min(piece_start.z, piece_end.z) + mins.z - 1.0f);
+		gs_vec3 sweep_maxs = gs_v3(
+			gs_max(piece_start.x, piece_end.x) + maxs.x + 1.0f,
+			gs_max(piece_start.y, piece_end.y) + maxs.y + 1.0f,
+			gs_max(piece_start.z, piece_end.z) + maxs.z + 1.0f);
+
+		int32_t cell_mins[3];
+		int32_t cell_maxs[3];
+		_mg_entity_grid_cells(sweep_mins, sweep_maxs, cell_mins, cell_maxs);
+
+		for (int32_t x = cell_mins[0]; x <= cell_maxs[0]; x++)
+		{
+			for (int32_t y = cell_mins[1]; y <= cell_maxs[1]; y++)
+			{
+				for (int32_t z = cell_mins[2]; z <= cell_maxs[2]; z++)
+				{
+					uint32_t *bucket = grid->buckets[_mg_entity_grid_hash(x, y, z)];
+					for (size_t i = 0; i < gs_dyn_array_size(bucket); i++)
+					{
+						uint32_t id		      = bucket[i];
+						mg_entity_grid_proxy_t *proxy = &grid->proxies[id];
+						if (proxy->stamp == stamp) continue;
+						proxy->stamp = stamp;
+
+						if (id == ignore || (proxy->type & type_mask) == 0) continue;
+						_mg_entity_grid_trace_proxy(trace, id, proxy, start, end, mins, maxs);
+					}
+				}
+			}
+		}
+
+		if (trace->fraction <= end_fr - pullback) break;
+	}
+}
+
+void _mg_entity_grid_cells(const gs_vec3 mins, const gs_vec3 maxs, int32_t *cell_mins, int32_t *cell_maxs)
+{
+	cell_mins[0] = (int32_t)floorf(mins.x / MG_ENTITY_GRID_CELL_SIZE);
+	cell_mins[1] = (int32_t)floorf(mins.y / MG_ENTITY_GRID_CELL_SIZE);
+	cell_mins[2] = (int32_t)floorf(mins.z / MG_ENTITY_GRID_CELL_SIZE);
+	cell_maxs[0] = (int32_t)floorf(maxs.x / MG_ENTITY_GRID_CELL_SIZE);
+	cell_maxs[1] = (int32_t)floorf(maxs.y / MG_ENTITY_GRID_CELL_SIZE);
+	cell_maxs[2] = (int32_t)floorf(maxs.z / MG_ENTITY_GRID_CELL_SIZE);
+}
+
+uint32_t _mg_entity_grid_hash(int32_t x, int32_t y, int32_t z)
+{
+	uint32_t hash = ((uint32_t)x * 73856093u) ^ ((uint32_t)y * 19349663u) ^ ((uint32_t)z * 83492791u);
+	return hash & (MG_ENTITY_GRID_BUCKETS - 1);
+}
+
+// Stamp for a new query, proxies visited by it get marked with it
+uint32_t _mg_entity_grid_next_stamp(mg_entity_grid_t *grid)
+{
+	grid->stamp++;
+	if (grid->stamp == 0)
+	{
+		// Wrapped around, old stamps could match again
+		for (size_t i = 0; i < gs_dyn_array_size(grid->proxies); i++)
+		{
+			grid->proxies[i].stamp = 0;
+		}
+		grid->stamp = 1;
+	}
+	return grid->stamp;
+}
+
+void _mg_entity_grid_link(mg_entity_grid_t *grid, uint32_t id, mg_entity_grid_proxy_t *proxy)
+{
+	_mg_entity_grid_cells(proxy->mins, proxy->maxs, proxy->cell_mins, proxy->cell_maxs);
+
+	proxy->large = false;
+	for (size_t i = 0; i < 3; i++)
+	{
+		if (proxy->cell_maxs[i] - proxy->cell_mins[i] + 1 > MG_ENTITY_GRID_MAX_SPAN)
+		{
+			proxy->large = true;
+		}
+	}
+
+	if (proxy->large)
+	{
+		gs_dyn_array_push(grid->large, id);
+		return;
+	}
+
+	// Cells hashing to the same bucket add the id more than once,
+	// unlink removes one entry per cell so it evens out.
+	for (int32_t x = proxy->cell_mins[0]; x <= proxy->cell_maxs[0]; x++)
+	{
+		for (int32_t y = proxy->cell_mins[1]; y <= proxy->cell_maxs[1]; y++)
+		{
+			for (int32_t z = proxy->cell_mins[2]; z <= proxy->cell_maxs[2]; z++)
+			{
+				gs_dyn_array_push(grid->buckets[_mg_entity_grid_hash(x, y, z)], id);
+			}
+		}
+	}
+}
+
+static inline void _mg_entity_grid_remove_id(uint32_t *ids, uint32_t id)
+{
+	for (size_t i = 0; i < gs_dyn_array_size(ids); i++)
+	{
+		if (ids[i] == id)
+		{
+			ids[i] = gs_dyn_array_back(ids);
+			gs_dyn_array_pop(ids);
+			return;
+		}
+	}
+}
+
+void _mg_entity_grid_unlink(mg_entity_grid_t *grid, uint32_t id, mg_entity_grid_proxy_t *proxy)
+{
+	if (proxy->large)
+	{
+		_mg_entity_grid_remove_id(grid->large, id);
+		return;
+	}
+
+	for (int32_t x = proxy->cell_mins[0]; x <= proxy->cell_maxs[0]; x++)
+	{
+		for (int32_t y = proxy->cell_mins[1]; y <= proxy->cell_maxs[1]; y++)
+		{
+			for (int32_t z = proxy->cell_mins[2]; z <= proxy->cell_maxs[2]; z++)
+			{
+				_mg_entity_grid_remove_id(grid->buckets[_mg_entity_grid_hash(x, y, z)], id);
+			}
+		}
+	}
+}
+
+// Slab test of the trace against the proxy grown by the trace box,
+// keeps the hit if it's nearer than the current one.
+void _mg_entity_grid_trace_proxy(mg_entity_trace_t *trace, uint32_t id, const mg_entity_grid_proxy_t *proxy, gs_vec3 start, gs_vec3 end, gs_vec3 mins, gs_vec3 maxs)
+{
+	float32_t lo[3]	   = {proxy->mins.x - maxs.x, proxy->mins.y - maxs.y, proxy->mins.z - maxs.z};
+	float32_t hi[3]	   = {proxy->maxs.x - mins.x, proxy->maxs.y - mins.y, proxy->maxs.z - mins.z};
+	float32_t from[3]  = {start.x, start.y, start.z};
+	float32_t delta[3] = {end.x - start.x, end.y - start.y, end.z - start.z};
+	float32_t enter	   = -FLT_MAX;
+	float32_t exit	   = FLT_MAX;
+	int32_t enter_axis = -1;
+	float32_t enter_sign;
+	bool inside = true;
+
+	for (size_t i = 0; i < 3; i++)
+	{
+		if (from[i] <= lo[i] || from[i] >= hi[i]) inside = false;
+
+		if (fabsf(delta[i]) < GS_EPSILON)
+		{
+			// Parallel, never gets in if outside now
+			if (from[i] <= lo[i] || from[i] >= hi[i]) return;
+			continue;
+		}
+
+		float32_t near_fr;
+		float32_t far_fr;
+		float32_t sign;
+		if (delta[i] > 0)
+		{
+			near_fr = (lo[i] - from[i]) / delta[i];
+			far_fr	= (hi[i] - from[i]) / delta[i];
+			sign	= -1.0f;
+		}
+		else
+		{
+			near_fr = (hi[i] - from[i]) / delta[i];
+			far_fr	= (lo[i] - from[i]) / delta[i];
+			sign	= 1.0f;
+		}
+
+		if (near_fr > enter)
+		{
+			enter	   = near_fr;
+			enter_axis = i;
+			enter_sign = sign;
+		}
+		if (far_fr < exit) exit = far_fr;
+	}
+
+	if (inside)
+	{
+		if (!trace->start_solid || trace->fraction > 0)
+		{
+			trace->fraction	   = 0;
+			trace->normal	   = gs_v3(0, 0, 0);
+			trace->start_solid = true;
+			trace->proxy	   = id;
+			trace->type	   = proxy->type;
+			trace->owner	   = proxy->owner;
+		}
+		return;
+	}
+
+	if (enter_axis < 0 || enter > exit || enter < 0) return;
+
+	// Stop a bit short like BSP traces do
+	float32_t length   = sqrtf(delta[0] * delta[0] + delta[1] * delta[1] + delta[2] * delta[2]);
+	float32_t fraction = gs_max(0.0f, enter - BSP_TRACE_EPSILON / length);
+	if (fraction >= trace->fraction) return;
+
+	float32_t normal[3] = {0, 0, 0};
+	normal[enter_axis]  = enter_sign;
+
+	trace->fraction = fraction;
+	trace->normal	= gs_v3(normal[0], normal[1], normal[2]);
+	trace->proxy	= id;
+	trace->type	= proxy->type;
+	trace->owner	= proxy->owner;
+}
\ No newline at end of file
@@ -0,0 +1,95 @@
+/*================================================================
+	* entities/entity_grid.h
+	*
+	* Copyright (c) 2022 Lauri Räsänen
+	* ================================
+
+	Spatial hash of entity bounds for finding entities near
+	a point or along a trace without going through all of them.
+	Not thread safe, use from the main thread.
+=================================================================*/
+
+#ifndef MG_ENTITY_GRID_H
+#define MG_ENTITY_GRID_H
+
+#include <gs/gs.h>
+
+#include "../bsp/bsp_trace.h"
+
+#define MG_ENTITY_GRID_CELL_SIZE 128.0f
+// Power of two
+#define MG_ENTITY_GRID_BUCKETS 4096
+// Proxies spanning more cells than this on any axis
+// are kept in a list that every query checks.
+#define MG_ENTITY_GRID_MAX_SPAN 4
+#define MG_ENTITY_GRID_NONE	UINT32_MAX
+
+typedef enum mg_entity_grid_type
+{
+	MG_ENTITY_GRID_ENTITY  = 1 << 0,
+	MG_ENTITY_GRID_PLAYER  = 1 << 1,
+	MG_ENTITY_GRID_MONSTER = 1 << 2,
+	MG_ENTITY_GRID_ALL     = 0xFF,
+} mg_entity_grid_type;
+
+typedef struct mg_entity_grid_proxy_t
+{
+	// World space bounds
+	gs_vec3 mins;
+	gs_vec3 maxs;
+	// Cells the proxy is in, inclusive
+	int32_t cell_mins[3];
+	int32_t cell_maxs[3];
+	bool32_t large;
+	mg_entity_grid_type type;
+	// mg_entity_t, mg_player_t or mg_monster_t depending on type
+	void *owner;
+	// Last query that visited this proxy
+	uint32_t stamp;
+	bool32_t used;
+} mg_entity_grid_proxy_t;
+
+typedef struct mg_entity_grid_t
+{
+	// Indexed by proxy id, removed ones are reused through free_ids
+	gs_dyn_array(mg_entity_grid_proxy_t) proxies;
+	gs_dyn_array(uint32_t) free_ids;
+	gs_dyn_array(uint32_t) buckets[MG_ENTITY_GRID_BUCKETS];
+	gs_dyn_array(uint32_t) large;
+	uint32_t stamp;
+} mg_entity_grid_t;
+
+typedef struct mg_entity_trace_t
+{
+	float32_t fraction;
+	gs_vec3 end;
+	gs_vec3 normal;
+	bool32_t start_solid;
+	// Proxy that was hit, MG_ENTITY_GRID_NONE for world or nothing
+	uint32_t proxy;
+	mg_entity_grid_type type;
+	void *owner;
+	// World part of mg_entity_grid_trace_world
+	bsp_trace_t world;
+} mg_entity_trace_t;
+
+void mg_entity_grid_init(mg_entity_grid_t *grid);
+void mg_entity_grid_free(mg_entity_grid_t *grid);
+uint32_t mg_entity_grid_insert(mg_entity_grid_t *grid, mg_entity_grid_type type, void *owner, gs_vec3 mins, gs_vec3 maxs);
+void mg_entity_grid_move(mg_entity_grid_t *grid, uint32_t id, gs_vec3 mins, gs_vec3 maxs);
+void mg_entity_grid_move_origin(mg_entity_grid_t *grid, uint32_t id, gs_vec3 origin, gs_vec3 mins, gs_vec3 maxs);
+void mg_entity_grid_remove(mg_entity_grid_t *grid, uint32_t id);
+mg_entity_grid_proxy_t *mg_entity_grid_get(mg_entity_grid_t *grid, uint32_t id);
+void mg_entity_grid_query_box(mg_entity_grid_t *grid, gs_vec3 mins, gs_vec3 maxs, uint32_t type_mask, uint32_t **results);
+void mg_entity_grid_query_sphere(mg_entity_grid_t *grid, gs_vec3 center, float32_t radius, uint32_t type_mask, uint32_t **results);
+void mg_entity_grid_trace(mg_entity_grid_t *grid, mg_entity_trace_t *trace, gs_vec3 start, gs_vec3 end, gs_vec3 mins, gs_vec3 maxs, uint32_t type_mask, uint32_t ignore);
+void mg_entity_grid_trace_world(mg_entity_grid_t *grid, bsp_map_t *map, mg_entity_trace_t *trace, gs_vec3 start, gs_vec3 end, gs_vec3 mins, gs_vec3 maxs, int32_t content_mask, uint32_t type_mask, uint32_t ignore, bsp_trace_caller caller);
+void _mg_entity_grid_sweep(mg_entity_grid_t *grid, mg_entity_trace_t *trace, gs_vec3 start, gs_vec3 end, gs_vec3 mins, gs_vec3 maxs, uint32_t type_mask, uint32_t ignore);
+void _mg_entity_grid_cells(const gs_vec3 mins, const gs_vec3 maxs, int32_t *cell_mins, int32_t *cell_maxs);
+uint32_t _mg_entity_grid_hash(int32_t x, int32_t y, int32_t z);
+uint32_t _mg_entity_grid_next_stamp(mg_entity_grid_t *grid);
+void _mg_entity_grid_link(mg_entity_grid_t *grid, uint32_t id, mg_entity_grid_proxy_t *proxy);
+void _mg_entity_grid_unlink(mg_entity_grid_t *grid, uint32_t id, mg_entity_grid_proxy_t *proxy);
+void _mg_entity_grid_trace_proxy(mg_entity_trace_t *trace, uint32_t id, const mg_entity_grid_proxy_t *proxy, gs_vec3 start, gs_vec3 end, gs_vec3 mins, gs_vec3 maxs);
+
+#endif // MG_ENTITY_GRID_H
\ No newline at end of file
@@ -16,6 +16,8 @@ void mg_entity_manager_init()
 {
 	g_entity_manager	    = gs_malloc_init(mg_entity_manager_t);
 	g_entity_manager->ent_funcs = gs_slot_array_new(mg_entity_func_wrapper_t);
+	mg_entity_grid_init(&g_entity_manager->grid);
+	mg_radius_damage_init(&g_entity_manager->radius_damage);
 }
 
 void mg_entity_manager_free()
@@ -32,6 +34,8 @@ void mg_entity_manager_free()
 		}
 	}
 	gs_slot_array_free(g_entity_manager->ent_funcs);
+	mg_entity_grid_free(&g_entity_manager->grid);
+	mg_radius_damage_free(&g_entity_manager->radius_damage);
 }
 
 void mg_entity_manager_update()
@@ -43,11 +47,25 @@ void mg_entity_manager_update()
 		gs_slot_array_iter_advance(g_entity_manager->ent_funcs, it))
 	{
 		mg_entity_funcs_t ent = gs_slot_array_iter_get(g_entity_manager->ent_funcs, it);
+		uint32_t id	      = ent.entity->id;
 		if (ent.update_func != NULL)
 		{
 			ent.update_func(ent.entity, dt);
+
+			// Removed itself
+			if (!gs_slot_array_handle_valid(g_entity_manager->ent_funcs, id)) continue;
 		}
+
+		mg_entity_grid_move_origin(
+			&g_entity_manager->grid,
+			ent.entity->grid_id,
+			ent.entity->transform.position,
+			ent.entity->mins,
+			ent.entity->maxs);
 	}
+
+	mg_radius_damage_flush(&g_entity_manager->radius_damage, &g_entity_manager->grid, g_game_manager->map);
+	mg_radius_damage_apply(&g_entity_manager->radius_damage);
 }
 
 uint32_t mg_entity_manager_add_entity(mg_entity_t *entity, void (*update_func)(void *, double), void (*free_func)(void *))
@@ -60,6 +78,13 @@ uint32_t mg_entity_manager_add_entity(mg_entity_t *entity, void (*update_func)(v
 	uint32_t id	     = gs_slot_array_insert(g_entity_manager->ent_funcs, ent_funcs);
 	mg_entity_funcs_t *f = gs_slot_array_getp(g_entity_manager->ent_funcs, id);
 	f->entity->id	     = id;
+
+	entity->grid_id = mg_entity_grid_insert(
+		&g_entity_manager->grid,
+		MG_ENTITY_GRID_ENTITY,
+		entity,
+		gs_vec3_add(entity->transform.position, entity->mins),
+		gs_vec3_add(entity->transform.position, entity->maxs));
 	return id;
 }
 
@@ -67,6 +92,8 @@ void mg_entity_manager_remove_entity(const uint32_t id)
 {
 	if (gs_slot_array_handle_valid(g_entity_manager->ent_funcs, id))
 	{
+		mg_entity_funcs_t *f = gs_slot_array_getp(g_entity_manager->ent_funcs, id);
+		mg_entity_grid_remove(&g_entity_manager->grid, f->entity->grid_id);
 		gs_slot_array_erase(g_entity_manager->ent_funcs, id);
 	}
 }
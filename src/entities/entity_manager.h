@@ -13,6 +13,8 @@
 #include <gs/gs.h>
 
 #include "entity.h"
+#include "entity_grid.h"
+#include "radius_damage.h"
 
 typedef struct mg_entity_funcs_t
 {
@@ -24,6 +26,10 @@ typedef struct mg_entity_funcs_t
 typedef struct mg_entity_manager_t
 {
 	gs_slot_array(mg_entity_funcs_t) ent_funcs;
+	// Bounds of entities, players and monsters
+	mg_entity_grid_t grid;
+	// Explosions queued this frame, resolved after entity updates
+	mg_radius_damage_t radius_damage;
 } mg_entity_manager_t;
 
 void mg_entity_manager_init();
@@ -18,6 +18,7 @@
 #include "../util/math.h"
 #include "../util/transform.h"
 #include "entity.h"
+#include "entity_manager.h"
 #include <gs/util/gs_idraw.h>
 
 mg_monster_t *mg_monster_new(const char *model_path, const gs_vec3 mins, const gs_vec3 maxs)
@@ -47,11 +48,19 @@ mg_monster_t *mg_monster_new(const char *model_path, const gs_vec3 mins, const g
 	monster->model_id   = mg_renderer_create_renderable(*monster->model, &monster->transform);
 	monster->renderable = mg_renderer_get_renderable(monster->model_id);
 
+	monster->grid_id = mg_entity_grid_insert(
+		&g_entity_manager->grid,
+		MG_ENTITY_GRID_MONSTER,
+		monster,
+		gs_vec3_add(monster->transform.position, monster->mins),
+		gs_vec3_add(monster->transform.position, monster->maxs));
+
 	return monster;
 }
 
 void mg_monster_free(mg_monster_t *monster)
 {
+	mg_entity_grid_remove(&g_entity_manager->grid, monster->grid_id);
 	gs_free(monster);
 }
 
@@ -65,6 +74,14 @@ void mg_monster_update(mg_monster_t *monster)
 	double pt = g_time_manager->time;
 
 	_mg_monster_think(monster, pt);
+	mg_ent_ride_mover(
+		&monster->transform,
+		&monster->ground_model,
+		&monster->ground_model_transform,
+		monster->mins,
+		monster->maxs,
+		BSP_CONTENT_CONTENTS_SOLID | BSP_CONTENT_CONTENTS_MONSTERCLIP,
+		BSP_TRACE_CALLER_MONSTER);
 	_mg_monster_check_floor(monster);
 
 	// Handle jump and gravity
@@ -141,7 +158,8 @@ void mg_monster_update(mg_monster_t *monster)
 		    MG_MONSTER_STEP_HEIGHT,
 		    monster->grounded,
 		    BSP_CONTENT_CONTENTS_SOLID | BSP_CONTENT_CONTENTS_MONSTERCLIP,
-		    dt))
+		    dt,
+		    BSP_TRACE_CALLER_MONSTER))
 	{
 		// FIXME: this just makes you fly up walls...
 		// _mg_monster_unstuck(monster);
@@ -191,7 +209,7 @@ void _mg_monster_do_jump(mg_monster_t *monster)
 
 void _mg_monster_check_floor(mg_monster_t *monster)
 {
-	bsp_trace_t trace = {.map = g_game_manager->map};
+	bsp_trace_t trace = {.map = g_game_manager->map, .caller = BSP_TRACE_CALLER_MONSTER};
 	bsp_trace_box(
 		&trace,
 		monster->transform.position,
@@ -211,6 +229,7 @@ void _mg_monster_check_floor(mg_monster_t *monster)
 		monster->has_jumped	  = false;
 		monster->ground_normal	  = trace.normal;
 		monster->last_ground_time = g_time_manager->time;
+		mg_ent_set_ground_model(&monster->ground_model, &monster->ground_model_transform, trace.model);
 
 		uint32_t leaf_index   = g_game_manager->map->stats.current_leaf;
 		int32_t cluster_index = g_game_manager->map->leaves.data[leaf_index].cluster;
@@ -222,6 +241,7 @@ void _mg_monster_check_floor(mg_monster_t *monster)
 	else
 	{
 		monster->grounded = false;
+		mg_ent_set_ground_model(&monster->ground_model, &monster->ground_model_transform, 0);
 	}
 }
 
@@ -269,7 +289,7 @@ void _mg_monster_uncrouch(mg_monster_t *monster, float delta_time)
 {
 	if (monster->crouch_fraction == 0.0f) return;
 
-	bsp_trace_t trace = {.map = g_game_manager->map};
+	bsp_trace_t trace = {.map = g_game_manager->map, .caller = BSP_TRACE_CALLER_MONSTER};
 	gs_vec3 origin	  = monster->transform.position;
 	bool32_t grounded = monster->grounded;
 
@@ -350,7 +370,7 @@ void _mg_monster_unstuck(mg_monster_t *monster)
 	uint32_t dir	   = 0;
 	gs_vec3 start	   = gs_v3(0, 0, 0);
 	gs_vec3 end	   = gs_v3(0, 0, 0);
-	bsp_trace_t trace  = {.map = g_game_manager->map};
+	bsp_trace_t trace  = {.map = g_game_manager->map, .caller = BSP_TRACE_CALLER_MONSTER};
 
 	while (true)
 	{
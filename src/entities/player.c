@@ -20,6 +20,7 @@
 #include "../util/camera.h"
 #include "../util/math.h"
 #include "entity.h"
+#include "entity_manager.h"
 
 #include <gs/util/gs_idraw.h>
 
@@ -65,11 +66,20 @@ mg_player_t *mg_player_new()
 
 	_mg_player_camera_update(player);
 
+	player->grid_id = mg_entity_grid_insert(
+		&g_entity_manager->grid,
+		MG_ENTITY_GRID_PLAYER,
+		player,
+		gs_vec3_add(player->transform.position, player->mins),
+		gs_vec3_add(player->transform.position, player->maxs));
+
 	return player;
 }
 
 void mg_player_free(mg_player_t *player)
 {
+	mg_entity_grid_remove(&g_entity_manager->grid, player->grid_id);
+
 	for (size_t i = 0; i < MG_WEAPON_COUNT; i++)
 	{
 		mg_weapon_free(player->weapons[i]);
@@ -87,6 +97,14 @@ void mg_player_update(mg_player_t *player)
 	double dt = g_time_manager->delta;
 	double pt = g_time_manager->time;
 
+	mg_ent_ride_mover(
+		&player->transform,
+		&player->ground_model,
+		&player->ground_model_transform,
+		player->mins,
+		player->maxs,
+		BSP_CONTENT_CONTENTS_SOLID | BSP_CONTENT_CONTENTS_PLAYERCLIP,
+		BSP_TRACE_CALLER_PLAYER);
 	_mg_player_check_floor(player);
 
 	// Handle jump and gravity
@@ -169,7 +187,8 @@ void mg_player_update(mg_player_t *player)
 		    MG_PLAYER_STEP_HEIGHT,
 		    player->grounded,
 		    BSP_CONTENT_CONTENTS_SOLID | BSP_CONTENT_CONTENTS_PLAYERCLIP,
-		    dt))
+		    dt,
+		    BSP_TRACE_CALLER_PLAYER))
 	{
 		// FIXME: this just makes you fly up walls...
 		// _mg_player_unstuck(player);
@@ -229,7 +248,7 @@ void _mg_player_do_jump(mg_player_t *player)
 
 void _mg_player_check_floor(mg_player_t *player)
 {
-	bsp_trace_t trace = {.map = g_game_manager->map};
+	bsp_trace_t trace = {.map = g_game_manager->map, .caller = BSP_TRACE_CALLER_PLAYER};
 	bsp_trace_box(
 		&trace,
 		player->transform.position,
@@ -249,6 +268,7 @@ void _mg_player_check_floor(mg_player_t *player)
 		player->has_jumped	 = false;
 		player->ground_normal	 = trace.normal;
 		player->last_ground_time = g_time_manager->time;
+		mg_ent_set_ground_model(&player->ground_model, &player->ground_model_transform, trace.model);
 
 		uint32_t leaf_index   = g_game_manager->map->stats.current_leaf;
 		int32_t cluster_index = g_game_manager->map->leaves.data[leaf_index].cluster;
@@ -260,6 +280,7 @@ void _mg_player_check_floor(mg_player_t *player)
 	else
 	{
 		player->grounded = false;
+		mg_ent_set_ground_model(&player->ground_model, &player->ground_model_transform, 0);
 	}
 }
 
@@ -340,7 +361,7 @@ void _mg_player_uncrouch(mg_player_t *player, float delta_time)
 {
 	if (player->crouch_fraction == 0.0f) return;
 
-	bsp_trace_t trace = {.map = g_game_manager->map};
+	bsp_trace_t trace = {.map = g_game_manager->map, .caller = BSP_TRACE_CALLER_PLAYER};
 	gs_vec3 origin	  = player->transform.position;
 	bool32_t grounded = player->grounded;
 
@@ -421,7 +442,7 @@ void _mg_player_unstuck(mg_player_t *player)
 	uint32_t dir	   = 0;
 	gs_vec3 start	   = gs_v3(0, 0, 0);
 	gs_vec3 end	   = gs_v3(0, 0, 0);
-	bsp_trace_t trace  = {.map = g_game_manager->map};
+	bsp_trace_t trace  = {.map = g_game_manager->map, .caller = BSP_TRACE_CALLER_PLAYER};
 
 	while (true)
 	{
@@ -482,6 +503,6 @@ void _mg_player_shoot(mg_player_t *player)
 	}
 
 	mg_weapon_t *weapon	      = player->weapons[player->weapon_current];
-	mg_weapon_shoot_result result = mg_weapon_shoot(weapon, player->camera.cam.transform);
+	mg_weapon_shoot_result result = mg_weapon_shoot(weapon, player->camera.cam.transform, player->grid_id);
 	// TODO: shoot anim, out of ammo sound
 }
\ No newline at end of file
@@ -52,12 +52,17 @@ typedef struct mg_player_t
 	gs_camera_t viewmodel_camera;
 	float32_t yaw;
 	int32_t health;
+	// Proxy in the entity manager grid
+	uint32_t grid_id;
 	gs_vec3 velocity;
 	gs_vec3 wish_move;
 	gs_vec3 mins;
 	gs_vec3 maxs;
 	gs_vec3 eye_pos;
 	gs_vec3 ground_normal;
+	// Brush model stood on and its transform when last ridden
+	int32_t ground_model;
+	gs_mat4 ground_model_transform;
 	bool32_t wish_jump;
 	bool32_t wish_crouch;
 	bool32_t crouched;
@@ -0,0 +1,274 @@
+/*================================================================
+	* entities/radius_damage.c
+	*
+	* Copyright (c) 2022 Lauri Räsänen
+	* ================================
+
+	Splash damage from queued blasts. Targets come from a sphere
+	query on the entity grid, a PVS check drops ones the blast
+	can't see, and the remaining line of sight rays are shared by
+	blasts in the same snap cell and traced as one batch. Targets
+	with a blocked center get a second batch of corner rays.
+=================================================================*/
+
+#include "radius_damage.h"
+#include "monster.h"
+#include "player.h"
+
+void mg_radius_damage_init(mg_radius_damage_t *rd)
+{
+	*rd = (mg_radius_damage_t){
+		.blasts	    = gs_dyn_array_new(mg_radius_damage_blast_t),
+		.events	    = gs_dyn_array_new(mg_damage_event_t),
+		.overlaps   = gs_dyn_array_new(uint32_t),
+		.candidates = gs_dyn_array_new(mg_radius_damage_candidate_t),
+		.queries    = gs_dyn_array_new(bsp_trace_query_t),
+		.results    = gs_dyn_array_new(bsp_trace_t),
+		.fallbacks  = gs_dyn_array_new(uint32_t),
+		.los_cache  = gs_hash_table_new(mg_radius_damage_los_key_t, uint32_t),
+	};
+}
+
+void mg_radius_damage_free(mg_radius_damage_t *rd)
+{
+	gs_dyn_array_free(rd->blasts);
+	gs_dyn_array_free(rd->events);
+	gs_dyn_array_free(rd->overlaps);
+	gs_dyn_array_free(rd->candidates);
+	gs_dyn_array_free(rd->queries);
+	gs_dyn_array_free(rd->results);
+	gs_dyn_array_free(rd->fallbacks);
+	gs_hash_table_free(rd->los_cache);
+	*rd = (mg_radius_damage_t){0};
+}
+
+void mg_radius_damage_add(mg_radius_damage_t *rd, mg_radius_damage_blast_t blast)
+{
+	if (blast.radius <= 0) return;
+	gs_dyn_array_push(rd->blasts, blast);
+}
+
+void mg_radius_damage_flush(mg_radius_damage_t *rd, mg_entity_grid_t *grid, bsp_map_t *map)
+{
+	gs_dyn_array_clear(rd->events);
+	if (gs_dyn_array_size(rd->blasts) == 0) return;
+
+	if (map != NULL && !map->valid) map = NULL;
+
+	gs_dyn_array_clear(rd->candidates);
+	gs_dyn_array_clear(rd->queries);
+	gs_hash_table_clear(rd->los_cache);
+
+	for (uint32_t i = 0; i < gs_dyn_array_size(rd->blasts); i++)
+	{
+		_mg_radius_damage_gather(rd, grid, map, i);
+	}
+
+	// Line of sight for every blast at once,
+	// then corners of targets whose center was blocked.
+	uint32_t num_queries = gs_dyn_array_size(rd->queries);
+	_mg_radius_damage_trace(rd, map, 0, num_queries);
+	_mg_radius_damage_add_fallbacks(rd, grid);
+	_mg_radius_damage_trace(rd, map, num_queries, gs_dyn_array_size(rd->queries) - num_queries);
+
+	for (size_t i = 0; i < gs_dyn_array_size(rd->candidates); i++)
+	{
+		mg_radius_damage_candidate_t *candidate = &rd->candidates[i];
+		if (!_mg_radius_damage_visible(rd, candidate)) continue;
+
+		mg_radius_damage_blast_t *blast = &rd->blasts[candidate->blast];
+		mg_entity_grid_proxy_t *proxy	= mg_entity_grid_get(grid, candidate->proxy);
+		float32_t scale			= 1.0f - candidate->distance / blast->radius;
+		float32_t damage		= blast->damage * scale;
+		if (candidate->proxy == blast->attacker)
+		{
+			damage *= MG_RADIUS_DAMAGE_SELF_SCALE;
+		}
+
+		// Push away from the blast, straight up if at the center
+		gs_vec3 center = gs_vec3_scale(gs_vec3_add(proxy->mins, proxy->maxs), 0.5f);
+		gs_vec3 dir    = gs_vec3_sub(center, blast->origin);
+		float32_t len  = gs_vec3_len(dir);
+		dir	       = len > 0.001f ? gs_vec3_scale(dir, 1.0f / len) : gs_v3(0, 0, 1.0f);
+
+		mg_damage_event_t event = {
+			.blast	   = candidate->blast,
+			.attacker  = blast->attacker,
+			.proxy	   = candidate->proxy,
+			.type	   = proxy->type,
+			.target	   = proxy->owner,
+			.damage	   = (int32_t)(damage + 0.5f),
+			.knockback = gs_vec3_scale(dir, blast->knockback * scale),
+		};
+		gs_dyn_array_push(rd->events, event);
+	}
+
+	gs_dyn_array_clear(rd->blasts);
+}
+
+void mg_radius_damage_apply(mg_radius_damage_t *rd)
+{
+	for (size_t i = 0; i < gs_dyn_array_size(rd->events); i++)
+	{
+		mg_damage_event_t *event = &rd->events[i];
+		switch (event->type)
+		{
+			case MG_ENTITY_GRID_PLAYER:
+			{
+				mg_player_t *player = event->target;
+				player->health -= event->damage;
+				player->velocity = gs_vec3_add(player->velocity, event->knockback);
+				break;
+			}
+
+			case MG_ENTITY_GRID_MONSTER:
+			{
+				mg_monster_t *monster = event->target;
+				monster->health -= event->damage;
+				monster->velocity = gs_vec3_add(monster->velocity, event->knockback);
+				break;
+			}
+
+			default:
+				break;
+		}
+	}
+}
+
+void _mg_radius_damage_gather(mg_radius_damage_t *rd, mg_entity_grid_t *grid, bsp_map_t *map, uint32_t blast_index)
+{
+	mg_radius_damage_blast_t *blast = &rd->blasts[blast_index];
+	mg_entity_grid_query_sphere(grid, blast->origin, blast->radius, blast->type_mask, &rd->overlaps);
+	if (gs_dyn_array_size(rd->overlaps) == 0) return;
+
+	int32_t blast_cluster = -1;
+	if (map != NULL)
+	{
+		blast_cluster = _mg_radius_damage_cluster(map, blast->origin);
+	}
+
+	mg_radius_damage_los_key_t key = {
+		.cell = {
+			(int32_t)floorf(blast->origin.x / MG_RADIUS_DAMAGE_LOS_SNAP),
+			(int32_t)floorf(blast->origin.y / MG_RADIUS_DAMAGE_LOS_SNAP),
+			(int32_t)floorf(blast->origin.z / MG_RADIUS_DAMAGE_LOS_SNAP),
+		},
+	};
+
+	for (size_t i = 0; i < gs_dyn_array_size(rd->overlaps); i++)
+	{
+		uint32_t id		      = rd->overlaps[i];
+		mg_entity_grid_proxy_t *proxy = mg_entity_grid_get(grid, id);
+		gs_vec3 center		      = gs_vec3_scale(gs_vec3_add(proxy->mins, proxy->maxs), 0.5f);
+
+		mg_radius_damage_candidate_t candidate = {
+			.blast = blast_index,
+			.proxy = id,
+			.query = MG_ENTITY_GRID_NONE,
+		};
+
+		// Distance to the closest point of the bounds,
+		// the sphere query already made sure it's within radius.
+		gs_vec3 closest = gs_v3(
+			gs_clamp(blast->origin.x, proxy->mins.x, proxy->maxs.x),
+			gs_clamp(blast->origin.y, proxy->mins.y, proxy->maxs.y),
+			gs_clamp(blast->origin.z, proxy->mins.z, proxy->maxs.z));
+		candidate.distance = gs_min(gs_vec3_dist(closest, blast->origin), blast->radius);
+
+		if (map != NULL)
+		{
+			// Cheaper than a trace, can't see it if it's not in the PVS
+			if (!_bsp_cluster_visible(map, blast_cluster, _mg_radius_damage_cluster(map, center))) continue;
+
+			key.proxy = id;
+			if (gs_hash_table_exists(rd->los_cache, key))
+			{
+				candidate.query = gs_hash_table_get(rd->los_cache, key);
+			}
+			else
+			{
+				bsp_trace_query_t query = {
+					.type	      = RAY,
+					.start	      = blast->origin,
+					.end	      = center,
+					.content_mask = BSP_CONTENT_CONTENTS_SOLID,
+					.caller	      = blast->caller,
+				};
+				candidate.query = gs_dyn_array_size(rd->queries);
+				gs_dyn_array_push(rd->queries, query);
+				gs_hash_table_insert(rd->los_cache, key, candidate.query);
+			}
+		}
+
+		gs_dyn_array_push(rd->candidates, candidate);
+	}
+}
+
+// Trace queries first .. first + count into results of the same index
+void _mg_radius_damage_trace(mg_radius_damage_t *rd, bsp_map_t *map, uint32_t first, uint32_t count)
+{
+	if (count == 0) return;
+
+	gs_dyn_array_reserve(rd->results, first + count);
+	gs_dyn_array_head(rd->results)->size = first + count;
+	bsp_trace_batch(map, rd->queries + first, rd->results + first, count, true);
+}
+
+// Queue corner rays for candidates whose center ray was blocked,
+// shared by candidates with the same center query.
+void _mg_radius_damage_add_fallbacks(mg_radius_damage_t *rd, mg_entity_grid_t *grid)
+{
+	uint32_t num_queries = gs_dyn_array_size(rd->queries);
+	gs_dyn_array_clear(rd->fallbacks);
+	for (size_t i = 0; i < num_queries; i++)
+	{
+		gs_dyn_array_push(rd->fallbacks, MG_ENTITY_GRID_NONE);
+	}
+
+	for (size_t i = 0; i < gs_dyn_array_size(rd->candidates); i++)
+	{
+		uint32_t query = rd->candidates[i].query;
+		if (query == MG_ENTITY_GRID_NONE || rd->results[query].fraction >= 1.0f) continue;
+		if (rd->fallbacks[query] != MG_ENTITY_GRID_NONE) continue;
+
+		mg_entity_grid_proxy_t *proxy = mg_entity_grid_get(grid, rd->candidates[i].proxy);
+		gs_vec3 center		      = gs_vec3_scale(gs_vec3_add(proxy->mins, proxy->maxs), 0.5f);
+
+		gs_vec3 points[MG_RADIUS_DAMAGE_LOS_FALLBACKS] = {
+			gs_v3(proxy->mins.x, proxy->mins.y, center.z),
+			gs_v3(proxy->maxs.x, proxy->mins.y, center.z),
+			gs_v3(proxy->mins.x, proxy->maxs.y, center.z),
+			gs_v3(proxy->maxs.x, proxy->maxs.y, center.z),
+			// Over a low lip
+			gs_v3(center.x, center.y, proxy->maxs.z - 1.0f),
+		};
+
+		rd->fallbacks[query] = gs_dyn_array_size(rd->queries);
+		for (size_t j = 0; j < MG_RADIUS_DAMAGE_LOS_FALLBACKS; j++)
+		{
+			bsp_trace_query_t fallback = rd->queries[query];
+			fallback.end		   = points[j];
+			gs_dyn_array_push(rd->queries, fallback);
+		}
+	}
+}
+
+// Any of the candidate's rays reached it
+bool32_t _mg_radius_damage_visible(mg_radius_damage_t *rd, const mg_radius_damage_candidate_t *candidate)
+{
+	if (candidate->query == MG_ENTITY_GRID_NONE || rd->results[candidate->query].fraction >= 1.0f) return true;
+
+	uint32_t first = rd->fallbacks[candidate->query];
+	for (size_t i = 0; i < MG_RADIUS_DAMAGE_LOS_FALLBACKS; i++)
+	{
+		if (rd->results[first + i].fraction >= 1.0f) return true;
+	}
+	return false;
+}
+
+int32_t _mg_radius_damage_cluster(bsp_map_t *map, gs_vec3 point)
+{
+	int32_t leaf = bsp_trace_point_leaf(map, point);
+	if (leaf < 0) return -1;
+	return map->leaves.data[leaf].cluster;
+}
\ No newline at end of file
@@ -0,0 +1,95 @@
+/*================================================================
+	* entities/radius_damage.h
+	*
+	* Copyright (c) 2022 Lauri Räsänen
+	* ================================
+
+	Splash damage from explosions. Blasts are queued during
+	the frame and resolved together in one flush, which finds
+	targets from the entity grid, drops the ones outside the
+	blast's PVS and traces line of sight in batches.
+	Not thread safe, use from the main thread.
+=================================================================*/
+
+#ifndef MG_RADIUS_DAMAGE_H
+#define MG_RADIUS_DAMAGE_H
+
+#include <gs/gs.h>
+
+#include "../bsp/bsp_trace.h"
+#include "entity_grid.h"
+
+// Blasts this close to each other share line of sight traces
+#define MG_RADIUS_DAMAGE_LOS_SNAP   8.0f
+// Damage scale for hurting yourself, knockback is not scaled
+#define MG_RADIUS_DAMAGE_SELF_SCALE 0.5f
+// Rays tried when the center is blocked, 4 corners like Quake 3 and the top
+#define MG_RADIUS_DAMAGE_LOS_FALLBACKS 5
+
+typedef struct mg_radius_damage_blast_t
+{
+	gs_vec3 origin;
+	float32_t radius;
+	// Damage and knockback speed at the center, fall off linearly to 0 at radius
+	float32_t damage;
+	float32_t knockback;
+	// Grid proxy that caused the blast, MG_ENTITY_GRID_NONE if nobody
+	uint32_t attacker;
+	uint32_t type_mask;
+	bsp_trace_caller caller;
+} mg_radius_damage_blast_t;
+
+typedef struct mg_damage_event_t
+{
+	uint32_t blast;
+	uint32_t attacker;
+	uint32_t proxy;
+	mg_entity_grid_type type;
+	// mg_entity_t, mg_player_t or mg_monster_t depending on type
+	void *target;
+	int32_t damage;
+	gs_vec3 knockback;
+} mg_damage_event_t;
+
+// Target that passed the sphere and PVS tests, waiting for line of sight
+typedef struct mg_radius_damage_candidate_t
+{
+	uint32_t blast;
+	uint32_t proxy;
+	uint32_t query;
+	float32_t distance;
+} mg_radius_damage_candidate_t;
+
+typedef struct mg_radius_damage_los_key_t
+{
+	int32_t cell[3];
+	uint32_t proxy;
+} mg_radius_damage_los_key_t;
+
+typedef struct mg_radius_damage_t
+{
+	gs_dyn_array(mg_radius_damage_blast_t) blasts;
+	// Result of the last flush, valid until the next one
+	gs_dyn_array(mg_damage_event_t) events;
+	// Scratch
+	gs_dyn_array(uint32_t) overlaps;
+	gs_dyn_array(mg_radius_damage_candidate_t) candidates;
+	gs_dyn_array(bsp_trace_query_t) queries;
+	gs_dyn_array(bsp_trace_t) results;
+	// First fallback query of each blocked center query
+	gs_dyn_array(uint32_t) fallbacks;
+	gs_hash_table(mg_radius_damage_los_key_t, uint32_t) los_cache;
+} mg_radius_damage_t;
+
+void mg_radius_damage_init(mg_radius_damage_t *rd);
+void mg_radius_damage_free(mg_radius_damage_t *rd);
+void mg_radius_damage_add(mg_radius_damage_t *rd, mg_radius_damage_blast_t blast);
+void mg_radius_damage_flush(mg_radius_damage_t *rd, mg_entity_grid_t *grid, bsp_map_t *map);
+void mg_radius_damage_apply(mg_radius_damage_t *rd);
+void _mg_radius_damage_gather(mg_radius_damage_t *rd, mg_entity_grid_t *grid, bsp_map_t *map, uint32_t blast_index);
+void _mg_radius_damage_trace(mg_radius_damage_t *rd, bsp_map_t *map, uint32_t first, uint32_t count);
+void _mg_radius_damage_add_fallbacks(mg_radius_damage_t *rd, mg_entity_grid_t *grid);
+bool32_t _mg_radius_damage_visible(mg_radius_damage_t *rd, const mg_radius_damage_candidate_t *candidate);
+int32_t _mg_radius_damage_cluster(bsp_map_t *map, gs_vec3 point);
+
+#endif // MG_RADIUS_DAMAGE_H
\ No newline at end of file
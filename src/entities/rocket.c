@@ -14,7 +14,7 @@
 #include "../util/transform.h"
 #include "entity_manager.h"
 
-mg_rocket_t *mg_rocket_new(gs_vqs transform)
+mg_rocket_t *mg_rocket_new(gs_vqs transform, uint32_t owner)
 {
 	mg_rocket_t *rocket = gs_malloc_init(mg_rocket_t);
 	gs_assert(mg_model_ent_init(&rocket->mdl_ent, transform, "projectiles/rocket.md3", "basic"));
@@ -23,6 +23,7 @@ mg_rocket_t *mg_rocket_new(gs_vqs transform)
 	rocket->start_time	     = g_time_manager->time;
 	rocket->hidden		     = true;
 	rocket->trail		     = mg_rocket_trail_new(&rocket->mdl_ent.ent.transform);
+	rocket->owner		     = owner;
 	mg_renderer_set_hidden(rocket->mdl_ent.renderable_id, true);
 	mg_entity_manager_add_entity(rocket, mg_rocket_update, mg_rocket_free);
 	return rocket;
@@ -56,17 +57,28 @@ void mg_rocket_update(mg_rocket_t *rocket, double dt)
 		    current_pos,
 		    gs_vec3_scale(rocket->mdl_ent.ent.velocity, dt));
 
-	bsp_trace_t trace = {0};
-	trace.map	  = g_game_manager->map;
-	bsp_trace_ray(&trace, current_pos, new_pos, BSP_CONTENT_CONTENTS_SOLID);
+	mg_entity_trace_t trace;
+	mg_entity_grid_trace_world(
+		&g_entity_manager->grid,
+		g_game_manager->map,
+		&trace,
+		current_pos,
+		new_pos,
+		gs_v3(0, 0, 0),
+		gs_v3(0, 0, 0),
+		BSP_CONTENT_CONTENTS_SOLID,
+		MG_ENTITY_GRID_PLAYER | MG_ENTITY_GRID_MONSTER,
+		rocket->owner,
+		BSP_TRACE_CALLER_ROCKET);
 
-	if (trace.start_solid)
+	if (trace.start_solid && trace.proxy == MG_ENTITY_GRID_NONE)
 	{
+		// Inside world
 		_mg_rocket_remove(rocket);
 		return;
 	}
 
-	if (trace.fraction < 1.0)
+	if (trace.fraction < 1.0 || trace.start_solid)
 	{
 		// Pull away from surface a bit so explosion can see entities better
 		gs_vec3 pull			       = gs_vec3_scale(trace.normal, 8.0f);
@@ -77,8 +89,6 @@ void mg_rocket_update(mg_rocket_t *rocket, double dt)
 		return;
 	}
 
-	// TODO: trace against entities
-
 	rocket->mdl_ent.ent.transform.position = new_pos;
 
 	// TODO: travel sound at pos
@@ -93,7 +103,17 @@ void _mg_rocket_remove(mg_rocket_t *rocket)
 
 void _mg_rocket_explode(mg_rocket_t *rocket)
 {
-	// TODO: sphere iter nearby ents + trace + damage
+	mg_radius_damage_blast_t blast = {
+		.origin	   = rocket->mdl_ent.ent.transform.position,
+		.radius	   = MG_ROCKET_RADIUS,
+		.damage	   = MG_ROCKET_DAMAGE,
+		.knockback = MG_ROCKET_KNOCKBACK,
+		.attacker  = rocket->owner,
+		.type_mask = MG_ENTITY_GRID_PLAYER | MG_ENTITY_GRID_MONSTER,
+		.caller	   = BSP_TRACE_CALLER_ROCKET,
+	};
+	mg_radius_damage_add(&g_entity_manager->radius_damage, blast);
+
 	// TODO: explosion sound at pos
 	// TODO: explosion fx
 	_mg_rocket_remove(rocket);
@@ -16,6 +16,9 @@
 #define MG_ROCKET_SPEED	    800.0
 #define MG_ROCKET_LIFE	    10.0
 #define MG_ROCKET_HIDE_TIME 0.025
+#define MG_ROCKET_RADIUS    120.0f
+#define MG_ROCKET_DAMAGE    100.0f
+#define MG_ROCKET_KNOCKBACK 600.0f
 
 typedef struct mg_rocket_t
 {
@@ -24,9 +27,11 @@ typedef struct mg_rocket_t
 	double life_time;
 	double start_time;
 	mg_rocket_trail_t *trail;
+	// Grid proxy of the shooter, not hit by the rocket
+	uint32_t owner;
 } mg_rocket_t;
 
-mg_rocket_t *mg_rocket_new(gs_vqs transform);
+mg_rocket_t *mg_rocket_new(gs_vqs transform, uint32_t owner);
 void mg_rocket_free(mg_rocket_t *rocket);
 void mg_rocket_update(mg_rocket_t *rocket, double dt);
 void _mg_rocket_remove(mg_rocket_t *rocket);
@@ -65,7 +65,8 @@ void mg_weapon_free(mg_weapon_t *weapon)
 	gs_free(weapon);
 }
 
-mg_weapon_shoot_result mg_weapon_shoot(mg_weapon_t *weapon, gs_vqs origin)
+// Shooter is the grid proxy of who shot, projectiles won't hit it
+mg_weapon_shoot_result mg_weapon_shoot(mg_weapon_t *weapon, gs_vqs origin, uint32_t shooter)
 {
 	if (weapon->ammo_current <= 0)
 	{
@@ -89,13 +90,15 @@ mg_weapon_shoot_result mg_weapon_shoot(mg_weapon_t *weapon, gs_vqs origin)
 		break;
 
 	case MG_WEAPON_ROCKET_LAUNCHER:
-		mg_rocket_new(gs_vqs_absolute_transform(
-			&(gs_vqs){
-				.position = gs_vec3_scale(MG_AXIS_DOWN, 8.0f),
-				.rotation = gs_quat_default(),
-				.scale	  = gs_v3(1.0f, 1.0f, 1.0f),
-			},
-			&origin));
+		mg_rocket_new(
+			gs_vqs_absolute_transform(
+				&(gs_vqs){
+					.position = gs_vec3_scale(MG_AXIS_DOWN, 8.0f),
+					.rotation = gs_quat_default(),
+					.scale	  = gs_v3(1.0f, 1.0f, 1.0f),
+				},
+				&origin),
+			shooter);
 		break;
 
 	default:
@@ -53,6 +53,6 @@ typedef struct mg_weapon_t
 
 mg_weapon_t *mg_weapon_create(mg_weapon_type type);
 void mg_weapon_free(mg_weapon_t *weapon);
-mg_weapon_shoot_result mg_weapon_shoot(mg_weapon_t *weapon, gs_vqs origin);
+mg_weapon_shoot_result mg_weapon_shoot(mg_weapon_t *weapon, gs_vqs origin, uint32_t shooter);
 
 #endif // MG_WEAPON_H
\ No newline at end of file
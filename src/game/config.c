@@ -50,6 +50,13 @@ void mg_config_init()
 	mg_cvar_new("r_mips", MG_CONFIG_TYPE_INT, 0);
 #endif
 	mg_cvar_new("r_wireframe", MG_CONFIG_TYPE_INT, 0);
+	mg_cvar_new("r_occlusion", MG_CONFIG_TYPE_INT, 1);
+	// Applied when map or models are loaded
+#ifdef __ANDROID__
+	mg_cvar_new("r_packed_vertices", MG_CONFIG_TYPE_INT, 1);
+#else
+	mg_cvar_new("r_packed_vertices", MG_CONFIG_TYPE_INT, 0);
+#endif
 
 	mg_cvar_new("r_viewmodel_fov", MG_CONFIG_TYPE_INT, 65);
 	mg_cvar_new("r_viewmodel_pos_x", MG_CONFIG_TYPE_FLOAT, 0.0f);
@@ -66,6 +73,7 @@ void mg_config_init()
 #endif
 
 	mg_cvar_new("cl_timescale", MG_CONFIG_TYPE_FLOAT, 1.0f);
+	mg_cvar_new("cl_trace_timing", MG_CONFIG_TYPE_INT, 0);
 
 	mg_cvar_new_str("stringtest", MG_CONFIG_TYPE_STRING, "Sandvich make me strong!");
 
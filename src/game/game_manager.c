@@ -1,4 +1,6 @@
 #include "game_manager.h"
+#include "../bsp/bsp_trace.h"
+#include "../entities/entity_manager.h"
 #include "../graphics/renderer.h"
 #include "../graphics/ui_manager.h"
 #include "../util/transform.h"
@@ -22,6 +24,7 @@ void mg_game_manager_init()
 	mg_cmd_arg_type types[] = {MG_CMD_ARG_STRING};
 	mg_cmd_new("map", "Load map", &mg_game_manager_load_map, (mg_cmd_arg_type *)types, 1);
 	mg_cmd_new("spawn", "Spawn player", &mg_game_manager_spawn_player, NULL, 0);
+	mg_cmd_new("trace_stats", "Print collision counters of the last frame", &mg_game_manager_print_trace_stats, NULL, 0);
 }
 
 void mg_game_manager_free()
@@ -32,6 +35,7 @@ void mg_game_manager_free()
 	g_game_manager->player = NULL;
 	bsp_map_free(g_game_manager->map);
 	g_game_manager->map = NULL;
+	bsp_trace_free_thread_scratch();
 
 	gs_free(g_game_manager);
 	g_game_manager = NULL;
@@ -51,6 +55,12 @@ void mg_game_manager_update()
 	{
 		mg_game_manager_input_alive();
 		mg_player_update(g_game_manager->player);
+		mg_entity_grid_move_origin(
+			&g_entity_manager->grid,
+			g_game_manager->player->grid_id,
+			g_game_manager->player->transform.position,
+			g_game_manager->player->mins,
+			g_game_manager->player->maxs);
 		mg_monster_manager_update();
 	}
 
@@ -97,6 +107,32 @@ void mg_game_manager_spawn_player()
 		g_game_manager->player->last_valid_pos = g_game_manager->player->transform.position;
 		g_game_manager->player->yaw -= 90;
 		g_renderer->cam = &g_game_manager->player->camera.cam;
+		mg_entity_grid_move_origin(
+			&g_entity_manager->grid,
+			g_game_manager->player->grid_id,
+			g_game_manager->player->transform.position,
+			g_game_manager->player->mins,
+			g_game_manager->player->maxs);
+	}
+}
+
+void mg_game_manager_print_trace_stats()
+{
+	for (size_t i = 0; i < BSP_TRACE_CALLER_COUNT; i++)
+	{
+		const bsp_trace_counters_t *c = &g_bsp_trace_stats.last[i];
+		mg_println(
+			"%s: ray %zu, sphere %zu, box %zu, nodes %zu, leaves %zu, brushes %zu, sides %zu, patches %zu, %.3fms",
+			bsp_trace_caller_name(i),
+			(size_t)c->traces[RAY],
+			(size_t)c->traces[SPHERE],
+			(size_t)c->traces[BOX],
+			(size_t)c->nodes,
+			(size_t)c->leaves,
+			(size_t)c->brushes,
+			(size_t)c->sides,
+			(size_t)c->patches,
+			c->time_ns / 1e6);
 	}
 }
 
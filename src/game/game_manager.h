@@ -29,6 +29,7 @@ void mg_game_manager_update();
 
 void mg_game_manager_load_map(char *filename);
 void mg_game_manager_spawn_player();
+void mg_game_manager_print_trace_stats();
 
 mg_player_input_t mg_game_manager_get_input();
 void mg_game_manager_input_alive();
@@ -1,4 +1,5 @@
 #include "monster_manager.h"
+#include "../entities/entity_manager.h"
 #include "../entities/monster.h"
 #include "../graphics/renderer.h"
 #include "../graphics/ui_manager.h"
@@ -35,7 +36,9 @@ void mg_monster_manager_update()
 {
 	for (size_t i = 0; i < gs_dyn_array_size(g_monster_manager->monsters); i++)
 	{
-		mg_monster_update(g_monster_manager->monsters[i]);
+		mg_monster_t *mon = g_monster_manager->monsters[i];
+		mg_monster_update(mon);
+		mg_entity_grid_move_origin(&g_entity_manager->grid, mon->grid_id, mon->transform.position, mon->mins, mon->maxs);
 	}
 }
 
@@ -46,6 +49,7 @@ bool mg_monster_manager_spawn_monster(const gs_vec3 pos, const char *model_path)
 	{
 		mon->transform.position = pos;
 		mon->last_valid_pos	= pos;
+		mg_entity_grid_move_origin(&g_entity_manager->grid, mon->grid_id, mon->transform.position, mon->mins, mon->maxs);
 		gs_dyn_array_push(g_monster_manager->monsters, mon);
 		return true;
 	}
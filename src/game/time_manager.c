@@ -9,6 +9,7 @@
 
 #include "time_manager.h"
 #include "config.h"
+#include "../bsp/bsp_trace.h"
 
 mg_time_manager_t *g_time_manager;
 
@@ -35,12 +36,18 @@ void mg_time_manager_update_start()
 	g_time_manager->delta	       = g_time_manager->unscaled_delta * mg_cvar("cl_timescale")->value.f;
 	g_time_manager->unscaled_time += g_time_manager->unscaled_delta;
 	g_time_manager->time += g_time_manager->delta;
+
+	g_bsp_trace_stats.timing = mg_cvar("cl_trace_timing")->value.i;
 }
 
 void mg_time_manager_update_end()
 {
 	g_time_manager->_update_end = gs_platform_elapsed_time() / 1000.0f;
 	g_time_manager->update	    = g_time_manager->_update_end - g_time_manager->_update_start;
+
+	bsp_trace_stats_end_frame();
+	bsp_trace_counters_t total = bsp_trace_stats_total(g_bsp_trace_stats.last);
+	g_time_manager->collision  = total.time_ns / 1e9;
 }
 
 void mg_time_manager_render_start()
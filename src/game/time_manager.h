@@ -28,6 +28,7 @@ typedef struct mg_time_manager_t
 	double post;	  // seconds
 	double ui;	  // seconds
 	double submit;	  // seconds
+	double collision; // seconds, all traces of the last update
 
 	double _update_start;	 // seconds
 	double _update_end;	 // seconds
@@ -9,6 +9,7 @@
 
 #include "model.h"
 #include "../game/console.h"
+#include "../util/packing.h"
 #include "../util/render.h"
 #include "../util/string.h"
 #include "../util/transform.h"
@@ -22,8 +23,10 @@ b32 _mg_load_md3_fail(gs_byte_buffer_t *buffer, char *msg)
 	return false;
 }
 
-bool mg_load_md3(char *filename, md3_t *model)
+bool mg_load_md3(char *filename, md3_t *model, bool32_t packed_vertices)
 {
+	model->packed_vertices = packed_vertices;
+
 	mg_println("mg_load_md3() loading: '%s'", filename);
 
 	if (!gs_platform_file_exists(filename))
@@ -137,14 +140,36 @@ bool mg_load_md3(char *filename, md3_t *model)
 			surf->render_vertices[j].texcoord.y = surf->texcoords[texcoord_index].v;
 		}
 
+		if (packed_vertices)
+		{
+			surf->packed_vertices = gs_malloc(sizeof(mg_md3_packed_vertex_t) * surf->num_verts * surf->num_frames);
+			for (size_t j = 0; j < surf->num_verts * surf->num_frames; j++)
+			{
+				mg_md3_render_vertex_t v = surf->render_vertices[j];
+				uint16_t normal		 = mg_pack_snorm8x2(mg_oct_encode(v.normal));
+
+				surf->packed_vertices[j].position_xy	   = ((uint16_t)surf->vertices[j].x) | ((uint32_t)(uint16_t)surf->vertices[j].y << 16);
+				surf->packed_vertices[j].position_z_normal = ((uint16_t)surf->vertices[j].z) | ((uint32_t)normal << 16);
+				surf->packed_vertices[j].texcoord	   = mg_pack_half2(v.texcoord);
+			}
+		}
+
 		// Vertex buffers
 		surf->vbos = gs_malloc(sizeof(gs_handle_gs_graphics_vertex_buffer_t) * surf->num_frames);
 		for (size_t j = 0; j < surf->num_frames; j++)
 		{
 			gs_graphics_vertex_buffer_desc_t vdesc = gs_default_val();
-			vdesc.data			       = surf->render_vertices + j * surf->num_verts;
-			vdesc.size			       = sizeof(mg_md3_render_vertex_t) * surf->num_verts;
-			surf->vbos[j]			       = gs_graphics_vertex_buffer_create(&vdesc);
+			if (packed_vertices)
+			{
+				vdesc.data = surf->packed_vertices + j * surf->num_verts;
+				vdesc.size = sizeof(mg_md3_packed_vertex_t) * surf->num_verts;
+			}
+			else
+			{
+				vdesc.data = surf->render_vertices + j * surf->num_verts;
+				vdesc.size = sizeof(mg_md3_render_vertex_t) * surf->num_verts;
+			}
+			surf->vbos[j] = gs_graphics_vertex_buffer_create(&vdesc);
 		}
 
 		// Index buffer
@@ -319,6 +344,7 @@ void mg_free_md3(md3_t *model)
 		gs_free(model->surfaces[i].texcoords);
 		gs_free(model->surfaces[i].vertices);
 		gs_free(model->surfaces[i].render_vertices);
+		gs_free(model->surfaces[i].packed_vertices);
 		gs_free(model->surfaces[i].vbos);
 		// contents will be freed by texture manager
 		gs_free(model->surfaces[i].textures);
@@ -330,6 +356,7 @@ void mg_free_md3(md3_t *model)
 		model->surfaces[i].texcoords	   = NULL;
 		model->surfaces[i].vertices	   = NULL;
 		model->surfaces[i].render_vertices = NULL;
+		model->surfaces[i].packed_vertices = NULL;
 		model->surfaces[i].vbos		   = NULL;
 		model->surfaces[i].textures	   = NULL;
 	}
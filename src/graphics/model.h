@@ -92,6 +92,18 @@ typedef struct mg_md3_render_vertex_t
 	gs_vec2 texcoord;
 } mg_md3_render_vertex_t;
 
+// Packed rendering vertex, 12 bytes instead of 32.
+// Positions are the original MD3 int16 values.
+typedef struct mg_md3_packed_vertex_t
+{
+	// int16 x, int16 y
+	uint32_t position_xy;
+	// int16 z, octahedral snorm8x2 normal
+	uint32_t position_z_normal;
+	// half2
+	uint32_t texcoord;
+} mg_md3_packed_vertex_t;
+
 typedef struct md3_surface_t
 {
 	char *magic;
@@ -111,6 +123,7 @@ typedef struct md3_surface_t
 	md3_texcoord_t *texcoords;
 	md3_vertex_t *vertices;
 	mg_md3_render_vertex_t *render_vertices;
+	mg_md3_packed_vertex_t *packed_vertices;
 	gs_handle_gs_graphics_vertex_buffer_t *vbos;
 	gs_handle_gs_graphics_index_buffer_t ibo;
 	gs_asset_texture_t **textures;
@@ -123,10 +136,11 @@ typedef struct md3_t
 	md3_tag_t *tags;
 	md3_surface_t *surfaces;
 	gs_dyn_array(mg_md3_animation_t) animations;
+	bool32_t packed_vertices;
 } md3_t;
 
 b32 _mg_load_md3_fail(gs_byte_buffer_t *buffer, char *msg);
-bool mg_load_md3(char *filename, md3_t *model);
+bool mg_load_md3(char *filename, md3_t *model, bool32_t packed_vertices);
 void mg_free_md3(md3_t *model);
 
 #endif // MODEL_H
\ No newline at end of file
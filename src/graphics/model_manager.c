@@ -8,6 +8,7 @@
 =================================================================*/
 
 #include "model_manager.h"
+#include "../game/config.h"
 #include "../game/console.h"
 #include "../util/string.h"
 
@@ -19,6 +20,8 @@ void mg_model_manager_init()
 	g_model_manager		= gs_malloc_init(mg_model_manager_t);
 	g_model_manager->models = gs_dyn_array_new(mg_model_t);
 
+	g_model_manager->packed_vertices = mg_cvar("r_packed_vertices")->value.i;
+
 	// Test
 	_mg_model_manager_load("players/sarge/head.md3", "basic");
 	_mg_model_manager_load("players/sarge/upper.md3", "basic");
@@ -77,7 +80,7 @@ bool _mg_model_manager_load(const char *filename, const char *shader)
 	char *path = mg_append_string("assets/models/", filename);
 
 	md3_t *data = gs_malloc_init(md3_t);
-	if (!mg_load_md3(path, data))
+	if (!mg_load_md3(path, data, g_model_manager->packed_vertices))
 	{
 		mg_println("WARN: _mg_model_manager_load failed, model %s", filename);
 		mg_free_md3(data);
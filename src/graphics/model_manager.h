@@ -24,6 +24,8 @@ typedef struct mg_model_t
 typedef struct mg_model_manager_t
 {
 	gs_dyn_array(mg_model_t) models;
+	// Read once at init, renderer pipelines depend on it
+	bool32_t packed_vertices;
 } mg_model_manager_t;
 
 void mg_model_manager_init();
@@ -7,7 +7,10 @@
 	...
 =================================================================*/
 
+#include <float.h>
+
 #include "renderer.h"
+#include "../bsp/bsp_occlusion.h"
 #include "../game/config.h"
 #include "../game/console.h"
 #include "../game/game_manager.h"
@@ -37,6 +40,13 @@ void mg_renderer_init(uint32_t window_handle)
 	_mg_renderer_load_shader("post");
 	_mg_renderer_load_shader("wireframe");
 	_mg_renderer_load_shader("bsp_wireframe");
+	_mg_renderer_load_shader_variant("basic", "basic_packed", "MG_PACKED_VERTICES");
+	_mg_renderer_load_shader_variant("wireframe", "wireframe_packed", "MG_PACKED_VERTICES");
+	_mg_renderer_load_shader_variant("bsp", "bsp_packed", "MG_PACKED_VERTICES");
+	_mg_renderer_load_shader_variant("bsp", "bsp_alpha_test", "MG_ALPHA_TEST");
+	_mg_renderer_load_shader_variant("bsp", "bsp_translucent", "MG_TRANSLUCENT");
+	_mg_renderer_load_shader_variant("bsp", "bsp_packed_alpha_test", "MG_PACKED_VERTICES MG_ALPHA_TEST");
+	_mg_renderer_load_shader_variant("bsp", "bsp_packed_translucent", "MG_PACKED_VERTICES MG_TRANSLUCENT");
 
 	g_renderer->clear_color[0] = 0;
 	g_renderer->clear_color[1] = 0;
@@ -208,6 +218,14 @@ void mg_renderer_init(uint32_t window_handle)
 		(gs_graphics_vertex_attribute_desc_t){.format = GS_GRAPHICS_VERTEX_ATTRIBUTE_FLOAT3, .name = "a_normal", .stride = total_stride, .offset = sizeof(float32_t) * 3},
 		(gs_graphics_vertex_attribute_desc_t){.format = GS_GRAPHICS_VERTEX_ATTRIBUTE_FLOAT2, .name = "a_texcoord", .stride = total_stride, .offset = sizeof(float32_t) * 6},
 	};
+	gs_graphics_vertex_attribute_desc_t packed_vattrs[] = {
+		(gs_graphics_vertex_attribute_desc_t){.format = GS_GRAPHICS_VERTEX_ATTRIBUTE_UINT3, .name = "a_packed", .stride = sizeof(mg_md3_packed_vertex_t), .offset = 0},
+	};
+
+	// Models are built with one layout for the whole session
+	bool32_t packed				   = g_model_manager->packed_vertices;
+	gs_graphics_vertex_attribute_desc_t *model_vattrs = packed ? packed_vattrs : vattrs;
+	size_t model_vattrs_size		   = packed ? sizeof(packed_vattrs) : sizeof(vattrs);
 	gs_graphics_vertex_attribute_desc_t post_vattrs[] = {
 		(gs_graphics_vertex_attribute_desc_t){.format = GS_GRAPHICS_VERTEX_ATTRIBUTE_FLOAT2, .name = "a_pos", .stride = sizeof(float32_t) * 2, .offset = 0},
 	};
@@ -216,29 +234,24 @@ void mg_renderer_init(uint32_t window_handle)
 	g_renderer->pipe = gs_graphics_pipeline_create(
 		&(gs_graphics_pipeline_desc_t){
 			.raster = {
-				.shader			   = mg_renderer_get_shader("basic"),
+				.shader			   = mg_renderer_get_shader(packed ? "basic_packed" : "basic"),
 				.index_buffer_element_size = sizeof(int32_t),
 				.primitive		   = GS_GRAPHICS_PRIMITIVE_TRIANGLES,
 				.face_culling		   = GS_GRAPHICS_FACE_CULLING_BACK,
 				.winding_order		   = GS_GRAPHICS_WINDING_ORDER_CW,
 			},
-			.blend = {
-				.func = GS_GRAPHICS_BLEND_EQUATION_ADD,
-				.src  = GS_GRAPHICS_BLEND_MODE_SRC_ALPHA,
-				.dst  = GS_GRAPHICS_BLEND_MODE_ONE_MINUS_SRC_ALPHA,
-			},
 			.depth = {
 				.func = GS_GRAPHICS_DEPTH_FUNC_LESS,
 			},
 			.layout = {
-				.attrs = vattrs,
-				.size  = sizeof(vattrs),
+				.attrs = model_vattrs,
+				.size  = model_vattrs_size,
 			},
 		});
 	g_renderer->viewmodel_pipe = gs_graphics_pipeline_create(
 		&(gs_graphics_pipeline_desc_t){
 			.raster = {
-				.shader			   = mg_renderer_get_shader("basic"),
+				.shader			   = mg_renderer_get_shader(packed ? "basic_packed" : "basic"),
 				.index_buffer_element_size = sizeof(int32_t),
 				.primitive		   = GS_GRAPHICS_PRIMITIVE_TRIANGLES,
 				.face_culling		   = GS_GRAPHICS_FACE_CULLING_BACK,
@@ -253,14 +266,14 @@ void mg_renderer_init(uint32_t window_handle)
 				.func = GS_GRAPHICS_DEPTH_FUNC_LESS,
 			},
 			.layout = {
-				.attrs = vattrs,
-				.size  = sizeof(vattrs),
+				.attrs = model_vattrs,
+				.size  = model_vattrs_size,
 			},
 		});
 	g_renderer->wire_pipe = gs_graphics_pipeline_create(
 		&(gs_graphics_pipeline_desc_t){
 			.raster = {
-				.shader			   = mg_renderer_get_shader("wireframe"),
+				.shader			   = mg_renderer_get_shader(packed ? "wireframe_packed" : "wireframe"),
 				.index_buffer_element_size = sizeof(int32_t),
 				.primitive		   = GS_GRAPHICS_PRIMITIVE_LINE_LOOP,
 			},
@@ -273,8 +286,8 @@ void mg_renderer_init(uint32_t window_handle)
 				.func = GS_GRAPHICS_DEPTH_FUNC_LESS,
 			},
 			.layout = {
-				.attrs = vattrs,
-				.size  = sizeof(vattrs),
+				.attrs = model_vattrs,
+				.size  = model_vattrs_size,
 			},
 		});
 	g_renderer->post_pipe = gs_graphics_pipeline_create(
@@ -622,6 +635,11 @@ void _mg_renderer_models_pass()
 {
 	mg_time_manager_models_start();
 
+	if (g_game_manager != NULL && g_game_manager->map != NULL)
+	{
+		g_game_manager->map->stats.culled_renderables_occlusion = 0;
+	}
+
 	if (gs_slot_array_size(g_renderer->renderables) == 0)
 	{
 		mg_time_manager_models_end();
@@ -694,6 +712,12 @@ void _mg_renderer_models_pass()
 			       .binding = 1, // VERTEX
 		       };
 
+		if (_mg_renderer_renderable_occluded(renderable))
+		{
+			g_game_manager->map->stats.culled_renderables_occlusion++;
+			continue;
+		}
+
 		gs_vec4_t color		  = gs_v4(1.0, 1.0, 1.0, 1.0);
 		mg_renderer_light_t light = {0};
 
@@ -823,6 +847,32 @@ void _mg_renderer_models_pass()
 
 // TODO: this has a lot of duplicate code from models pass,
 // create helpers for common stuff.
+// Test bounds of the current frame against the map's occlusion buffer.
+// Call after u_view is updated.
+bool32_t _mg_renderer_renderable_occluded(const mg_renderable_t *renderable)
+{
+	if (g_game_manager == NULL || g_game_manager->map == NULL || !g_game_manager->map->valid) return false;
+	if (!g_game_manager->map->occlusion.rendered) return false;
+
+	md3_frame_t frame = renderable->model.data->frames[renderable->frame];
+	gs_vec3 mins	  = gs_v3(FLT_MAX, FLT_MAX, FLT_MAX);
+	gs_vec3 maxs	  = gs_v3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (size_t i = 0; i < 8; i++)
+	{
+		gs_vec4 corner = gs_mat4_mul_vec4(
+			renderable->u_view,
+			gs_v4(
+				i & 1 ? frame.bounds_max.x : frame.bounds_min.x,
+				i & 2 ? frame.bounds_max.y : frame.bounds_min.y,
+				i & 4 ? frame.bounds_max.z : frame.bounds_min.z,
+				1.0f));
+		mins = gs_v3(gs_min(mins.x, corner.x), gs_min(mins.y, corner.y), gs_min(mins.z, corner.z));
+		maxs = gs_v3(gs_max(maxs.x, corner.x), gs_max(maxs.y, corner.y), gs_max(maxs.z, corner.z));
+	}
+
+	return !bsp_occlusion_test_aabb(&g_game_manager->map->occlusion, mins, maxs);
+}
+
 void _mg_renderer_viewmodel_pass()
 {
 	mg_time_manager_viewmodel_start();
@@ -1097,6 +1147,13 @@ void _mg_renderer_post_pass()
 }
 
 void _mg_renderer_load_shader(char *name)
+{
+	_mg_renderer_load_shader_variant(name, name, NULL);
+}
+
+// Load shader files of name with define added after #version,
+// registered as variant.
+void _mg_renderer_load_shader_variant(char *name, char *variant, char *define)
 {
 	// Get paths to shaders
 	char *base_path = "assets/shaders/";
@@ -1137,10 +1194,12 @@ void _mg_renderer_load_shader(char *name)
 	// Read from files
 	char *vert_src = gs_platform_read_file_contents(vert, "r", &sz);
 	mg_println("_mg_renderer_load_shader read %zu bytes from %s", sz, vert);
+	if (define != NULL) vert_src = _mg_renderer_shader_add_define(vert_src, define);
 	gs_dyn_array_push(g_renderer->shader_sources_vert, vert_src);
 
 	char *frag_src = gs_platform_read_file_contents(frag, "r", &sz);
 	mg_println("_mg_renderer_load_shader read %zu bytes from %s", sz, frag);
+	if (define != NULL) frag_src = _mg_renderer_shader_add_define(frag_src, define);
 	gs_dyn_array_push(g_renderer->shader_sources_frag, frag_src);
 
 	// Create description
@@ -1154,15 +1213,56 @@ void _mg_renderer_load_shader(char *name)
 		&(gs_graphics_shader_desc_t){
 			.sources = sources,
 			.size	 = sizeof(sources),
-			.name	 = name,
+			.name	 = variant,
 		});
 
 	gs_dyn_array_push(g_renderer->shaders, shader);
 	// make a persistent copy
-	char *name_cpy = gs_malloc(strlen(name) + 1);
-	memcpy(name_cpy, name, strlen(name) + 1);
+	char *name_cpy = gs_malloc(strlen(variant) + 1);
+	memcpy(name_cpy, variant, strlen(variant) + 1);
 	gs_dyn_array_push(g_renderer->shader_names, name_cpy);
 
 	gs_free(vert);
 	gs_free(frag);
+}
+
+// Insert space separated defines on the lines after #version, frees src
+char *_mg_renderer_shader_add_define(char *src, char *define)
+{
+	// #version may follow a header comment
+	char *version  = strstr(src, "#version");
+	char *line_end = strchr(version != NULL ? version : src, '\n');
+	size_t head    = line_end != NULL ? (size_t)(line_end - src) + 1 : strlen(src);
+
+	size_t num_defines = 1;
+	for (char *c = define; *c != '\0'; c++)
+	{
+		if (*c == ' ') num_defines++;
+	}
+
+	size_t sz = strlen(src) + strlen(define) + num_defines * strlen("#define \n") + 2;
+	char *out = gs_malloc(sz);
+
+	memcpy(out, src, head);
+	out[head] = '\0';
+	if (line_end == NULL) strcat(out, "\n");
+
+	char *start = define;
+	while (*start != '\0')
+	{
+		char *end  = strchr(start, ' ');
+		size_t len = end != NULL ? (size_t)(end - start) : strlen(start);
+
+		strcat(out, "#define ");
+		strncat(out, start, len);
+		strcat(out, "\n");
+
+		start += len;
+		while (*start == ' ') start++;
+	}
+
+	strcat(out, src + head);
+
+	gs_free(src);
+	return out;
 }
\ No newline at end of file
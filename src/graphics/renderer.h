@@ -99,11 +99,14 @@ void mg_renderer_set_hidden(uint32_t id, bool hidden);
 void mg_renderer_set_model_type(uint32_t id, mg_model_type type);
 void _mg_renderer_resize(const gs_vec2 fb);
 void _mg_renderer_models_pass();
+bool32_t _mg_renderer_renderable_occluded(const mg_renderable_t *renderable);
 void _mg_renderer_viewmodel_pass();
 void _mg_renderer_post_pass();
 void _mg_renderer_immediate_pass();
 void _mg_renderer_draw_debug_overlay();
 void _mg_renderer_load_shader(char *name);
+void _mg_renderer_load_shader_variant(char *name, char *variant, char *define);
+char *_mg_renderer_shader_add_define(char *src, char *define);
 
 extern mg_renderer_t *g_renderer;
 
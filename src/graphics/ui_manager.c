@@ -8,6 +8,7 @@
 =================================================================*/
 
 #include "ui_manager.h"
+#include "../bsp/bsp_trace.h"
 #include "../game/console.h"
 #include "../game/game_manager.h"
 #include "../game/time_manager.h"
@@ -391,6 +392,8 @@ void _mg_ui_manager_debug_overlay(gs_vec2 fbs, gs_gui_container_t *root)
 
 		sprintf(tmp, "update: %.2fms", g_time_manager->update * 1000.0);
 		DRAW_TMP(10, tmp_y)
+		sprintf(tmp, "collision: %.2fms", g_time_manager->collision * 1000.0);
+		DRAW_TMP(15, tmp_y)
 
 		sprintf(tmp, "render: %.2fms", g_time_manager->render * 1000.0);
 		DRAW_TMP(10, tmp_y)
@@ -431,8 +434,24 @@ void _mg_ui_manager_debug_overlay(gs_vec2 fbs, gs_gui_container_t *root)
 			DRAW_TMP(10, tmp_y)
 			sprintf(tmp, "faces: %zu/%zu", g_game_manager->map->stats.visible_faces, g_game_manager->map->stats.total_faces);
 			DRAW_TMP(10, tmp_y)
+			sprintf(tmp, "backface culled: %zu", g_game_manager->map->stats.culled_faces_backface);
+			DRAW_TMP(10, tmp_y)
+			sprintf(tmp, "nodraw/sky skipped: %zu", g_game_manager->map->stats.skipped_faces_nodraw);
+			DRAW_TMP(10, tmp_y)
+			sprintf(tmp, "occlusion culled: %zu", g_game_manager->map->stats.culled_faces_occlusion);
+			DRAW_TMP(10, tmp_y)
+			sprintf(tmp, "occluders: %zu", g_game_manager->map->stats.drawn_occluders);
+			DRAW_TMP(10, tmp_y)
 			sprintf(tmp, "patches: %zu/%zu", g_game_manager->map->stats.visible_patches, g_game_manager->map->stats.total_patches);
 			DRAW_TMP(10, tmp_y)
+			sprintf(tmp, "models: %zu/%zu", g_game_manager->map->stats.visible_models, g_game_manager->map->stats.models);
+			DRAW_TMP(10, tmp_y)
+			sprintf(tmp, "renderables occlusion culled: %zu", g_game_manager->map->stats.culled_renderables_occlusion);
+			DRAW_TMP(10, tmp_y)
+			sprintf(tmp, "batches: %zu/%zu", g_game_manager->map->stats.visible_batches, g_game_manager->map->stats.total_materials);
+			DRAW_TMP(10, tmp_y)
+			sprintf(tmp, "acmr: %.2f -> %.2f", g_game_manager->map->stats.acmr_before, g_game_manager->map->stats.acmr_after);
+			DRAW_TMP(10, tmp_y)
 			sprintf(tmp, "leaf: %zu, cluster: %d", g_game_manager->map->stats.current_leaf, g_game_manager->map->leaves.data[g_game_manager->map->stats.current_leaf].cluster);
 			DRAW_TMP(10, tmp_y)
 			sprintf(tmp, "leaves:");
@@ -441,10 +460,34 @@ void _mg_ui_manager_debug_overlay(gs_vec2 fbs, gs_gui_container_t *root)
 			DRAW_TMP(15, tmp_y)
 			sprintf(tmp, "pvs culled: %zu", g_game_manager->map->stats.culled_leaves_pvs);
 			DRAW_TMP(15, tmp_y)
-			sprintf(tmp, "frustum culled: %zu", g_game_manager->map->stats.culled_leaves_frustum);
+			sprintf(tmp, "area culled: %zu", g_game_manager->map->stats.culled_leaves_area);
+			DRAW_TMP(15, tmp_y)
+			sprintf(tmp, "frustum culled: %zu (%zu nodes)", g_game_manager->map->stats.culled_leaves_frustum, g_game_manager->map->stats.culled_nodes_frustum);
+			DRAW_TMP(15, tmp_y)
+			sprintf(tmp, "frustum tested: %zu", g_game_manager->map->stats.tested_leaves_frustum);
+			DRAW_TMP(15, tmp_y)
+			sprintf(tmp, "occlusion culled: %zu", g_game_manager->map->stats.culled_leaves_occlusion);
 			DRAW_TMP(15, tmp_y)
 			sprintf(tmp, "visible: %zu", g_game_manager->map->stats.visible_leaves);
 			DRAW_TMP(15, tmp_y)
+
+			bsp_trace_counters_t traces = bsp_trace_stats_total(g_bsp_trace_stats.last);
+			sprintf(tmp, "traces: %zu ray, %zu sphere, %zu box", (size_t)traces.traces[RAY], (size_t)traces.traces[SPHERE], (size_t)traces.traces[BOX]);
+			DRAW_TMP(10, tmp_y)
+			sprintf(tmp, "nodes: %zu, leaves: %zu", (size_t)traces.nodes, (size_t)traces.leaves);
+			DRAW_TMP(15, tmp_y)
+			sprintf(tmp, "brushes: %zu, sides: %zu", (size_t)traces.brushes, (size_t)traces.sides);
+			DRAW_TMP(15, tmp_y)
+			sprintf(tmp, "patches: %zu", (size_t)traces.patches);
+			DRAW_TMP(15, tmp_y)
+			for (size_t i = 0; i < BSP_TRACE_CALLER_COUNT; i++)
+			{
+				const bsp_trace_counters_t *caller = &g_bsp_trace_stats.last[i];
+				size_t count			   = caller->traces[RAY] + caller->traces[SPHERE] + caller->traces[BOX];
+				if (count == 0) continue;
+				sprintf(tmp, "%s: %zu, %zu brushes, %.2fms", bsp_trace_caller_name(i), count, (size_t)caller->brushes, caller->time_ns / 1e6);
+				DRAW_TMP(15, tmp_y)
+			}
 		}
 
 		// draw player stats
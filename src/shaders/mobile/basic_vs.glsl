@@ -1,8 +1,13 @@
 #version 300 es
 
+#ifdef MG_PACKED_VERTICES
+// int16 x, y | int16 z, oct snorm8x2 normal | half2 texcoord
+layout(location = 0) in uvec3 a_packed;
+#else
 layout(location = 0) in vec3 a_pos;
 layout(location = 1) in vec3 a_normal;
 layout(location = 2) in vec2 a_texcoord;
+#endif
 
 uniform mat4 u_proj;
 uniform mat4 u_view;
@@ -10,8 +15,43 @@ uniform mat4 u_view;
 out vec3 v_normal;
 out vec2 v_texcoord;
 
+#ifdef MG_PACKED_VERTICES
+vec2 mg_unpack_half2(uint u)
+{
+	return unpackHalf2x16(u);
+}
+
+vec3 mg_oct_decode(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+	{
+		vec2 s = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+		n.xy   = (1.0 - abs(n.yx)) * s;
+	}
+	return normalize(n);
+}
+
+float mg_snorm8(int v)
+{
+	return max(float(v) / 127.0, -1.0);
+}
+#endif
+
 void main()
 {
+#ifdef MG_PACKED_VERTICES
+	// Sign extend int16 and int8 components
+	vec3 a_pos = vec3(
+		float(int(a_packed.x << 16u) >> 16),
+		float(int(a_packed.x) >> 16),
+		float(int(a_packed.y << 16u) >> 16)) / 64.0;
+	vec3 a_normal = mg_oct_decode(vec2(
+		mg_snorm8(int(a_packed.y << 8u) >> 24),
+		mg_snorm8(int(a_packed.y) >> 24)));
+	vec2 a_texcoord = mg_unpack_half2(a_packed.z);
+#endif
+
 	v_normal = -normalize(mat3(u_view) * a_normal);
 	v_texcoord = a_texcoord;
 
@@ -13,11 +13,24 @@ void main()
 	mediump vec4 tex = texture(u_tex, tex_coord);
 	mediump vec4 lm = texture(u_lm, lm_coord);
 
-	// magic values for the look I want
-	mediump float lm_strength = 2.8;
+	// magic values for the look I want,
+	// lightmap overbright and gamma are baked in at load.
 	mediump float gamma = 1.15;
+	mediump float lm_range = 2.5;
 
-	frag_color = tex * lm * lm_strength;
-	frag_color.rgb = pow(frag_color.rgb, vec3(1.0/gamma));
+#ifdef MG_ALPHA_TEST
+	if (tex.a < 0.5)
+	{
+		discard;
+	}
+#endif
+
+	frag_color.rgb = pow(tex.rgb, vec3(1.0/gamma)) * lm.rgb * lm_range;
+#ifdef MG_TRANSLUCENT
+	// Blend shaders aren't parsed, keep surfaces see-through
+	mediump float max_alpha = 0.75;
+	frag_color.a = min(tex.a, max_alpha);
+#else
 	frag_color.a = 1.0;
+#endif
 }
\ No newline at end of file
@@ -1,19 +1,43 @@
 #version 300 es
 
 layout(location = 0) in vec3 a_pos;
+#ifdef MG_PACKED_VERTICES
+// half2 tex coord | unorm16x2 lightmap coord | oct snorm16x2 normal
+layout(location = 1) in uvec3 a_packed;
+#else
 layout(location = 1) in vec2 a_tex_coord;
 layout(location = 2) in vec2 a_lm_coord;
 layout(location = 3) in vec3 a_normal;
 layout(location = 4) in vec4 a_color;
+#endif
 
 uniform mat4 u_proj;
+// Transform of brush submodels, identity for the world
+uniform mat4 u_model;
 
 out vec2 tex_coord;
 out vec2 lm_coord;
 
+#ifdef MG_PACKED_VERTICES
+vec2 mg_unpack_half2(uint u)
+{
+	return unpackHalf2x16(u);
+}
+
+vec2 mg_unpack_unorm16x2(uint u)
+{
+	return unpackUnorm2x16(u);
+}
+#endif
+
 void main()
 {
-	gl_Position = u_proj * vec4(a_pos, 1.0);
+#ifdef MG_PACKED_VERTICES
+	vec2 a_tex_coord = mg_unpack_half2(a_packed.x);
+	vec2 a_lm_coord	 = mg_unpack_unorm16x2(a_packed.y);
+#endif
+
+	gl_Position = u_proj * u_model * vec4(a_pos, 1.0);
 	tex_coord = a_tex_coord;
 	lm_coord = a_lm_coord;
 }
\ No newline at end of file
@@ -3,8 +3,9 @@
 layout(location = 0) in mediump vec3 a_pos;
 
 uniform mediump mat4 u_proj;
+uniform mediump mat4 u_model;
 
 void main()
 {
-	gl_Position = u_proj * vec4(a_pos, 1.0);
+	gl_Position = u_proj * u_model * vec4(a_pos, 1.0);
 }
\ No newline at end of file
@@ -1,11 +1,22 @@
 #version 300 es
 
+#ifdef MG_PACKED_VERTICES
+layout(location = 0) in uvec3 a_packed;
+#else
 layout(location = 0) in mediump vec3 a_pos;
+#endif
 
 uniform mediump mat4 u_proj;
 uniform mediump mat4 u_view;
 
 void main()
 {
+#ifdef MG_PACKED_VERTICES
+	mediump vec3 a_pos = vec3(
+		float(int(a_packed.x << 16u) >> 16),
+		float(int(a_packed.x) >> 16),
+		float(int(a_packed.y << 16u) >> 16)) / 64.0;
+#endif
+
 	gl_Position = u_proj * u_view * vec4(a_pos, 1.0);
 }
\ No newline at end of file
@@ -10,19 +10,51 @@
 #version 330 core
 
 layout(location = 0) in vec3 a_pos;
+#ifdef MG_PACKED_VERTICES
+// half2 tex coord | unorm16x2 lightmap coord | oct snorm16x2 normal
+layout(location = 1) in uvec3 a_packed;
+#else
 layout(location = 1) in vec2 a_tex_coord;
 layout(location = 2) in vec2 a_lm_coord;
 layout(location = 3) in vec3 a_normal;
 layout(location = 4) in vec4 a_color;
+#endif
 
 uniform mat4 u_proj;
+// Transform of brush submodels, identity for the world
+uniform mat4 u_model;
 
 out vec2 tex_coord;
 out vec2 lm_coord;
 
+#ifdef MG_PACKED_VERTICES
+float mg_half_to_float(uint h)
+{
+	uint e = (h >> 10u) & 0x1fu;
+	float m = float(h & 0x3ffu);
+	float v = e == 0u ? m * exp2(-24.0) : (1.0 + m / 1024.0) * exp2(float(e) - 15.0);
+	return (h & 0x8000u) != 0u ? -v : v;
+}
+
+vec2 mg_unpack_half2(uint u)
+{
+	return vec2(mg_half_to_float(u & 0xffffu), mg_half_to_float(u >> 16u));
+}
+
+vec2 mg_unpack_unorm16x2(uint u)
+{
+	return vec2(float(u & 0xffffu), float(u >> 16u)) / 65535.0;
+}
+#endif
+
 void main()
 {
-	gl_Position = u_proj * vec4(a_pos, 1.0);
+#ifdef MG_PACKED_VERTICES
+	vec2 a_tex_coord = mg_unpack_half2(a_packed.x);
+	vec2 a_lm_coord	 = mg_unpack_unorm16x2(a_packed.y);
+#endif
+
+	gl_Position = u_proj * u_model * vec4(a_pos, 1.0);
 	tex_coord = a_tex_coord;
 	lm_coord = a_lm_coord;
 }
\ No newline at end of file
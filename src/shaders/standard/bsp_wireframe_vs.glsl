@@ -12,8 +12,9 @@
 layout(location = 0) in vec3 a_pos;
 
 uniform mat4 u_proj;
+uniform mat4 u_model;
 
 void main()
 {
-	gl_Position = u_proj * vec4(a_pos, 1.0);
+	gl_Position = u_proj * u_model * vec4(a_pos, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,445 @@
+/*================================================================
+	* trace_bench.c
+	*
+	* Copyright (c) 2022 Lauri Räsänen
+	* ================================
+
+	Headless benchmark for BSP traces.
+	Runs a fixed corpus of rays and boxes through a map,
+	reports time per trace and compares results to a golden file.
+=================================================================*/
+
+#define GS_NO_HIJACK_MAIN
+#define GS_IMPL
+#include <gs/gs.h>
+#define GS_IMMEDIATE_DRAW_IMPL
+#include <gs/util/gs_idraw.h>
+#define GS_GUI_IMPL
+#include <gs/util/gs_gui.h>
+
+#include "bsp/bsp_loader.h"
+#include "bsp/bsp_map.h"
+#include "bsp/bsp_trace.h"
+#include "util/timer.h"
+
+#define MG_BENCH_DEFAULT_MAP	"assets/maps/q3dm1.bsp"
+#define MG_BENCH_DEFAULT_COUNT	20000
+#define MG_BENCH_DEFAULT_PASSES 5
+#define MG_BENCH_SEED		0x6d795f67
+#define MG_BENCH_MAX_LENGTH	1024.0f
+#define MG_BENCH_CONTENT_MASK	(BSP_CONTENT_CONTENTS_SOLID | BSP_CONTENT_CONTENTS_PLAYERCLIP)
+// Default golden files, relative to bin
+#define MG_BENCH_GOLDEN_DIR "../test/"
+// Allowed difference to the golden file
+#define MG_BENCH_EPSILON 0.001f
+// Mismatches to print before staying quiet
+#define MG_BENCH_MAX_REPORTS 10
+
+// Boxes the game traces with
+static const float32_t _mg_bench_box_sizes[][2][3] = {
+	{{-16.0f, -16.0f, -24.0f}, {16.0f, 16.0f, 32.0f}}, // player
+	{{-16.0f, -16.0f, -24.0f}, {16.0f, 16.0f, 16.0f}}, // player crouched
+	{{-15.0f, -15.0f, -24.0f}, {15.0f, 15.0f, 32.0f}}, // monster
+	{{-2.0f, -2.0f, -2.0f}, {2.0f, 2.0f, 2.0f}},	   // small
+};
+
+typedef struct mg_bench_result_t
+{
+	float32_t fraction;
+	gs_vec3 end;
+	gs_vec3 normal;
+	int32_t start_solid;
+	int32_t all_solid;
+	int32_t contents;
+} mg_bench_result_t;
+
+static uint32_t _mg_bench_random_state;
+
+// Same numbers on every platform, unlike rand()
+static inline uint32_t _mg_bench_random()
+{
+	_mg_bench_random_state = _mg_bench_random_state * 1664525u + 1013904223u;
+	return _mg_bench_random_state >> 8;
+}
+
+// [0, 1)
+static inline float32_t _mg_bench_random_float()
+{
+	return (float32_t)_mg_bench_random() / (float32_t)(1u << 24);
+}
+
+static inline float32_t _mg_bench_random_range(float32_t min, float32_t max)
+{
+	return min + (max - min) * _mg_bench_random_float();
+}
+
+static int _mg_bench_compare_u64(const void *a, const void *b)
+{
+	uint64_t value_a = *(const uint64_t *)a;
+	uint64_t value_b = *(const uint64_t *)b;
+	return (value_a > value_b) - (value_a < value_b);
+}
+
+// Start points in empty leaves, end points in any direction
+void _mg_bench_generate(bsp_map_t *map, bsp_trace_query_t *queries, uint32_t count, uint32_t seed)
+{
+	gs_dyn_array(uint32_t) empty_leaves = NULL;
+	for (size_t i = 0; i < map->leaves.count; i++)
+	{
+		if (map->leaves.data[i].cluster >= 0)
+		{
+			gs_dyn_array_push(empty_leaves, i);
+		}
+	}
+
+	_mg_bench_random_state = seed;
+	uint32_t num_boxes     = sizeof(_mg_bench_box_sizes) / sizeof(_mg_bench_box_sizes[0]);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		gs_vec3 start = gs_v3(0, 0, 0);
+		if (gs_dyn_array_size(empty_leaves) > 0)
+		{
+			bsp_leaf_lump_t leaf = map->leaves.data[empty_leaves[_mg_bench_random() % gs_dyn_array_size(empty_leaves)]];
+			start.x		     = _mg_bench_random_range(leaf.mins[0], leaf.maxs[0]);
+			start.y		     = _mg_bench_random_range(leaf.mins[1], leaf.maxs[1]);
+			start.z		     = _mg_bench_random_range(leaf.mins[2], leaf.maxs[2]);
+		}
+
+		gs_vec3 dir = gs_v3(
+			_mg_bench_random_range(-1.0f, 1.0f),
+			_mg_bench_random_range(-1.0f, 1.0f),
+			_mg_bench_random_range(-1.0f, 1.0f));
+		if (gs_vec3_len2(dir) < GS_EPSILON) dir = gs_v3(0, 0, -1.0f);
+		dir = gs_vec3_norm(dir);
+
+		queries[i] = (bsp_trace_query_t){
+			.type	      = RAY,
+			.start	      = start,
+			.end	      = gs_vec3_add(start, gs_vec3_scale(dir, _mg_bench_random_range(1.0f, MG_BENCH_MAX_LENGTH))),
+			.content_mask = MG_BENCH_CONTENT_MASK,
+		};
+
+		// Every other one is a box
+		if (_mg_bench_random() % 2 == 0)
+		{
+			const float32_t(*box)[3] = _mg_bench_box_sizes[_mg_bench_random() % num_boxes];
+			queries[i].type		 = BOX;
+			queries[i].mins		 = gs_v3(box[0][0], box[0][1], box[0][2]);
+			queries[i].maxs		 = gs_v3(box[1][0], box[1][1], box[1][2]);
+		}
+	}
+
+	gs_dyn_array_free(empty_leaves);
+}
+
+mg_bench_result_t _mg_bench_result(const bsp_trace_t *trace)
+{
+	return (mg_bench_result_t){
+		.fraction    = trace->fraction,
+		.end	     = trace->end,
+		.normal	     = trace->normal,
+		.start_solid = trace->start_solid,
+		.all_solid   = trace->all_solid,
+		.contents    = trace->contents,
+	};
+}
+
+// Time every trace on its own, samples gets count * passes entries
+void _mg_bench_run(bsp_map_t *map, const bsp_trace_query_t *queries, mg_bench_result_t *results, uint64_t *samples, uint32_t count, uint32_t passes)
+{
+	// Warm up caches and thread scratch
+	for (size_t i = 0; i < count; i++)
+	{
+		bsp_trace_t trace = {.map = map};
+		bsp_trace_query(&trace, &queries[i]);
+		results[i] = _mg_bench_result(&trace);
+	}
+	bsp_trace_stats_end_frame();
+
+	for (size_t pass = 0; pass < passes; pass++)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			bsp_trace_t trace = {.map = map};
+			uint64_t start	  = mg_timer_now_ns();
+			bsp_trace_query(&trace, &queries[i]);
+			samples[pass * count + i] = mg_timer_now_ns() - start;
+		}
+	}
+}
+
+void _mg_bench_report(const char *name, uint64_t *samples, uint32_t count)
+{
+	if (count == 0) return;
+
+	uint64_t total = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		total += samples[i];
+	}
+	qsort(samples, count, sizeof(uint64_t), _mg_bench_compare_u64);
+
+	printf(
+		"%-6s %8u traces, mean %7.1f ns, p50 %6zu ns, p90 %6zu ns, p99 %6zu ns, max %8zu ns\n",
+		name,
+		count,
+		(double)total / count,
+		(size_t)samples[count / 2],
+		(size_t)samples[(size_t)(count * 0.9)],
+		(size_t)samples[(size_t)(count * 0.99)],
+		(size_t)samples[count - 1]);
+}
+
+bool _mg_bench_write_golden(const char *filepath, const mg_bench_result_t *results, uint32_t count, uint32_t seed)
+{
+	FILE *file = fopen(filepath, "w");
+	if (file == NULL)
+	{
+		printf("WARN: failed to open golden file '%s' for writing\n", filepath);
+		return false;
+	}
+
+	fprintf(file, "tracebench %u %u\n", count, seed);
+	for (size_t i = 0; i < count; i++)
+	{
+		const mg_bench_result_t *r = &results[i];
+		fprintf(
+			file,
+			"%.6f %.4f %.4f %.4f %.4f %.4f %.4f %d %d %d\n",
+			r->fraction,
+			r->end.x, r->end.y, r->end.z,
+			r->normal.x, r->normal.y, r->normal.z,
+			r->start_solid, r->all_solid, r->contents);
+	}
+
+	fclose(file);
+	printf("Wrote %u results to '%s'\n", count, filepath);
+	return true;
+}
+
+static inline bool _mg_bench_close(float32_t a, float32_t b, float32_t epsilon)
+{
+	return fabsf(a - b) <= epsilon * gs_max(1.0f, fabsf(b));
+}
+
+// Returns the number of mismatches, -1 if the file can't be used
+int32_t _mg_bench_compare_golden(const char *filepath, const bsp_trace_query_t *queries, const mg_bench_result_t *results, uint32_t count, uint32_t seed)
+{
+	FILE *file = fopen(filepath, "r");
+	if (file == NULL)
+	{
+		printf("WARN: missing golden file '%s', run with --write-golden to create it\n", filepath);
+		return -1;
+	}
+
+	uint32_t golden_count = 0;
+	uint32_t golden_seed  = 0;
+	if (fscanf(file, "tracebench %u %u", &golden_count, &golden_seed) != 2 || golden_count != count || golden_seed != seed)
+	{
+		printf("WARN: golden file '%s' was written for a different corpus\n", filepath);
+		fclose(file);
+		return -1;
+	}
+
+	int32_t mismatches = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		mg_bench_result_t g = {0};
+
+		int32_t read = fscanf(
+			file,
+			"%f %f %f %f %f %f %f %d %d %d",
+			&g.fraction,
+			&g.end.x, &g.end.y, &g.end.z,
+			&g.normal.x, &g.normal.y, &g.normal.z,
+			&g.start_solid, &g.all_solid, &g.contents);
+		if (read != 10)
+		{
+			printf("WARN: golden file '%s' ends at trace %zu\n", filepath, i);
+			fclose(file);
+			return -1;
+		}
+
+		const mg_bench_result_t *r = &results[i];
+
+		bool same = r->start_solid == g.start_solid && r->all_solid == g.all_solid;
+		same &= _mg_bench_close(r->fraction, g.fraction, MG_BENCH_EPSILON);
+		same &= _mg_bench_close(r->end.x, g.end.x, MG_BENCH_EPSILON);
+		same &= _mg_bench_close(r->end.y, g.end.y, MG_BENCH_EPSILON);
+		same &= _mg_bench_close(r->end.z, g.end.z, MG_BENCH_EPSILON);
+
+		// Which plane gets reported only matters on a hit
+		if (r->fraction < 1.0f)
+		{
+			same &= r->contents == g.contents;
+			same &= _mg_bench_close(r->normal.x, g.normal.x, MG_BENCH_EPSILON);
+			same &= _mg_bench_close(r->normal.y, g.normal.y, MG_BENCH_EPSILON);
+			same &= _mg_bench_close(r->normal.z, g.normal.z, MG_BENCH_EPSILON);
+		}
+
+		if (!same)
+		{
+			if (mismatches < MG_BENCH_MAX_REPORTS)
+			{
+				const bsp_trace_query_t *q = &queries[i];
+				printf(
+					"MISMATCH %zu: %s [%.2f, %.2f, %.2f] -> [%.2f, %.2f, %.2f], fraction %f (golden %f), normal [%.3f, %.3f, %.3f] (golden [%.3f, %.3f, %.3f])\n",
+					i,
+					q->type == BOX ? "box" : "ray",
+					q->start.x, q->start.y, q->start.z,
+					q->end.x, q->end.y, q->end.z,
+					r->fraction, g.fraction,
+					r->normal.x, r->normal.y, r->normal.z,
+					g.normal.x, g.normal.y, g.normal.z);
+			}
+			mismatches++;
+		}
+	}
+
+	fclose(file);
+	return mismatches;
+}
+
+void _mg_bench_usage()
+{
+	printf("Usage: tracebench [map.bsp] [--count N] [--passes N] [--seed N] [--golden file] [--write-golden]\n");
+	printf("Defaults: %s, %u traces, %u passes, golden file in %s\n", MG_BENCH_DEFAULT_MAP, MG_BENCH_DEFAULT_COUNT, MG_BENCH_DEFAULT_PASSES, MG_BENCH_GOLDEN_DIR);
+}
+
+int32_t main(int32_t argc, char **argv)
+{
+	char *map_path	  = MG_BENCH_DEFAULT_MAP;
+	char *golden_path = NULL;
+	uint32_t count	  = MG_BENCH_DEFAULT_COUNT;
+	uint32_t passes	  = MG_BENCH_DEFAULT_PASSES;
+	uint32_t seed	  = MG_BENCH_SEED;
+	bool write_golden = false;
+
+	for (size_t i = 1; i < argc; i++)
+	{
+		bool has_value = i + 1 < argc;
+		if (strcmp(argv[i], "--write-golden") == 0) write_golden = true;
+		else if (strcmp(argv[i], "--count") == 0 && has_value) count = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--passes") == 0 && has_value) passes = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--seed") == 0 && has_value) seed = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--golden") == 0 && has_value) golden_path = argv[++i];
+		else if (argv[i][0] != '-') map_path = argv[i];
+		else
+		{
+			_mg_bench_usage();
+			return 1;
+		}
+	}
+	if (count == 0 || passes == 0)
+	{
+		_mg_bench_usage();
+		return 1;
+	}
+
+	// ../test/<map name>.golden unless given,
+	// outside bin so rebuilding doesn't delete it.
+	char default_golden[256];
+	if (golden_path == NULL)
+	{
+		char *name = map_path;
+		for (char *c = map_path; *c != '\0'; c++)
+		{
+			if (*c == '/' || *c == '\\') name = c + 1;
+		}
+		char *ext	 = strrchr(name, '.');
+		int32_t name_len = ext != NULL ? ext - name : strlen(name);
+		snprintf(default_golden, sizeof(default_golden), "%s%.*s.golden", MG_BENCH_GOLDEN_DIR, name_len, name);
+		golden_path = default_golden;
+	}
+
+	// Only file data and trace data, no renderer or GL context
+	bsp_map_t *map = gs_malloc_init(bsp_map_t);
+	if (!load_bsp(map_path, map))
+	{
+		bsp_map_free(map);
+		return 1;
+	}
+	uint64_t init_start = mg_timer_now_ns();
+	bsp_trace_init(map);
+	printf(
+		"Trace init %.2f ms: %u nodes, %u leaves, %u brushes, %u patches\n",
+		(mg_timer_now_ns() - init_start) / 1e6,
+		map->nodes.count,
+		map->leaves.count,
+		map->num_trace_brushes,
+		gs_dyn_array_size(map->trace_patches));
+
+	bsp_trace_query_t *queries = gs_malloc(sizeof(bsp_trace_query_t) * count);
+	mg_bench_result_t *results = gs_malloc(sizeof(mg_bench_result_t) * count);
+	uint64_t *samples	   = gs_malloc(sizeof(uint64_t) * count * passes);
+	uint64_t *ray_samples	   = gs_malloc(sizeof(uint64_t) * count * passes);
+	uint64_t *box_samples	   = gs_malloc(sizeof(uint64_t) * count * passes);
+	_mg_bench_generate(map, queries, count, seed);
+	_mg_bench_run(map, queries, results, samples, count, passes);
+
+	// Split by type before sorting
+	uint32_t num_rays  = 0;
+	uint32_t num_boxes = 0;
+	for (size_t i = 0; i < count * passes; i++)
+	{
+		if (queries[i % count].type == BOX) box_samples[num_boxes++] = samples[i];
+		else ray_samples[num_rays++] = samples[i];
+	}
+	_mg_bench_report("ray", ray_samples, num_rays);
+	_mg_bench_report("box", box_samples, num_boxes);
+	_mg_bench_report("all", samples, count * passes);
+
+	bsp_trace_stats_end_frame();
+	bsp_trace_counters_t stats = bsp_trace_stats_total(g_bsp_trace_stats.last);
+	uint64_t num_traces	   = count * passes;
+	printf(
+		"Per trace: %.1f nodes, %.1f leaves, %.1f brushes, %.1f sides, %.2f patches\n",
+		(double)stats.nodes / num_traces,
+		(double)stats.leaves / num_traces,
+		(double)stats.brushes / num_traces,
+		(double)stats.sides / num_traces,
+		(double)stats.patches / num_traces);
+
+	// Same corpus through the batch API
+	bsp_trace_t *batch_results = gs_malloc(sizeof(bsp_trace_t) * count);
+	uint64_t batch_start	   = mg_timer_now_ns();
+	bsp_trace_batch(map, queries, batch_results, count, true);
+	uint64_t batch_time = mg_timer_now_ns() - batch_start;
+	uint32_t batch_diff = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (batch_results[i].fraction != results[i].fraction || batch_results[i].start_solid != results[i].start_solid)
+		{
+			batch_diff++;
+		}
+	}
+	printf("batch  %8u traces, %.1f ns per trace, %u differ from single traces\n", count, (double)batch_time / count, batch_diff);
+
+	int32_t status = batch_diff > 0 ? 1 : 0;
+	if (write_golden)
+	{
+		if (!_mg_bench_write_golden(golden_path, results, count, seed)) status = 1;
+	}
+	else
+	{
+		int32_t mismatches = _mg_bench_compare_golden(golden_path, queries, results, count, seed);
+		if (mismatches == 0) printf("Results match '%s'\n", golden_path);
+		else if (mismatches > 0) printf("%d of %u results differ from '%s'\n", mismatches, count, golden_path);
+		if (mismatches != 0) status = 1;
+	}
+
+	gs_free(batch_results);
+	gs_free(box_samples);
+	gs_free(ray_samples);
+	gs_free(samples);
+	gs_free(results);
+	gs_free(queries);
+
+	// Nothing graphical was created, skip that part of freeing
+	map->valid = false;
+	bsp_map_free(map);
+	bsp_trace_free_thread_scratch();
+
+	return status;
+}
\ No newline at end of file
@@ -13,6 +13,7 @@
 #include <gs/gs.h>
 #include <gs/util/gs_idraw.h>
 
+#include "simd.h"
 #include "transform.h"
 
 #ifdef WIN32
@@ -101,31 +102,133 @@ static inline bool mg_camera_point_in_frustum(const mg_camera_frustum_t fr, cons
 
 static inline bool mg_camera_aabb_in_frustum(const mg_camera_frustum_t fr, const gs_vec3 mins, const gs_vec3 maxs)
 {
-	gs_vec3 center	= gs_vec3_scale(gs_vec3_add(mins, maxs), 0.5);
-	float half_size = gs_vec3_len(gs_vec3_sub(maxs, center));
+	for (size_t i = 0; i < 6; i++)
+	{
+		gs_vec4 p = fr.planes[i];
+
+		// If the corner furthest along the plane normal (p-vertex)
+		// is behind any of the planes, the whole box is outside.
+		float distance = p.x * (p.x >= 0 ? maxs.x : mins.x) + p.y * (p.y >= 0 ? maxs.y : mins.y) + p.z * (p.z >= 0 ? maxs.z : mins.z) + p.w;
+		if (distance < 0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
 
+// Test AABB against the frustum planes set in plane_mask.
+// Returns false if the box is fully outside any plane,
+// otherwise clears the bits of planes the box is fully inside of
+// so children of the box can skip testing them.
+static inline bool mg_camera_aabb_in_frustum_masked(const mg_camera_frustum_t *fr, const gs_vec3 mins, const gs_vec3 maxs, uint8_t *plane_mask)
+{
 	for (size_t i = 0; i < 6; i++)
 	{
-		// Distance of AABB center from plane.
-		float distance = (fr.planes[i].x * center.x + fr.planes[i].y * center.y + fr.planes[i].z * center.z) + fr.planes[i].w;
+		if (!(*plane_mask & (1 << i))) continue;
+
+		gs_vec4 p = fr->planes[i];
 
-		// If center of AABB is more than half-diagonal distance away
-		// from any of the 6 planes, it cannot be inside the frustum.
-		if (distance < -half_size)
+		// Corner furthest along the plane normal (p-vertex)
+		float d = p.x * (p.x >= 0 ? maxs.x : mins.x) + p.y * (p.y >= 0 ? maxs.y : mins.y) + p.z * (p.z >= 0 ? maxs.z : mins.z) + p.w;
+		if (d < 0)
 		{
 			return false;
 		}
-		// Intersecting this plane if between +- half-diagonal distance.
-		// (Might actually be just outside the frustum and still return
-		// true since we are using diagonal distance)
-		else if (abs(distance) < half_size)
+
+		// Opposite corner (n-vertex) in front too, no need to test this plane again
+		d = p.x * (p.x >= 0 ? mins.x : maxs.x) + p.y * (p.y >= 0 ? mins.y : maxs.y) + p.z * (p.z >= 0 ? mins.z : maxs.z) + p.w;
+		if (d >= 0)
 		{
-			return true;
+			*plane_mask &= ~(1 << i);
 		}
 	}
 
-	// No planes intersect, is fully inside the frustum.
 	return true;
 }
 
+// Test count AABBs stored as SoA against all 6 frustum planes,
+// same p-vertex test as mg_camera_aabb_in_frustum but 4 boxes at a time.
+// Sets visible[i] to 1 if box i is at least partially inside, 0 otherwise.
+static inline void mg_camera_aabbs_in_frustum(
+	const mg_camera_frustum_t *fr,
+	const float *min_x,
+	const float *min_y,
+	const float *min_z,
+	const float *max_x,
+	const float *max_y,
+	const float *max_z,
+	uint32_t count,
+	uint8_t *visible)
+{
+	// The p-vertex only depends on plane normal signs,
+	// so pick the source arrays once per plane.
+	const float *px[6], *py[6], *pz[6];
+	for (size_t i = 0; i < 6; i++)
+	{
+		px[i] = fr->planes[i].x >= 0 ? max_x : min_x;
+		py[i] = fr->planes[i].y >= 0 ? max_y : min_y;
+		pz[i] = fr->planes[i].z >= 0 ? max_z : min_z;
+	}
+
+	uint32_t i = 0;
+
+#if defined(MG_SIMD_SSE)
+	const __m128 zero = _mm_setzero_ps();
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 outside = zero;
+		for (size_t j = 0; j < 6; j++)
+		{
+			__m128 d = _mm_set1_ps(fr->planes[j].w);
+			d	 = _mm_add_ps(d, _mm_mul_ps(_mm_loadu_ps(px[j] + i), _mm_set1_ps(fr->planes[j].x)));
+			d	 = _mm_add_ps(d, _mm_mul_ps(_mm_loadu_ps(py[j] + i), _mm_set1_ps(fr->planes[j].y)));
+			d	 = _mm_add_ps(d, _mm_mul_ps(_mm_loadu_ps(pz[j] + i), _mm_set1_ps(fr->planes[j].z)));
+			outside	 = _mm_or_ps(outside, _mm_cmplt_ps(d, zero));
+		}
+
+		int mask       = _mm_movemask_ps(outside);
+		visible[i + 0] = !(mask & 1);
+		visible[i + 1] = !(mask & 2);
+		visible[i + 2] = !(mask & 4);
+		visible[i + 3] = !(mask & 8);
+	}
+#elif defined(MG_SIMD_NEON)
+	const float32x4_t zero = vdupq_n_f32(0);
+	for (; i + 4 <= count; i += 4)
+	{
+		uint32x4_t outside = vdupq_n_u32(0);
+		for (size_t j = 0; j < 6; j++)
+		{
+			float32x4_t d = vdupq_n_f32(fr->planes[j].w);
+			d	      = vmlaq_n_f32(d, vld1q_f32(px[j] + i), fr->planes[j].x);
+			d	      = vmlaq_n_f32(d, vld1q_f32(py[j] + i), fr->planes[j].y);
+			d	      = vmlaq_n_f32(d, vld1q_f32(pz[j] + i), fr->planes[j].z);
+			outside	      = vorrq_u32(outside, vcltq_f32(d, zero));
+		}
+
+		visible[i + 0] = vgetq_lane_u32(outside, 0) == 0;
+		visible[i + 1] = vgetq_lane_u32(outside, 1) == 0;
+		visible[i + 2] = vgetq_lane_u32(outside, 2) == 0;
+		visible[i + 3] = vgetq_lane_u32(outside, 3) == 0;
+	}
+#endif
+
+	// Remainder, or everything without SIMD
+	for (; i < count; i++)
+	{
+		visible[i] = 1;
+		for (size_t j = 0; j < 6; j++)
+		{
+			float d = fr->planes[j].x * px[j][i] + fr->planes[j].y * py[j][i] + fr->planes[j].z * pz[j][i] + fr->planes[j].w;
+			if (d < 0)
+			{
+				visible[i] = 0;
+				break;
+			}
+		}
+	}
+}
+
 #endif // MG_UTIL_CAMERA_H
\ No newline at end of file
@@ -0,0 +1,87 @@
+/*================================================================
+	* util/packing.h
+	*
+	* Copyright (c) 2021 Lauri Räsänen
+	* ================================
+
+	Vertex attribute packing helpers.
+	Shaders unpack these manually from uint attributes.
+=================================================================*/
+
+#ifndef MG_PACKING_H
+#define MG_PACKING_H
+
+#include <gs/gs.h>
+
+// Float to half float, rounds to nearest.
+// Values too small for a normal half flush to zero.
+static inline uint16_t mg_float_to_half(float32_t value)
+{
+	union
+	{
+		float32_t f;
+		uint32_t u;
+	} bits = {.f = value};
+
+	uint32_t sign	  = (bits.u >> 16) & 0x8000;
+	int32_t exponent  = (int32_t)((bits.u >> 23) & 0xff) - 127 + 15;
+	uint32_t mantissa = bits.u & 0x7fffff;
+
+	if (exponent <= 0) return sign;
+	if (exponent >= 31) return sign | 0x7c00;
+
+	// Rounding can carry into the exponent, which is still correct
+	uint32_t half = sign | (exponent << 10) | (mantissa >> 13);
+	if (mantissa & 0x1000) half++;
+
+	return half;
+}
+
+static inline uint32_t mg_pack_half2(const gs_vec2 v)
+{
+	return mg_float_to_half(v.x) | ((uint32_t)mg_float_to_half(v.y) << 16);
+}
+
+static inline uint32_t mg_pack_unorm16x2(const gs_vec2 v)
+{
+	uint32_t x = (uint32_t)(gs_clamp(v.x, 0.0f, 1.0f) * 65535.0f + 0.5f);
+	uint32_t y = (uint32_t)(gs_clamp(v.y, 0.0f, 1.0f) * 65535.0f + 0.5f);
+	return x | (y << 16);
+}
+
+static inline uint32_t mg_pack_snorm16x2(const gs_vec2 v)
+{
+	int32_t x = (int32_t)roundf(gs_clamp(v.x, -1.0f, 1.0f) * 32767.0f);
+	int32_t y = (int32_t)roundf(gs_clamp(v.y, -1.0f, 1.0f) * 32767.0f);
+	return ((uint32_t)x & 0xffff) | (((uint32_t)y & 0xffff) << 16);
+}
+
+static inline uint16_t mg_pack_snorm8x2(const gs_vec2 v)
+{
+	int32_t x = (int32_t)roundf(gs_clamp(v.x, -1.0f, 1.0f) * 127.0f);
+	int32_t y = (int32_t)roundf(gs_clamp(v.y, -1.0f, 1.0f) * 127.0f);
+	return ((uint32_t)x & 0xff) | (((uint32_t)y & 0xff) << 8);
+}
+
+// Map unit vector to [-1, 1]^2 using octahedral projection
+static inline gs_vec2 mg_oct_encode(const gs_vec3 n)
+{
+	float32_t l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	if (l1 == 0) return gs_v2(0, 0);
+
+	float32_t x = n.x / l1;
+	float32_t y = n.y / l1;
+
+	// Fold lower hemisphere over the diagonals
+	if (n.z < 0)
+	{
+		float32_t fx = (1.0f - fabsf(y)) * (x >= 0 ? 1.0f : -1.0f);
+		float32_t fy = (1.0f - fabsf(x)) * (y >= 0 ? 1.0f : -1.0f);
+		x	     = fx;
+		y	     = fy;
+	}
+
+	return gs_v2(x, y);
+}
+
+#endif // MG_PACKING_H
\ No newline at end of file
@@ -0,0 +1,22 @@
+/*================================================================
+	* util/simd.h
+	*
+	* Copyright (c) 2021 Lauri Räsänen
+	* ================================
+
+	Select SIMD instruction set for hot loops.
+	Code using these should always have a scalar fallback.
+=================================================================*/
+
+#ifndef MG_UTIL_SIMD_H
+#define MG_UTIL_SIMD_H
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define MG_SIMD_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MG_SIMD_NEON
+#endif
+
+#endif // MG_UTIL_SIMD_H
@@ -0,0 +1,144 @@
+/*================================================================
+	* util/thread.h
+	*
+	* Copyright (c) 2021 Lauri Räsänen
+	* ================================
+
+	Minimal worker thread helpers over pthreads and Win32.
+=================================================================*/
+
+#ifndef MG_UTIL_THREAD_H
+#define MG_UTIL_THREAD_H
+
+#include <gs/gs.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+// Upper limit for worker threads of one job
+#define MG_THREAD_MAX_WORKERS 8
+
+typedef void (*mg_thread_func_t)(void *arg);
+
+typedef struct mg_thread_start_t
+{
+	mg_thread_func_t func;
+	void *arg;
+} mg_thread_start_t;
+
+typedef struct mg_thread_t
+{
+#ifdef _WIN32
+	HANDLE handle;
+#else
+	pthread_t handle;
+#endif
+	mg_thread_start_t *start;
+	bool32_t valid;
+} mg_thread_t;
+
+#ifdef _WIN32
+static DWORD WINAPI _mg_thread_entry(LPVOID param)
+{
+	mg_thread_start_t *start = param;
+	start->func(start->arg);
+	return 0;
+}
+#else
+static void *_mg_thread_entry(void *param)
+{
+	mg_thread_start_t *start = param;
+	start->func(start->arg);
+	return NULL;
+}
+#endif
+
+// Start func(arg) on a new thread.
+// Returns false if the thread could not be created.
+static inline bool32_t mg_thread_create(mg_thread_t *thread, mg_thread_func_t func, void *arg)
+{
+	thread->start	    = gs_malloc(sizeof(mg_thread_start_t));
+	thread->start->func = func;
+	thread->start->arg  = arg;
+
+#ifdef _WIN32
+	thread->handle = CreateThread(NULL, 0, _mg_thread_entry, thread->start, 0, NULL);
+	thread->valid  = thread->handle != NULL;
+#else
+	thread->valid = pthread_create(&thread->handle, NULL, _mg_thread_entry, thread->start) == 0;
+#endif
+
+	if (!thread->valid)
+	{
+		gs_free(thread->start);
+		thread->start = NULL;
+	}
+
+	return thread->valid;
+}
+
+static inline void mg_thread_join(mg_thread_t *thread)
+{
+	if (!thread->valid) return;
+
+#ifdef _WIN32
+	WaitForSingleObject(thread->handle, INFINITE);
+	CloseHandle(thread->handle);
+#else
+	pthread_join(thread->handle, NULL);
+#endif
+
+	gs_free(thread->start);
+	thread->start = NULL;
+	thread->valid = false;
+}
+
+// Number of worker threads worth starting for a job,
+// including the calling thread.
+static inline uint32_t mg_thread_worker_count()
+{
+	int32_t count = 1;
+
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	count = info.dwNumberOfProcessors;
+#else
+	count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+	return gs_clamp(count, 1, MG_THREAD_MAX_WORKERS);
+}
+
+// Run func(args + i * arg_size) for count args, spread over worker threads.
+// The calling thread runs the first one. Falls back to running
+// on the calling thread if threads can't be created.
+static inline void mg_thread_run(mg_thread_func_t func, void *args, size_t arg_size, uint32_t count)
+{
+	mg_thread_t threads[MG_THREAD_MAX_WORKERS];
+	count = gs_min(count, MG_THREAD_MAX_WORKERS);
+
+	for (size_t i = 1; i < count; i++)
+	{
+		if (!mg_thread_create(&threads[i], func, (uint8_t *)args + i * arg_size))
+		{
+			func((uint8_t *)args + i * arg_size);
+		}
+	}
+
+	if (count > 0)
+	{
+		func(args);
+	}
+
+	for (size_t i = 1; i < count; i++)
+	{
+		mg_thread_join(&threads[i]);
+	}
+}
+
+#endif // MG_UTIL_THREAD_H
\ No newline at end of file
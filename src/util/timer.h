@@ -0,0 +1,41 @@
+/*================================================================
+	* util/timer.h
+	*
+	* Copyright (c) 2021 Lauri Räsänen
+	* ================================
+
+	High resolution timer that doesn't need the platform layer,
+	for measuring code that can run on any thread or headless.
+=================================================================*/
+
+#ifndef MG_UTIL_TIMER_H
+#define MG_UTIL_TIMER_H
+
+#include <gs/gs.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+// Monotonic time in nanoseconds, only meaningful as a difference
+static inline uint64_t mg_timer_now_ns()
+{
+#ifdef _WIN32
+	static LARGE_INTEGER frequency = {0};
+	LARGE_INTEGER counter;
+	if (frequency.QuadPart == 0)
+	{
+		QueryPerformanceFrequency(&frequency);
+	}
+	QueryPerformanceCounter(&counter);
+	return (uint64_t)((counter.QuadPart / frequency.QuadPart) * 1000000000ull + (counter.QuadPart % frequency.QuadPart) * 1000000000ull / frequency.QuadPart);
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+#endif
+}
+
+#endif // MG_UTIL_TIMER_H
\ No newline at end of file